@@ -0,0 +1,227 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "Affinity.h"
+
+#include "GTP.h"
+#include "Utils.h"
+
+using namespace Utils;
+
+// Nodes this process has CPUs on, with their CPUs in the order threads
+// are pinned to them.
+struct Node {
+    int id;
+    std::vector<int> cpus;
+};
+static std::vector<Node> s_nodes;
+static std::atomic<size_t> s_next_slot{0};
+static std::array<std::atomic<size_t>, Affinity::MAX_NODES> s_next_node_slot;
+static thread_local size_t t_node = 0;
+
+#ifdef __linux__
+// Parses a sysfs CPU list such as "0-3,8-11".
+static std::vector<int> parse_cpu_list(const std::string& list) {
+    auto cpus = std::vector<int>{};
+    auto ss = std::stringstream{list};
+    auto range = std::string{};
+    while (std::getline(ss, range, ',')) {
+        const auto dash = range.find('-');
+        try {
+            const auto first = std::stoi(range.substr(0, dash));
+            const auto last = dash == std::string::npos
+                                  ? first
+                                  : std::stoi(range.substr(dash + 1));
+            for (auto cpu = first; cpu <= last; cpu++) {
+                cpus.emplace_back(cpu);
+            }
+        } catch (...) {
+            // Blank or malformed entry.
+        }
+    }
+    return cpus;
+}
+
+static void set_thread_cpus(const std::vector<int>& cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (const auto cpu : cpus) {
+        CPU_SET(cpu, &set);
+    }
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+static void set_memory_policy(void* const data, const size_t size,
+                              const int mode, const std::uint64_t nodemask) {
+    // The policy applies to whole pages inside the range.
+    const auto page = std::uintptr_t(sysconf(_SC_PAGESIZE));
+    const auto begin = (std::uintptr_t(data) + page - 1) & ~(page - 1);
+    const auto end = (std::uintptr_t(data) + size) & ~(page - 1);
+    if (end > begin) {
+        syscall(SYS_mbind, begin, end - begin, mode, &nodemask,
+                Affinity::MAX_NODES + 1, 0);
+    }
+}
+#endif
+
+void Affinity::initialize() {
+    s_nodes.clear();
+#ifdef __linux__
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+
+    for (auto node = size_t{0}; node < MAX_NODES; node++) {
+        auto file = std::ifstream{"/sys/devices/system/node/node"
+                                  + std::to_string(node) + "/cpulist"};
+        auto list = std::string{};
+        if (!file || !std::getline(file, list)) {
+            continue;
+        }
+        auto cpus = parse_cpu_list(list);
+        cpus.erase(std::remove_if(begin(cpus), end(cpus),
+                                  [&](const int cpu) {
+                                      return cpu >= CPU_SETSIZE
+                                             || !CPU_ISSET(cpu, &allowed);
+                                  }),
+                   end(cpus));
+        if (!cpus.empty()) {
+            s_nodes.push_back({int(node), std::move(cpus)});
+        }
+    }
+    if (s_nodes.empty()) {
+        auto cpus = std::vector<int>{};
+        for (auto cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &allowed)) {
+                cpus.emplace_back(cpu);
+            }
+        }
+        s_nodes.push_back({0, std::move(cpus)});
+    }
+
+    auto cores = size_t{0};
+    for (const auto& node : s_nodes) {
+        cores += node.cpus.size();
+    }
+    myprintf("Pinning threads to %zu cores on %zu NUMA node%s.\n",
+             cores, s_nodes.size(), s_nodes.size() > 1 ? "s" : "");
+#else
+    myprintf("Thread affinity is not supported on this system.\n");
+#endif
+}
+
+size_t Affinity::get_num_nodes() {
+    return std::max(s_nodes.size(), size_t{1});
+}
+
+size_t Affinity::get_current_node() {
+    return t_node;
+}
+
+void Affinity::pin_thread(size_t node) {
+    if (s_nodes.empty()) {
+        return;
+    }
+    auto cpu_index = size_t{0};
+    if (node == ANY_NODE) {
+        const auto slot = s_next_slot++;
+        node = slot % s_nodes.size();
+        cpu_index = slot / s_nodes.size();
+    } else {
+        node %= s_nodes.size();
+        cpu_index = s_next_node_slot[node]++;
+    }
+    const auto& cpus = s_nodes[node].cpus;
+    t_node = node;
+#ifdef __linux__
+    set_thread_cpus({cpus[cpu_index % cpus.size()]});
+#endif
+}
+
+void Affinity::run_on_node(const size_t node, const std::function<void()>& f) {
+    if (s_nodes.size() <= 1) {
+        f();
+        return;
+    }
+    auto thread = std::thread([node, &f]() {
+        t_node = node % s_nodes.size();
+#ifdef __linux__
+        set_thread_cpus(s_nodes[t_node].cpus);
+#endif
+        f();
+    });
+    thread.join();
+}
+
+void Affinity::prefer_current_node(void* const data, const size_t size) {
+#ifdef __linux__
+    if (s_nodes.size() > 1) {
+        set_memory_policy(data, size, MPOL_PREFERRED,
+                          std::uint64_t{1} << s_nodes[t_node].id);
+    }
+#else
+    (void)data;
+    (void)size;
+#endif
+}
+
+void Affinity::interleave(void* const data, const size_t size) {
+#ifdef __linux__
+    if (s_nodes.size() > 1) {
+        auto mask = std::uint64_t{0};
+        for (const auto& node : s_nodes) {
+            mask |= std::uint64_t{1} << node.id;
+        }
+        set_memory_policy(data, size, MPOL_INTERLEAVE, mask);
+    }
+#else
+    (void)data;
+    (void)size;
+#endif
+}
@@ -0,0 +1,66 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef AFFINITY_H_INCLUDED
+#define AFFINITY_H_INCLUDED
+
+#include "config.h"
+
+#include <cstddef>
+#include <functional>
+
+// Thread placement on cores and NUMA nodes.  Without --affinity, or on
+// systems where the topology can't be read, this is all a no-op and the
+// machine is a single node.  On a single node machine threads are only
+// pinned to cores.
+namespace Affinity {
+    constexpr size_t MAX_NODES = 64;
+    constexpr size_t ANY_NODE = MAX_NODES;
+
+    // Reads the topology, limited to the CPUs this process may use.
+    void initialize();
+    size_t get_num_nodes();
+
+    // Pins the calling thread to the next free core, going round the
+    // nodes, or of the given node only.
+    void pin_thread(size_t node = ANY_NODE);
+    // The node the calling thread was pinned to, 0 if none.
+    size_t get_current_node();
+
+    // Runs f on a thread bound to the given node, so that the memory it
+    // first touches is allocated there, and waits for it.
+    void run_on_node(size_t node, const std::function<void()>& f);
+
+    // Memory policies for pages that were not touched yet.  Nothing is
+    // done on a single node machine.
+    void prefer_current_node(void* data, size_t size);
+    void interleave(void* data, size_t size);
+}
+
+#endif
@@ -0,0 +1,219 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <boost/format.hpp>
+#include <cctype>
+#include <exception>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "BatchAnalysis.h"
+
+#include "FastBoard.h"
+#include "GTP.h"
+#include "SGFTree.h"
+#include "Training.h"
+#include "UCTSearch.h"
+#include "Utils.h"
+
+using namespace Utils;
+
+static std::string json_escape(const std::string& text) {
+    auto res = std::string{};
+    for (const auto c : text) {
+        if (c == '"' || c == '\\') {
+            res += '\\';
+            res += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            res += str(boost::format("\\u%04x") % int(c));
+        } else {
+            res += c;
+        }
+    }
+    return res;
+}
+
+// Scans the board like the search does, the neighbour counts of the
+// board don't see the starting stones.
+static bool has_legal_move(const GameState& state, const int color) {
+    for (auto i = 0; i < NUM_INTERSECTIONS; i++) {
+        const auto vertex =
+            state.board.get_vertex(i % BOARD_SIZE, i / BOARD_SIZE);
+        if (state.is_move_legal(color, vertex)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+BatchAnalysis::BatchAnalysis(Network& network) : m_network(network) {}
+
+bool BatchAnalysis::run(const std::string& filename, const int parallel) {
+    m_in.open(filename);
+    if (!m_in) {
+        myprintf("Could not read positions from %s.\n", filename.c_str());
+        return false;
+    }
+    m_network.set_shared(parallel > 1);
+    auto threads = std::vector<std::thread>{};
+    for (auto i = 0; i < parallel; i++) {
+        threads.emplace_back([this]() { analyze_positions(); });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return true;
+}
+
+bool BatchAnalysis::next_position(int& line, std::string& position) {
+    std::lock_guard<std::mutex> lock(m_in_mutex);
+    while (std::getline(m_in, position)) {
+        line = ++m_line;
+        const auto first = position.find_first_not_of(" \t\r");
+        if (first != std::string::npos && position[first] != '#') {
+            return true;
+        }
+    }
+    return false;
+}
+
+void BatchAnalysis::analyze_positions() {
+    // The workers of a search keep their threads until it stops, so
+    // the searches can't share the global pool.
+    auto pool = ThreadPool{};
+    pool.initialize(cfg_num_threads);
+    auto line = 0;
+    auto position = std::string{};
+    while (next_position(line, position)) {
+        const auto result = analyze(line, position, pool);
+        std::lock_guard<std::mutex> lock(m_out_mutex);
+        std::cout << result << std::endl;
+    }
+}
+
+bool BatchAnalysis::parse_position(const std::string& position,
+                                   GameState& state) {
+    auto in = std::istringstream{position};
+    auto format = std::string{};
+    in >> format;
+    state.init_game(BOARD_SIZE, KOMI);
+    state.set_timecontrol(0, 1, 0, 0); // Set infinite time.
+
+    if (format == "sgf") {
+        auto filename = std::string{};
+        auto movenum = 999;
+        in >> filename;
+        if (!in) {
+            return false;
+        }
+        in >> movenum;
+        auto sgftree = SGFTree{};
+        try {
+            sgftree.load_from_file(filename);
+            state = sgftree.follow_mainline_state(movenum - 1);
+            state.set_timecontrol(0, 1, 0, 0); // Set infinite time.
+        } catch (const std::exception&) {
+            return false;
+        }
+        return true;
+    }
+
+    if (format != "moves") {
+        return false;
+    }
+    // Moves are letters then digits, with or without spaces between.
+    auto moves = std::string{};
+    std::getline(in, moves);
+    auto pos = size_t{0};
+    for (;;) {
+        while (pos < moves.size()
+               && std::isspace(static_cast<unsigned char>(moves[pos]))) {
+            pos++;
+        }
+        if (pos == moves.size()) {
+            return true;
+        }
+        auto token = std::string{};
+        while (pos < moves.size()
+               && std::isalpha(static_cast<unsigned char>(moves[pos]))) {
+            token += moves[pos++];
+        }
+        while (pos < moves.size()
+               && std::isdigit(static_cast<unsigned char>(moves[pos]))) {
+            token += moves[pos++];
+        }
+        const auto move = state.board.text_to_move(token);
+        if (token.empty() || move == FastBoard::NO_VERTEX
+            || move == FastBoard::RESIGN) {
+            return false;
+        }
+        auto color = state.get_to_move();
+        if (IS_OTHELLO && move != FastBoard::PASS
+            && !has_legal_move(state, color)) {
+            // Transcripts leave out forced passes.
+            state.play_move(color, FastBoard::PASS);
+            color = !color;
+        }
+        const auto legal = (IS_OTHELLO && move == FastBoard::PASS)
+                               ? !has_legal_move(state, color)
+                               : state.is_move_legal(color, move);
+        if (!legal) {
+            return false;
+        }
+        state.play_move(color, move);
+    }
+}
+
+std::string BatchAnalysis::analyze(const int line,
+                                   const std::string& position,
+                                   ThreadPool& pool) {
+    const auto head = str(boost::format("{\"line\":%d,\"position\":\"%s\"")
+                          % line % json_escape(position));
+    auto game = GameState{};
+    if (!parse_position(position, game)) {
+        return head + ",\"error\":\"invalid position\"}";
+    }
+
+    const auto color = game.get_to_move();
+    auto search = UCTSearch{game, m_network};
+    search.set_thread_pool(pool, cfg_num_threads);
+    const auto move = search.think(color, UCTSearch::NORESIGN);
+    // The search records every position for training.
+    Training::clear_training();
+
+    return head
+           + str(boost::format(",\"color\":\"%s\",\"move\":\"%s\","
+                               "\"analysis\":%s}")
+                 % (color == FastBoard::BLACK ? "b" : "w")
+                 % game.move_to_text(move) % search.get_analysis_json());
+}
@@ -0,0 +1,81 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef BATCHANALYSIS_H_INCLUDED
+#define BATCHANALYSIS_H_INCLUDED
+
+#include "config.h"
+
+#include <fstream>
+#include <mutex>
+#include <string>
+
+#include "GameState.h"
+#include "ThreadPool.h"
+
+class Network;
+
+// Searches the positions listed in a file, several at once, and writes
+// one line of JSON per position to stdout as soon as it is done.  The
+// searches share the network and its cache, every one of them has its
+// own tree, its own --threads threads and the visit or playout limit
+// of a move.
+//
+// Every line of the file holds one position:
+//   sgf <file> [<move number>]  the main line of an SGF file, up to the
+//                               move number, to the end by default
+//   moves <moves>               the moves from the start position, like
+//                               "f5d6c3d3" or "f5 d6 c3 d3", passes are
+//                               added where a side has no legal move
+// Blank lines and lines starting with # are skipped.
+class BatchAnalysis {
+public:
+    explicit BatchAnalysis(Network& network);
+
+    // Returns false if the file can't be read.
+    bool run(const std::string& filename, int parallel);
+
+    // Sets up state from a line of the file, false if it is not valid.
+    static bool parse_position(const std::string& position,
+                               GameState& state);
+
+private:
+    bool next_position(int& line, std::string& position);
+    void analyze_positions();
+    std::string analyze(int line, const std::string& position,
+                        Utils::ThreadPool& pool);
+
+    Network& m_network;
+    std::ifstream m_in;
+    int m_line{0};
+    std::mutex m_in_mutex;
+    std::mutex m_out_mutex;
+};
+
+#endif
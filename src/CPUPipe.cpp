@@ -32,6 +32,10 @@
 
 #include "config.h"
 
+#include <algorithm>
+#include <array>
+#include <string>
+
 #ifdef __APPLE__
 #include <Accelerate/Accelerate.h>
 #endif
@@ -46,6 +50,10 @@
 #endif
 
 #include "CPUPipe.h"
+
+#include "Affinity.h"
+#include "CPUTuner.h"
+#include "GTP.h"
 #include "Im2Col.h"
 #include "Network.h"
 
@@ -59,19 +67,99 @@ using ConstEigenMatrixMap =
     Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>>;
 #endif
 
-// Initializes the CPU Pipe.
+// F(2x2, 3x3) Winograd tiles, for layers where the smaller transforms
+// pay off.
+constexpr auto WINOGRAD2_M = 2;
+constexpr auto WINOGRAD2_ALPHA = WINOGRAD2_M + 3 - 1;
+constexpr auto WINOGRAD2_WTILES =
+    BOARD_SIZE / WINOGRAD2_M + (BOARD_SIZE % WINOGRAD2_M != 0);
+constexpr auto WINOGRAD2_TILE = WINOGRAD2_ALPHA * WINOGRAD2_ALPHA;
+constexpr auto WINOGRAD2_P = WINOGRAD2_WTILES * WINOGRAD2_WTILES;
+
+constexpr std::array<int, 2> CPUPipe::TUNED_BATCH_SIZES;
+
+// Calls f(begin, end) on ranges that split [0, count) evenly over up to
+// the given number of threads.  The calling thread does the first range.
+template <typename F>
+static void split_work(Utils::ThreadPool* const pool, const int threads,
+                       const int count, F&& f) {
+    const auto parts = pool ? std::max(1, std::min(threads, count)) : 1;
+    if (parts == 1) {
+        f(0, count);
+        return;
+    }
+    Utils::ThreadGroup(*pool).parallel_for(parts, count, f);
+}
+
+// Size of the output channel blocks of the GEMMs.
+static int output_block_size(const int outputs, const int output_block) {
+    return output_block > 0 ? std::min(output_block, outputs) : outputs;
+}
+
+// Initializes the CPU Pipe, tuning the convolutions if this machine
+// has no tuning for the network shape yet.
 void CPUPipe::initialize(int channels) {
     m_input_channels = channels;
+
+    const auto gemm_threads = static_cast<int>(cfg_gemm_threads);
+    if (gemm_threads > 1) {
+        m_gemm_pool = std::make_unique<Utils::ThreadPool>();
+        if (cfg_affinity) {
+            // Helpers stay on the node of the pipe they work for.
+            const auto node = Affinity::get_current_node();
+            for (auto i = 1; i < gemm_threads; i++) {
+                m_gemm_pool->add_thread(
+                    [node]() { Affinity::pin_thread(node); });
+            }
+        } else {
+            m_gemm_pool->initialize(gemm_threads - 1);
+        }
+    }
+
+    auto tuner = CPUTuner{m_gemm_pool.get(), std::max(1, gemm_threads)};
+    for (auto i = size_t{0}; i < TUNED_BATCH_SIZES.size(); i++) {
+        m_conv_params[i][INPUT_LAYER] = tuner.load_conv_tuning(
+            Network::INPUT_CHANNELS, channels, TUNED_BATCH_SIZES[i]);
+        m_conv_params[i][RESIDUAL_LAYER] =
+            tuner.load_conv_tuning(channels, channels, TUNED_BATCH_SIZES[i]);
+    }
+}
+
+std::string CPUPipe::algorithm_to_string(const ConvAlgorithm algorithm) {
+    switch (algorithm) {
+        case ConvAlgorithm::WINOGRAD_F4: return "winograd4";
+        case ConvAlgorithm::WINOGRAD_F2: return "winograd2";
+        case ConvAlgorithm::IM2COL: return "im2col";
+        case ConvAlgorithm::DIRECT: return "direct";
+    }
+    return "";
+}
+
+bool CPUPipe::algorithm_from_string(const std::string& name,
+                                    ConvAlgorithm& algorithm) {
+    for (auto i = 0; i < CONV_ALGORITHMS; i++) {
+        const auto candidate = static_cast<ConvAlgorithm>(i);
+        if (name == algorithm_to_string(candidate)) {
+            algorithm = candidate;
+            return true;
+        }
+    }
+    return false;
 }
 
 // Applies a winograd transformation on the input data "in" and stores
-// the transformed data in the vector V.
+// the transformed data in the vector V.  The tiles of all positions in
+// the batch are stored next to each other, so that one matrix
+// multiplication per tile element covers the whole batch.
 void CPUPipe::winograd_transform_in(const std::vector<float>& in,
-                                    std::vector<float>& V, const int C) {
+                                    std::vector<float>& V, const int C,
+                                    const int batch_size, const int chb_begin,
+                                    const int chb_end) {
     constexpr auto W = BOARD_SIZE;
     constexpr auto H = BOARD_SIZE;
     constexpr auto WTILES = WINOGRAD_WTILES;
     constexpr auto P = WINOGRAD_P;
+    const auto PB = P * batch_size;
 
     constexpr auto Wpad = 2 + WINOGRAD_M * WTILES;
 
@@ -111,10 +199,13 @@ void CPUPipe::winograd_transform_in(const std::vector<float>& in,
         o5 = i1 + i3 * (-5.0f / 2.0f) + i5;
     };
 
-    for (auto ch = 0; ch < C; ch++) {
+    for (auto chb = chb_begin; chb < chb_end; chb++) {
+        const auto ch = chb / batch_size;
+        const auto batch = chb % batch_size;
+        const auto in_offset = (batch * C + ch) * (W * H);
         for (auto yin = 0; yin < H; yin++) {
             for (auto xin = 0; xin < W; xin++) {
-                in_pad[yin + 1][xin + 1] = in[ch * (W * H) + yin * W + xin];
+                in_pad[yin + 1][xin + 1] = in[in_offset + yin * W + xin];
             }
         }
         for (auto block_y = 0; block_y < WTILES; block_y++) {
@@ -167,17 +258,17 @@ void CPUPipe::winograd_transform_in(const std::vector<float>& in,
                 MULTIPLY_B(5)
 
                 if (buffer_entries == 0) {
-                    buffer_offset = ch * P + block_y * WTILES + block_x;
+                    buffer_offset = chb * P + block_y * WTILES + block_x;
                 }
                 buffer_entries++;
 
                 if (buffer_entries >= buffersize
-                    || (ch == C - 1 && block_x == WTILES - 1
+                    || (chb == chb_end - 1 && block_x == WTILES - 1
                         && block_y == WTILES - 1)) {
 
                     for (auto i = 0; i < WINOGRAD_ALPHA * WINOGRAD_ALPHA; i++) {
                         for (auto entry = 0; entry < buffer_entries; entry++) {
-                            V[i * C * P + buffer_offset + entry] =
+                            V[i * C * PB + buffer_offset + entry] =
                                 buffer[i * buffersize + entry];
                         }
                     }
@@ -189,30 +280,40 @@ void CPUPipe::winograd_transform_in(const std::vector<float>& in,
 }
 
 // Performs matrix multiplication using the data transofrmed by the
-// winograd transformation.
+// winograd transformation.  P is the number of tiles of the whole batch.
+// The output channels are done in blocks of output_block, which keeps
+// the part of U in use small for wide layers.  Every tile of every
+// block is a unit of work, and this does the units in [begin, end).
 void CPUPipe::winograd_sgemm(const std::vector<float>& U,
                              const std::vector<float>& V,
                              std::vector<float>& M,
-                             const int C, const int K) {
-    constexpr auto P = WINOGRAD_P;
+                             const int C, const int K, const int tiles,
+                             const int P, const int output_block,
+                             const int unit_begin, const int unit_end) {
+    const auto block = output_block_size(K, output_block);
 
-    for (auto b = 0; b < WINOGRAD_TILE; b++) {
+    for (auto unit = unit_begin; unit < unit_end; unit++) {
+        const auto k0 = (unit / tiles) * block;
+        const auto kb = std::min(block, K - k0);
+        const auto b = unit % tiles;
         const auto offset_u = b * K * C;
         const auto offset_v = b * C * P;
         const auto offset_m = b * K * P;
 #ifdef USE_BLAS
         cblas_sgemm(CblasRowMajor, CblasTrans, CblasNoTrans,
-                    K, P, C,
+                    kb, P, C,
                     1.0f,
-                    &U[offset_u], K,
+                    &U[offset_u + k0], K,
                     &V[offset_v], P,
                     0.0f,
-                    &M[offset_m], P);
+                    &M[offset_m + k0 * P], P);
 #else
-        auto C_mat = EigenMatrixMap<float>(M.data() + offset_m, P, K);
+        auto C_mat = EigenMatrixMap<float>(M.data() + offset_m + k0 * P, P, kb);
         C_mat.noalias() =
             ConstEigenMatrixMap<float>(V.data() + offset_v, P, C)
-            * ConstEigenMatrixMap<float>(U.data() + offset_u, K, C).transpose();
+            * ConstEigenMatrixMap<float>(U.data() + offset_u, K, C)
+                  .middleRows(k0, kb)
+                  .transpose();
         // Piece that performs the multiplication.
 #endif
     }
@@ -221,11 +322,14 @@ void CPUPipe::winograd_sgemm(const std::vector<float>& U,
 // Reverses the winograd transformation after the matrix
 // multiplication to obtain the output from the channels.
 void CPUPipe::winograd_transform_out(const std::vector<float>& M,
-                                     std::vector<float>& Y, const int K) {
+                                     std::vector<float>& Y, const int K,
+                                     const int batch_size, const int bk_begin,
+                                     const int bk_end) {
     constexpr auto W = BOARD_SIZE;
     constexpr auto H = BOARD_SIZE;
     constexpr auto WTILES = WINOGRAD_WTILES;
     constexpr auto P = WINOGRAD_P;
+    const auto PB = P * batch_size;
 
     // multiple vector [i0..i5] by At and produce [o0..o3]
     // const auto At = std::array<float, WINOGRAD_ALPHA * WINOGRAD_M>{
@@ -252,13 +356,15 @@ void CPUPipe::winograd_transform_out(const std::vector<float>& M,
 
     // Iterates for every channel in the output and reverses the
     // winograd transformation to obtain the actual output.
-    for (auto k = 0; k < K; k++) {
+    for (auto bk = bk_begin; bk < bk_end; bk++) {
+        const auto batch = bk / K;
+        const auto k = bk % K;
         for (auto block_x = 0; block_x < WTILES; block_x++) {
             const auto x = WINOGRAD_M * block_x;
             for (auto block_y = 0; block_y < WTILES; block_y++) {
                 const auto y = WINOGRAD_M * block_y;
 
-                const auto b = block_y * WTILES + block_x;
+                const auto b = batch * P + block_y * WTILES + block_x;
                 using WinogradTile =
                     std::array<std::array<float, WINOGRAD_ALPHA>,
                                WINOGRAD_ALPHA>;
@@ -266,7 +372,7 @@ void CPUPipe::winograd_transform_out(const std::vector<float>& M,
                 for (auto xi = 0; xi < WINOGRAD_ALPHA; xi++) {
                     for (auto nu = 0; nu < WINOGRAD_ALPHA; nu++) {
                         temp_m[xi][nu] =
-                            M[(xi * WINOGRAD_ALPHA + nu) * K * P + k * P + b];
+                            M[(xi * WINOGRAD_ALPHA + nu) * K * PB + k * PB + b];
                     }
                 }
                 std::array<std::array<float, WINOGRAD_ALPHA>, WINOGRAD_M> temp;
@@ -285,7 +391,7 @@ void CPUPipe::winograd_transform_out(const std::vector<float>& M,
                                 temp[i][3], temp[i][4], temp[i][5]);
                 }
 
-                const auto y_ind = k * H * W + y * W + x;
+                const auto y_ind = bk * H * W + y * W + x;
                 for (auto i = 0; i < WINOGRAD_M; i++) {
                     for (auto j = 0; j < WINOGRAD_M; j++) {
                         if (y + i < H && x + j < W) {
@@ -298,21 +404,445 @@ void CPUPipe::winograd_transform_out(const std::vector<float>& M,
     }
 }
 
-// Takes the inputs and calls the winograd transformation pipeline to
-// get the output of the convolutional layers.
-void CPUPipe::winograd_convolve3(const int outputs,
-                                 const std::vector<float>& input,
-                                 const std::vector<float>& U,
-                                 std::vector<float>& V,
-                                 std::vector<float>& M,
-                                 std::vector<float>& output) {
-
-    constexpr unsigned int filter_len = WINOGRAD_ALPHA * WINOGRAD_ALPHA;
-    const auto input_channels = U.size() / (outputs * filter_len);
-
-    winograd_transform_in(input, V, input_channels);
-    winograd_sgemm(U, V, M, input_channels, outputs);
-    winograd_transform_out(M, output, outputs);
+// F(2x2, 3x3) version of winograd_transform_in, with 4x4 tiles that
+// overlap by 2.
+void CPUPipe::winograd2_transform_in(const std::vector<float>& in,
+                                     std::vector<float>& V, const int C,
+                                     const int batch_size, const int chb_begin,
+                                     const int chb_end) {
+    constexpr auto W = BOARD_SIZE;
+    constexpr auto H = BOARD_SIZE;
+    constexpr auto WTILES = WINOGRAD2_WTILES;
+    constexpr auto P = WINOGRAD2_P;
+    constexpr auto ALPHA = WINOGRAD2_ALPHA;
+    const auto PB = P * batch_size;
+
+    constexpr auto Wpad = 2 + WINOGRAD2_M * WTILES;
+
+    std::array<std::array<float, Wpad>, Wpad> in_pad{{{0.0f}}};
+
+    // Bt = {1.0f,  0.0f, -1.0f,  0.0f,
+    //       0.0f,  1.0f,  1.0f,  0.0f,
+    //       0.0f, -1.0f,  1.0f,  0.0f,
+    //       0.0f,  1.0f,  0.0f, -1.0f}
+    for (auto chb = chb_begin; chb < chb_end; chb++) {
+        const auto ch = chb / batch_size;
+        const auto batch = chb % batch_size;
+        const auto in_offset = (batch * C + ch) * (W * H);
+        for (auto yin = 0; yin < H; yin++) {
+            for (auto xin = 0; xin < W; xin++) {
+                in_pad[yin + 1][xin + 1] = in[in_offset + yin * W + xin];
+            }
+        }
+        for (auto block_y = 0; block_y < WTILES; block_y++) {
+            const auto yin = WINOGRAD2_M * block_y;
+            for (auto block_x = 0; block_x < WTILES; block_x++) {
+                const auto xin = WINOGRAD2_M * block_x;
+
+                // Calculates transpose(B).x.B
+                std::array<std::array<float, ALPHA>, ALPHA> T1;
+                for (auto j = 0; j < ALPHA; j++) {
+                    const auto d0 = in_pad[yin + 0][xin + j];
+                    const auto d1 = in_pad[yin + 1][xin + j];
+                    const auto d2 = in_pad[yin + 2][xin + j];
+                    const auto d3 = in_pad[yin + 3][xin + j];
+                    T1[0][j] = d0 - d2;
+                    T1[1][j] = d1 + d2;
+                    T1[2][j] = d2 - d1;
+                    T1[3][j] = d1 - d3;
+                }
+                const auto offset = chb * P + block_y * WTILES + block_x;
+                for (auto i = 0; i < ALPHA; i++) {
+                    const auto& t = T1[i];
+                    V[(i * ALPHA + 0) * C * PB + offset] = t[0] - t[2];
+                    V[(i * ALPHA + 1) * C * PB + offset] = t[1] + t[2];
+                    V[(i * ALPHA + 2) * C * PB + offset] = t[2] - t[1];
+                    V[(i * ALPHA + 3) * C * PB + offset] = t[1] - t[3];
+                }
+            }
+        }
+    }
+}
+
+// F(2x2, 3x3) version of winograd_transform_out.
+void CPUPipe::winograd2_transform_out(const std::vector<float>& M,
+                                      std::vector<float>& Y, const int K,
+                                      const int batch_size, const int bk_begin,
+                                      const int bk_end) {
+    constexpr auto W = BOARD_SIZE;
+    constexpr auto H = BOARD_SIZE;
+    constexpr auto WTILES = WINOGRAD2_WTILES;
+    constexpr auto P = WINOGRAD2_P;
+    constexpr auto ALPHA = WINOGRAD2_ALPHA;
+    const auto PB = P * batch_size;
+
+    // At = {1.0f, 1.0f,  1.0f,  0.0f,
+    //       0.0f, 1.0f, -1.0f, -1.0f}
+    for (auto bk = bk_begin; bk < bk_end; bk++) {
+        const auto batch = bk / K;
+        const auto k = bk % K;
+        for (auto block_y = 0; block_y < WTILES; block_y++) {
+            const auto y = WINOGRAD2_M * block_y;
+            for (auto block_x = 0; block_x < WTILES; block_x++) {
+                const auto x = WINOGRAD2_M * block_x;
+
+                const auto b = batch * P + block_y * WTILES + block_x;
+                std::array<std::array<float, ALPHA>, WINOGRAD2_M> temp;
+                for (auto j = 0; j < ALPHA; j++) {
+                    const auto m0 = M[(0 * ALPHA + j) * K * PB + k * PB + b];
+                    const auto m1 = M[(1 * ALPHA + j) * K * PB + k * PB + b];
+                    const auto m2 = M[(2 * ALPHA + j) * K * PB + k * PB + b];
+                    const auto m3 = M[(3 * ALPHA + j) * K * PB + k * PB + b];
+                    temp[0][j] = m0 + m1 + m2;
+                    temp[1][j] = m1 - m2 - m3;
+                }
+
+                const auto y_ind = bk * H * W + y * W + x;
+                for (auto i = 0; i < WINOGRAD2_M; i++) {
+                    const auto& t = temp[i];
+                    const auto o0 = t[0] + t[1] + t[2];
+                    const auto o1 = t[1] - t[2] - t[3];
+                    if (y + i < H) {
+                        Y[y_ind + i * W] = o0;
+                        if (x + 1 < W) {
+                            Y[y_ind + i * W + 1] = o1;
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Convolves each position of the batch as one matrix multiplication of
+// the weights with the unrolled input.  The output channels are split
+// over the threads.
+void CPUPipe::im2col_convolve3(const int outputs, const int channels,
+                               const std::vector<float>& input,
+                               const std::vector<float>& weights,
+                               std::vector<float>& col,
+                               std::vector<float>& output,
+                               const int batch_size, const int output_block,
+                               const int threads,
+                               Utils::ThreadPool* const pool) {
+    constexpr auto filter_len = 3 * 3;
+    const auto filter_dim = filter_len * channels;
+    const auto block = output_block_size(outputs, output_block);
+
+    auto input_b = std::vector<float>(channels * NUM_INTERSECTIONS);
+    if (col.size() < size_t(filter_dim * NUM_INTERSECTIONS)) {
+        col.resize(filter_dim * NUM_INTERSECTIONS);
+    }
+
+    for (auto batch = 0; batch < batch_size; batch++) {
+        const auto in = begin(input) + batch * channels * NUM_INTERSECTIONS;
+        std::copy(in, in + channels * NUM_INTERSECTIONS, begin(input_b));
+        im2col<3>(channels, input_b, col);
+
+        const auto out = &output[batch * outputs * NUM_INTERSECTIONS];
+        split_work(pool, threads, outputs, [&](const int o_begin,
+                                               const int o_end) {
+            for (auto k0 = o_begin; k0 < o_end; k0 += block) {
+                const auto kb = std::min(block, o_end - k0);
+#ifdef USE_BLAS
+                cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans,
+                            kb, NUM_INTERSECTIONS, filter_dim,
+                            1.0f, &weights[k0 * filter_dim], filter_dim,
+                            &col[0], NUM_INTERSECTIONS,
+                            0.0f, &out[k0 * NUM_INTERSECTIONS],
+                            NUM_INTERSECTIONS);
+#else
+                auto C_mat = EigenMatrixMap<float>(
+                    out + k0 * NUM_INTERSECTIONS, NUM_INTERSECTIONS, kb);
+                C_mat.noalias() =
+                    ConstEigenMatrixMap<float>(col.data(), NUM_INTERSECTIONS,
+                                               filter_dim)
+                    * ConstEigenMatrixMap<float>(&weights[k0 * filter_dim],
+                                                 filter_dim, kb);
+#endif
+            }
+        });
+    }
+}
+
+// Straightforward convolution over zero padded input planes.  Slow for
+// wide layers, but it is simple enough to serve as the reference.
+void CPUPipe::direct_convolve3(const int outputs, const int channels,
+                               const std::vector<float>& input,
+                               const std::vector<float>& weights,
+                               std::vector<float>& padded,
+                               std::vector<float>& output,
+                               const int batch_size, const int threads,
+                               Utils::ThreadPool* const pool) {
+    constexpr auto Wpad = BOARD_SIZE + 2;
+    constexpr auto padded_size = Wpad * Wpad;
+
+    if (padded.size() < size_t(channels * padded_size)) {
+        padded.resize(channels * padded_size);
+    }
+    std::fill(begin(padded), begin(padded) + channels * padded_size, 0.0f);
+
+    for (auto batch = 0; batch < batch_size; batch++) {
+        for (auto c = 0; c < channels; c++) {
+            const auto in =
+                &input[(batch * channels + c) * NUM_INTERSECTIONS];
+            for (auto y = 0; y < BOARD_SIZE; y++) {
+                std::copy(in + y * BOARD_SIZE, in + (y + 1) * BOARD_SIZE,
+                          &padded[c * padded_size + (y + 1) * Wpad + 1]);
+            }
+        }
+        split_work(pool, threads, outputs, [&](const int o_begin,
+                                               const int o_end) {
+            for (auto o = o_begin; o < o_end; o++) {
+                const auto out =
+                    &output[(batch * outputs + o) * NUM_INTERSECTIONS];
+                std::fill(out, out + NUM_INTERSECTIONS, 0.0f);
+                for (auto c = 0; c < channels; c++) {
+                    const auto w = &weights[(o * channels + c) * 9];
+                    const auto plane = &padded[c * padded_size];
+                    for (auto ky = 0; ky < 3; ky++) {
+                        for (auto kx = 0; kx < 3; kx++) {
+                            const auto weight = w[ky * 3 + kx];
+                            for (auto y = 0; y < BOARD_SIZE; y++) {
+                                const auto row = plane + (y + ky) * Wpad + kx;
+                                for (auto x = 0; x < BOARD_SIZE; x++) {
+                                    out[y * BOARD_SIZE + x] += weight * row[x];
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        });
+    }
+}
+
+std::vector<float> CPUPipe::prepare_conv3(const ConvAlgorithm algorithm,
+                                          const std::vector<float>& weights,
+                                          const int outputs,
+                                          const int channels) {
+    switch (algorithm) {
+        case ConvAlgorithm::WINOGRAD_F4:
+            return Network::winograd_transform_f(weights, outputs, channels);
+        case ConvAlgorithm::WINOGRAD_F2:
+            break;
+        case ConvAlgorithm::IM2COL:
+        case ConvAlgorithm::DIRECT:
+            return weights;
+    }
+
+    // F(2x2, 3x3) filter transformation G.f.transpose(G), stored with
+    // the same transposed layout as winograd_transform_f.
+    constexpr auto ALPHA = WINOGRAD2_ALPHA;
+    const auto G = std::array<float, 3 * ALPHA>{
+        1.0f,  0.0f, 0.0f,
+        0.5f,  0.5f, 0.5f,
+        0.5f, -0.5f, 0.5f,
+        0.0f,  0.0f, 1.0f};
+
+    auto U = std::vector<float>(WINOGRAD2_TILE * outputs * channels);
+    auto temp = std::array<float, 3 * ALPHA>{};
+    for (auto o = 0; o < outputs; o++) {
+        for (auto c = 0; c < channels; c++) {
+            const auto f = &weights[(o * channels + c) * 9];
+            for (auto i = 0; i < ALPHA; i++) {
+                for (auto j = 0; j < 3; j++) {
+                    auto acc = 0.0f;
+                    for (auto k = 0; k < 3; k++) {
+                        acc += G[i * 3 + k] * f[k * 3 + j];
+                    }
+                    temp[i * 3 + j] = acc;
+                }
+            }
+            for (auto xi = 0; xi < ALPHA; xi++) {
+                for (auto nu = 0; nu < ALPHA; nu++) {
+                    auto acc = 0.0f;
+                    for (auto k = 0; k < 3; k++) {
+                        acc += temp[xi * 3 + k] * G[nu * 3 + k];
+                    }
+                    U[(xi * ALPHA + nu) * outputs * channels + c * outputs
+                      + o] = acc;
+                }
+            }
+        }
+    }
+    return U;
+}
+
+// Runs a 3x3 convolution with the given algorithm.  The weights must
+// come from prepare_conv3 for the same algorithm.  Each step is split
+// over params.threads threads, the GEMMs by tiles and output channels.
+void CPUPipe::convolve3(const ConvParams& params, const int outputs,
+                        const int channels, const std::vector<float>& input,
+                        const std::vector<float>& weights,
+                        ConvBuffers& buffers, std::vector<float>& output,
+                        const int batch_size, Utils::ThreadPool* const pool) {
+    const auto threads = params.threads;
+    const auto block = output_block_size(outputs, params.output_block);
+    const auto blocks = (outputs + block - 1) / block;
+
+    const auto winograd = [&](const int tiles, const int P,
+                              const auto transform_in,
+                              const auto transform_out) {
+        if (buffers.V.size() < size_t(tiles * channels * P)) {
+            buffers.V.resize(tiles * channels * P);
+        }
+        if (buffers.M.size() < size_t(tiles * outputs * P)) {
+            buffers.M.resize(tiles * outputs * P);
+        }
+        split_work(pool, threads, channels * batch_size,
+                   [&](const int begin, const int end) {
+                       transform_in(input, buffers.V, channels, batch_size,
+                                    begin, end);
+                   });
+        split_work(pool, threads, blocks * tiles,
+                   [&](const int begin, const int end) {
+                       winograd_sgemm(weights, buffers.V, buffers.M, channels,
+                                      outputs, tiles, P, params.output_block,
+                                      begin, end);
+                   });
+        split_work(pool, threads, outputs * batch_size,
+                   [&](const int begin, const int end) {
+                       transform_out(buffers.M, output, outputs, batch_size,
+                                     begin, end);
+                   });
+    };
+
+    switch (params.algorithm) {
+        case ConvAlgorithm::WINOGRAD_F4:
+            winograd(WINOGRAD_TILE, WINOGRAD_P * batch_size,
+                     winograd_transform_in, winograd_transform_out);
+            break;
+        case ConvAlgorithm::WINOGRAD_F2:
+            winograd(WINOGRAD2_TILE, WINOGRAD2_P * batch_size,
+                     winograd2_transform_in, winograd2_transform_out);
+            break;
+        case ConvAlgorithm::IM2COL:
+            im2col_convolve3(outputs, channels, input, weights, buffers.V,
+                             output, batch_size, params.output_block, threads,
+                             pool);
+            break;
+        case ConvAlgorithm::DIRECT:
+            direct_convolve3(outputs, channels, input, weights, buffers.V,
+                             output, batch_size, threads, pool);
+            break;
+    }
+}
+
+// Parameters for a layer at the given batch size.
+const CPUPipe::ConvParams& CPUPipe::conv_params(const ConvLayer layer,
+                                                const size_t batch_size) const {
+    auto index = size_t{0};
+    while (index + 1 < TUNED_BATCH_SIZES.size()
+           && size_t(TUNED_BATCH_SIZES[index + 1]) <= batch_size) {
+        index++;
+    }
+    return m_conv_params[index][layer];
+}
+
+const std::vector<float>& CPUPipe::conv_weights(const ConvParams& params,
+                                                const size_t layer) const {
+    return m_conv_weights[static_cast<size_t>(params.algorithm)][layer];
+}
+
+// The side to move planes are the only ones that are ever fully set.
+constexpr auto TOMOVE_PLANES = 2;
+constexpr auto FIRST_TOMOVE_PLANE = Network::INPUT_CHANNELS - TOMOVE_PLANES;
+constexpr auto INPUT_FILTER_LEN = 3 * 3;
+
+// Adds the response of the input convolution to one input plane into
+// acc, which holds the outputs of every intersection one after another.
+void CPUPipe::accumulate_input_plane(const int outputs, const int channel,
+                                     const float* const plane,
+                                     float* const acc) const {
+    for (auto pos = 0; pos < NUM_INTERSECTIONS; pos++) {
+        const auto value = plane[pos];
+        if (value == 0.0f) {
+            continue;
+        }
+        const auto y = pos / BOARD_SIZE;
+        const auto x = pos % BOARD_SIZE;
+        for (auto ky = 0; ky < 3; ky++) {
+            const auto out_y = y - ky + 1;
+            if (out_y < 0 || out_y >= BOARD_SIZE) {
+                continue;
+            }
+            for (auto kx = 0; kx < 3; kx++) {
+                const auto out_x = x - kx + 1;
+                if (out_x < 0 || out_x >= BOARD_SIZE) {
+                    continue;
+                }
+                const auto column =
+                    &m_input_columns[(channel * INPUT_FILTER_LEN + ky * 3 + kx)
+                                     * outputs];
+                const auto out = &acc[(out_y * BOARD_SIZE + out_x) * outputs];
+                for (auto o = 0; o < outputs; o++) {
+                    out[o] += value * column[o];
+                }
+            }
+        }
+    }
+}
+
+// The input planes are 0/1 and mostly empty.  When there are few enough
+// set intersections, accumulating the weight columns they touch is
+// cheaper than the dense Winograd convolution.
+bool CPUPipe::use_sparse_input(const std::vector<float>& input,
+                               const size_t batch_size) const {
+    // Multiply-adds per output channel of the dense input convolution
+    constexpr auto dense_cost =
+        WINOGRAD_TILE * WINOGRAD_P * Network::INPUT_CHANNELS;
+
+    auto set_count = size_t{0};
+    for (auto b = size_t{0}; b < batch_size; b++) {
+        const auto first =
+            begin(input) + b * Network::INPUT_CHANNELS * NUM_INTERSECTIONS;
+        set_count += std::count_if(
+            first, first + FIRST_TOMOVE_PLANE * NUM_INTERSECTIONS,
+            [](const auto value) { return value != 0.0f; });
+    }
+    // The scattered updates run at about half the rate of the dense GEMM.
+    return 2 * set_count * INPUT_FILTER_LEN < batch_size * dense_cost;
+}
+
+// Evaluates the input convolution for one position of the batch from
+// the set intersections of its input planes.  acc is scratch space,
+// grown as needed.
+void CPUPipe::sparse_input_convolve(const int outputs,
+                                    const std::vector<float>& input,
+                                    std::vector<float>& acc,
+                                    std::vector<float>& output,
+                                    const int batch) const {
+    const auto acc_size = size_t(NUM_INTERSECTIONS * outputs);
+    if (acc.size() < acc_size) {
+        acc.resize(acc_size);
+    }
+    std::fill_n(begin(acc), acc_size, 0.0f);
+
+    const auto planes =
+        &input[batch * Network::INPUT_CHANNELS * NUM_INTERSECTIONS];
+    for (auto c = 0; c < Network::INPUT_CHANNELS; c++) {
+        const auto plane = planes + c * NUM_INTERSECTIONS;
+        if (c >= FIRST_TOMOVE_PLANE
+            && std::all_of(plane, plane + NUM_INTERSECTIONS,
+                           [](const auto value) { return value == 1.0f; })) {
+            const auto full_plane =
+                &m_input_full_planes[(c - FIRST_TOMOVE_PLANE)
+                                     * NUM_INTERSECTIONS * outputs];
+            for (auto i = 0; i < NUM_INTERSECTIONS * outputs; i++) {
+                acc[i] += full_plane[i];
+            }
+            continue;
+        }
+        accumulate_input_plane(outputs, c, plane, acc.data());
+    }
+
+    const auto out = &output[batch * outputs * NUM_INTERSECTIONS];
+    for (auto pos = 0; pos < NUM_INTERSECTIONS; pos++) {
+        for (auto o = 0; o < outputs; o++) {
+            out[o * NUM_INTERSECTIONS + pos] = acc[pos * outputs + o];
+        }
+    }
 }
 
 // Applies a traditional convolution function.
@@ -367,17 +897,21 @@ void convolve(const size_t outputs,
     }
 }
 
-// Applies batch normalization to input vectors.
+// Applies batch normalization to input vectors.  The data may hold
+// several positions one after another, each with the given number of
+// channels.
 template <size_t spatial_size>
 void batchnorm(const size_t channels,
                std::vector<float>& data,
                const float* const means,
                const float* const stddevs,
                const float* const eltwise = nullptr) {
-    for (auto c = size_t{0}; c < channels; ++c) {
+    const auto rows = data.size() / spatial_size;
+    for (auto row = size_t{0}; row < rows; ++row) {
+        const auto c = row % channels;
         const auto mean = means[c];
         const auto scale_stddev = stddevs[c];
-        const auto arr = &data[c * spatial_size];
+        const auto arr = &data[row * spatial_size];
 
         if (eltwise == nullptr) {
             // Classical BN
@@ -386,7 +920,7 @@ void batchnorm(const size_t channels,
             }
         } else {
             // BN + residual add
-            const auto res = &eltwise[c * spatial_size];
+            const auto res = &eltwise[row * spatial_size];
             for (auto b = size_t{0}; b < spatial_size; b++) {
                 arr[b] =
                     std::max(0.0f, (scale_stddev * (arr[b] - mean)) + res[b]);
@@ -395,6 +929,12 @@ void batchnorm(const size_t channels,
     }
 }
 
+void CPUPipe::forward(const std::vector<float>& input,
+                      std::vector<float>& output_pol,
+                      std::vector<float>& output_val) {
+    forward_batch(input, output_pol, output_val, 1);
+}
+
 // Does the forwarding in the convolutional network: it applies
 // convolution to the input data, applies batch normalization to the
 // output, then for each pair of convolutional layers in the residual
@@ -403,56 +943,87 @@ void batchnorm(const size_t channels,
 // convolutional layer and finally adds the original input to the
 // output.  After all this it applies the fully connected
 // convolutional layers to obtain policy and value outputs.
-void CPUPipe::forward(const std::vector<float>& input,
-                      std::vector<float>& output_pol,
-                      std::vector<float>& output_val) {
+// All positions of the batch go through each layer together.
+void CPUPipe::forward_batch(const std::vector<float>& input,
+                            std::vector<float>& output_pol,
+                            std::vector<float>& output_val,
+                            const size_t batch_size) {
     // Input convolution
-    constexpr auto P = WINOGRAD_P;
+    const auto batch = static_cast<int>(batch_size);
     // Calculate output channels
     const auto output_channels = m_input_channels;
-    // input_channels is the maximum number of input channels of any
-    // convolution. Residual blocks are identical, but the first convolution
-    // might be bigger when the network has very few filters
-    const auto input_channels =
-        std::max(static_cast<size_t>(output_channels),
-                 static_cast<size_t>(Network::INPUT_CHANNELS));
-    auto conv_out = std::vector<float>(output_channels * NUM_INTERSECTIONS);
-
-    auto V = std::vector<float>(WINOGRAD_TILE * input_channels * P);
-    auto M = std::vector<float>(WINOGRAD_TILE * output_channels * P);
-
-    winograd_convolve3(output_channels, input, m_weights->m_conv_weights[0], V,
-                       M, conv_out);
+    auto conv_out =
+        std::vector<float>(batch_size * output_channels * NUM_INTERSECTIONS);
+
+    const auto& input_params = conv_params(INPUT_LAYER, batch_size);
+    const auto& residual_params = conv_params(RESIDUAL_LAYER, batch_size);
+    auto buffers = ConvBuffers{};
+
+    if (use_sparse_input(input, batch_size)) {
+        for (auto b = 0; b < batch; b++) {
+            sparse_input_convolve(output_channels, input, buffers.V,
+                                  conv_out, b);
+        }
+    } else {
+        convolve3(input_params, output_channels, Network::INPUT_CHANNELS,
+                  input, conv_weights(input_params, 0), buffers, conv_out,
+                  batch, m_gemm_pool.get());
+    }
     batchnorm<NUM_INTERSECTIONS>(output_channels, conv_out,
-                                 m_weights->m_batchnorm_means[0].data(),
-                                 m_weights->m_batchnorm_stddevs[0].data());
+                                 m_batchnorm_means[0].data(),
+                                 m_batchnorm_stddevs[0].data());
 
     // Residual tower
-    auto conv_in = std::vector<float>(output_channels * NUM_INTERSECTIONS);
-    auto res = std::vector<float>(output_channels * NUM_INTERSECTIONS);
-    for (auto i = size_t{1}; i < m_weights->m_conv_weights.size(); i += 2) {
+    auto conv_in =
+        std::vector<float>(batch_size * output_channels * NUM_INTERSECTIONS);
+    auto res =
+        std::vector<float>(batch_size * output_channels * NUM_INTERSECTIONS);
+    for (auto i = size_t{1}; i < m_batchnorm_means.size(); i += 2) {
         auto output_channels = m_input_channels;
         std::swap(conv_out, conv_in);
-        winograd_convolve3(output_channels, conv_in,
-                           m_weights->m_conv_weights[i], V, M, conv_out);
+        convolve3(residual_params, output_channels, output_channels, conv_in,
+                  conv_weights(residual_params, i), buffers, conv_out, batch,
+                  m_gemm_pool.get());
         batchnorm<NUM_INTERSECTIONS>(output_channels, conv_out,
-                                     m_weights->m_batchnorm_means[i].data(),
-                                     m_weights->m_batchnorm_stddevs[i].data());
+                                     m_batchnorm_means[i].data(),
+                                     m_batchnorm_stddevs[i].data());
 
         std::swap(conv_in, res);
         std::swap(conv_out, conv_in);
-        winograd_convolve3(output_channels, conv_in,
-                           m_weights->m_conv_weights[i + 1], V, M, conv_out);
+        convolve3(residual_params, output_channels, output_channels, conv_in,
+                  conv_weights(residual_params, i + 1), buffers, conv_out,
+                  batch, m_gemm_pool.get());
         batchnorm<NUM_INTERSECTIONS>(
-            output_channels, conv_out,
-            m_weights->m_batchnorm_means[i + 1].data(),
-            m_weights->m_batchnorm_stddevs[i + 1].data(), res.data());
+            output_channels, conv_out, m_batchnorm_means[i + 1].data(),
+            m_batchnorm_stddevs[i + 1].data(), res.data());
     }
+
     // Computes the fully connected convolutional layers.
-    convolve<1>(Network::OUTPUTS_POLICY, conv_out, m_conv_pol_w, m_conv_pol_b,
-                output_pol);
-    convolve<1>(Network::OUTPUTS_VALUE, conv_out, m_conv_val_w, m_conv_val_b,
-                output_val);
+    if (batch_size == 1) {
+        convolve<1>(Network::OUTPUTS_POLICY, conv_out, m_conv_pol_w,
+                    m_conv_pol_b, output_pol);
+        convolve<1>(Network::OUTPUTS_VALUE, conv_out, m_conv_val_w,
+                    m_conv_val_b, output_val);
+        return;
+    }
+    constexpr auto out_pol_size = Network::OUTPUTS_POLICY * NUM_INTERSECTIONS;
+    constexpr auto out_val_size = Network::OUTPUTS_VALUE * NUM_INTERSECTIONS;
+    const auto tower_size = output_channels * NUM_INTERSECTIONS;
+    auto head_in = std::vector<float>(tower_size);
+    auto head_pol = std::vector<float>(out_pol_size);
+    auto head_val = std::vector<float>(out_val_size);
+    for (auto b = size_t{0}; b < batch_size; b++) {
+        std::copy(begin(conv_out) + b * tower_size,
+                  begin(conv_out) + (b + 1) * tower_size, begin(head_in));
+        convolve<1>(Network::OUTPUTS_POLICY, head_in, m_conv_pol_w,
+                    m_conv_pol_b, head_pol);
+        convolve<1>(Network::OUTPUTS_VALUE, head_in, m_conv_val_w,
+                    m_conv_val_b, head_val);
+        std::copy(begin(head_pol), end(head_pol),
+                  begin(output_pol) + b * out_pol_size);
+        std::copy(begin(head_val), end(head_val),
+                  begin(output_val) + b * out_val_size);
+    }
 }
 
 // Sets up the weights, seperating the ones for the policy and the
@@ -462,7 +1033,60 @@ void CPUPipe::push_weights(const unsigned int /*filter_size*/,
                            const unsigned int outputs,
                            std::shared_ptr<const ForwardPipeWeights> weights) {
 
-    m_weights = weights;
+    // Tower convolutions, in the layout of every tuned algorithm.  The
+    // Winograd F(4x4, 3x3) weights come transformed already.
+    auto in_use = std::array<bool, CONV_ALGORITHMS>{};
+    for (const auto& batch_params : m_conv_params) {
+        for (const auto& params : batch_params) {
+            in_use[static_cast<size_t>(params.algorithm)] = true;
+        }
+    }
+    const auto& raw_weights = weights->m_conv_weights_raw;
+    for (auto a = 0; a < CONV_ALGORITHMS; a++) {
+        const auto algorithm = static_cast<ConvAlgorithm>(a);
+        auto& layers = m_conv_weights[a];
+        layers.clear();
+        if (!in_use[a]) {
+            continue;
+        }
+        if (algorithm == ConvAlgorithm::WINOGRAD_F4) {
+            layers = weights->m_conv_weights;
+            continue;
+        }
+        for (auto i = size_t{0}; i < raw_weights.size(); i++) {
+            const auto layer_channels =
+                i == 0 ? Network::INPUT_CHANNELS : int(outputs);
+            layers.emplace_back(prepare_conv3(algorithm, raw_weights[i],
+                                              outputs, layer_channels));
+        }
+    }
+    m_batchnorm_means = weights->m_batchnorm_means;
+    m_batchnorm_stddevs = weights->m_batchnorm_stddevs;
+
+    // Input convolution, reordered from (output, input, 3, 3) to
+    // (input, 3, 3, output) so that each set input intersection adds
+    // contiguous columns.
+    const auto& input_w = raw_weights[0];
+    m_input_columns.resize(input_w.size());
+    for (auto o = 0; o < m_input_channels; o++) {
+        for (auto c = 0; c < Network::INPUT_CHANNELS; c++) {
+            for (auto k = 0; k < INPUT_FILTER_LEN; k++) {
+                m_input_columns[(c * INPUT_FILTER_LEN + k) * m_input_channels
+                                + o] =
+                    input_w[(o * Network::INPUT_CHANNELS + c)
+                                * INPUT_FILTER_LEN
+                            + k];
+            }
+        }
+    }
+    const auto full_plane = std::vector<float>(NUM_INTERSECTIONS, 1.0f);
+    m_input_full_planes.assign(
+        TOMOVE_PLANES * NUM_INTERSECTIONS * m_input_channels, 0.0f);
+    for (auto p = 0; p < TOMOVE_PLANES; p++) {
+        accumulate_input_plane(
+            m_input_channels, FIRST_TOMOVE_PLANE + p, full_plane.data(),
+            &m_input_full_planes[p * NUM_INTERSECTIONS * m_input_channels]);
+    }
 
     // Output head convolutions
     m_conv_pol_w = weights->m_conv_pol_w;
@@ -31,44 +31,150 @@
 #define CPUPIPE_H_INCLUDED
 #include "config.h"
 
+#include <array>
 #include <cassert>
+#include <memory>
+#include <string>
 #include <vector>
 
 #include "ForwardPipe.h"
+#include "ThreadPool.h"
 
 class CPUPipe : public ForwardPipe {
+    friend class CPUPipeTest;
+
 public:
+    // Ways of evaluating a 3x3 convolution.  CPUTuner picks the fastest
+    // one for each layer shape on this machine.
+    enum class ConvAlgorithm {
+        WINOGRAD_F4, // F(4x4, 3x3), 6x6 tiles
+        WINOGRAD_F2, // F(2x2, 3x3), 4x4 tiles
+        IM2COL,      // Unrolled input times the plain weights
+        DIRECT       // Nested loops, also the tuner reference
+    };
+    static constexpr auto CONV_ALGORITHMS = 4;
+
+    struct ConvParams {
+        ConvAlgorithm algorithm{ConvAlgorithm::WINOGRAD_F4};
+        // Number of output channels per GEMM call, 0 for all of them.
+        int output_block{0};
+        // Number of threads the convolution is split over.
+        int threads{1};
+    };
+
+    // Scratch space of the convolutions, grown as needed.
+    struct ConvBuffers {
+        std::vector<float> V;
+        std::vector<float> M;
+    };
+
+    static std::string algorithm_to_string(ConvAlgorithm algorithm);
+    static bool algorithm_from_string(const std::string& name,
+                                      ConvAlgorithm& algorithm);
+
+    // Converts (output, input, 3, 3) weights to the layout used by the
+    // given algorithm.
+    static std::vector<float> prepare_conv3(ConvAlgorithm algorithm,
+                                            const std::vector<float>& weights,
+                                            int outputs, int channels);
+    // The calling thread does a share of the work itself, so the pool
+    // needs params.threads - 1 workers.
+    static void convolve3(const ConvParams& params, int outputs, int channels,
+                          const std::vector<float>& input,
+                          const std::vector<float>& weights,
+                          ConvBuffers& buffers, std::vector<float>& output,
+                          int batch_size, Utils::ThreadPool* pool = nullptr);
+
     virtual void initialize(int channels);
     virtual void forward(const std::vector<float>& input,
                          std::vector<float>& output_pol,
                          std::vector<float>& output_val);
+    virtual void forward_batch(const std::vector<float>& input,
+                               std::vector<float>& output_pol,
+                               std::vector<float>& output_val,
+                               size_t batch_size);
 
     virtual void push_weights(
         unsigned int filter_size, unsigned int channels, unsigned int outputs,
         std::shared_ptr<const ForwardPipeWeights> weights);
 
 private:
-    void winograd_transform_in(const std::vector<float>& in,
-                               std::vector<float>& V, int C);
+    // Batch sizes the convolutions are tuned for.  Batches use the
+    // parameters of the largest tuned size that is not bigger.
+    static constexpr std::array<int, 2> TUNED_BATCH_SIZES = {1, 8};
+    enum ConvLayer { INPUT_LAYER, RESIDUAL_LAYER, CONV_LAYERS };
+
+    static void winograd_transform_in(const std::vector<float>& in,
+                                      std::vector<float>& V, int C,
+                                      int batch_size,
+                                      int chb_begin, int chb_end);
+    static void winograd2_transform_in(const std::vector<float>& in,
+                                       std::vector<float>& V, int C,
+                                       int batch_size,
+                                       int chb_begin, int chb_end);
+
+    static void winograd_sgemm(const std::vector<float>& U,
+                               const std::vector<float>& V,
+                               std::vector<float>& M, int C, int K,
+                               int tiles, int P, int output_block,
+                               int unit_begin, int unit_end);
+
+    static void winograd_transform_out(const std::vector<float>& M,
+                                       std::vector<float>& Y, int K,
+                                       int batch_size,
+                                       int bk_begin, int bk_end);
+    static void winograd2_transform_out(const std::vector<float>& M,
+                                        std::vector<float>& Y, int K,
+                                        int batch_size,
+                                        int bk_begin, int bk_end);
+
+    static void im2col_convolve3(int outputs, int channels,
+                                 const std::vector<float>& input,
+                                 const std::vector<float>& weights,
+                                 std::vector<float>& col,
+                                 std::vector<float>& output, int batch_size,
+                                 int output_block, int threads,
+                                 Utils::ThreadPool* pool);
+
+    static void direct_convolve3(int outputs, int channels,
+                                 const std::vector<float>& input,
+                                 const std::vector<float>& weights,
+                                 std::vector<float>& padded,
+                                 std::vector<float>& output, int batch_size,
+                                 int threads, Utils::ThreadPool* pool);
+
+    bool use_sparse_input(const std::vector<float>& input,
+                          size_t batch_size) const;
+    void sparse_input_convolve(int outputs, const std::vector<float>& input,
+                               std::vector<float>& acc,
+                               std::vector<float>& output, int batch) const;
+    void accumulate_input_plane(int outputs, int channel, const float* plane,
+                                float* acc) const;
+
+    const ConvParams& conv_params(ConvLayer layer, size_t batch_size) const;
+    const std::vector<float>& conv_weights(const ConvParams& params,
+                                           size_t layer) const;
 
-    void winograd_sgemm(const std::vector<float>& U,
-                        const std::vector<float>& V,
-                        std::vector<float>& M, int C, int K);
+    int m_input_channels;
 
-    void winograd_transform_out(const std::vector<float>& M,
-                                std::vector<float>& Y, int K);
+    // Helpers that share the convolutions with the calling search thread.
+    std::unique_ptr<Utils::ThreadPool> m_gemm_pool;
 
-    void winograd_convolve3(int outputs,
-                            const std::vector<float>& input,
-                            const std::vector<float>& U,
-                            std::vector<float>& V,
-                            std::vector<float>& M,
-                            std::vector<float>& output);
+    // Tuned convolution parameters, per tuned batch size and layer shape.
+    std::array<std::array<ConvParams, CONV_LAYERS>, TUNED_BATCH_SIZES.size()>
+        m_conv_params;
 
-    int m_input_channels;
+    // Input + residual block tower, with the weights in the layout of
+    // every algorithm that is in use.
+    std::array<std::vector<std::vector<float>>, CONV_ALGORITHMS>
+        m_conv_weights;
+    std::vector<std::vector<float>> m_batchnorm_means;
+    std::vector<std::vector<float>> m_batchnorm_stddevs;
 
-    // Input + residual block tower
-    std::shared_ptr<const ForwardPipeWeights> m_weights;
+    // Input convolution as one column of outputs per input channel and
+    // filter tap, and its response to fully set side to move planes.
+    std::vector<float> m_input_columns;
+    std::vector<float> m_input_full_planes;
 
     std::vector<float> m_conv_pol_w;
     std::vector<float> m_conv_val_w;
@@ -0,0 +1,355 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "CPUTuner.h"
+#include "Utils.h"
+
+using namespace Utils;
+
+const auto TUNER_FILE_LOCAL = std::string("leelaz_cpu_tuning");
+const auto TUNER_KERNEL = std::string("conv3x3");
+
+// Largest difference from the direct convolution that a candidate
+// may have on the test data.
+constexpr auto TUNER_MAX_ERROR = 1e-3f;
+
+// Fills x with deterministic values in [-scale / 2, scale / 2).
+static void conv_generate_data(std::vector<float>& x, const int seed,
+                               const float scale) {
+    for (auto i = size_t{0}; i < x.size(); i++) {
+        x[i] = (((i * 37 + seed) % 256) / 256.0f - 0.5f) * scale;
+    }
+}
+
+// Names the CPU model and the matrix multiplication library, which
+// together decide the speed of every algorithm.
+std::string CPUTuner::get_cpu_name() {
+    auto name = std::string{"unknown"};
+    auto file = std::ifstream{"/proc/cpuinfo"};
+    auto line = std::string{};
+    while (std::getline(file, line)) {
+        if (line.compare(0, 10, "model name") == 0) {
+            const auto colon = line.find(':');
+            if (colon != std::string::npos) {
+                name = line.substr(line.find_first_not_of(" \t", colon + 1));
+            }
+            break;
+        }
+    }
+    // The tuning file uses ';' to separate fields.
+    std::replace(begin(name), end(name), ';', ',');
+
+    auto ss = std::stringstream{};
+    ss << "CPU: " << name;
+#if defined(USE_MKL)
+    ss << " (MKL)";
+#elif defined(USE_OPENBLAS)
+    ss << " (OpenBLAS)";
+#elif defined(USE_BLAS)
+    ss << " (BLAS)";
+#else
+    ss << " (Eigen)";
+#endif
+    return ss.str();
+}
+
+std::string CPUTuner::parameters_to_string(const CPUPipe::ConvParams& params) {
+    auto ss = std::stringstream{};
+    ss << "algo=" << CPUPipe::algorithm_to_string(params.algorithm)
+       << " kb=" << params.output_block << " threads=" << params.threads;
+    return ss.str();
+}
+
+bool CPUTuner::parameters_from_string(const std::string& text,
+                                      CPUPipe::ConvParams& params) {
+    auto ss = std::stringstream{text};
+    auto item = std::string{};
+    auto found_algorithm = false;
+    auto found_block = false;
+    auto found_threads = false;
+
+    while (ss >> item) {
+        const auto eq = item.find('=');
+        if (eq == std::string::npos) {
+            return false;
+        }
+        const auto key = item.substr(0, eq);
+        const auto value = item.substr(eq + 1);
+        if (key == "algo") {
+            found_algorithm =
+                CPUPipe::algorithm_from_string(value, params.algorithm);
+        } else if (key == "kb" || key == "threads") {
+            auto number = 0;
+            try {
+                number = std::stoi(value);
+            } catch (const std::exception&) {
+                return false;
+            }
+            if (key == "kb") {
+                params.output_block = number;
+                found_block = number >= 0;
+            } else {
+                params.threads = number;
+                found_threads = number >= 1 && number <= m_threads;
+            }
+        }
+    }
+    return found_algorithm && found_block && found_threads;
+}
+
+// Every algorithm, with a few output channel blockings for the ones
+// built on matrix multiplications.  Each runs on one thread and, if
+// there are helpers, split over all of them.  Small layers may not be
+// worth the hand-off.
+std::vector<CPUPipe::ConvParams> CPUTuner::build_valid_params(
+    const int outputs) {
+    using ConvAlgorithm = CPUPipe::ConvAlgorithm;
+
+    auto thread_counts = std::vector<int>{1};
+    if (m_pool != nullptr && m_threads > 1) {
+        thread_counts.push_back(m_threads);
+    }
+
+    auto result = std::vector<CPUPipe::ConvParams>{};
+    for (const auto threads : thread_counts) {
+        for (const auto algorithm : {ConvAlgorithm::WINOGRAD_F4,
+                                     ConvAlgorithm::WINOGRAD_F2,
+                                     ConvAlgorithm::IM2COL}) {
+            result.push_back({algorithm, 0, threads});
+            for (const auto block : {16, 32, 64}) {
+                if (block < outputs) {
+                    result.push_back({algorithm, block, threads});
+                }
+            }
+        }
+        result.push_back({ConvAlgorithm::DIRECT, 0, threads});
+    }
+    return result;
+}
+
+CPUPipe::ConvParams CPUTuner::tune_conv(const int channels, const int outputs,
+                                        const int batch_size,
+                                        const int runs) {
+    using Clock = std::chrono::steady_clock;
+
+    auto input = std::vector<float>(batch_size * channels * NUM_INTERSECTIONS);
+    auto weights = std::vector<float>(outputs * channels * 9);
+    auto output = std::vector<float>(batch_size * outputs * NUM_INTERSECTIONS);
+    auto output_ref = output;
+
+    // Scale the weights so that the outputs stay in the range of a
+    // real network, where the error bound is meaningful.
+    conv_generate_data(input, 0, 1.0f);
+    conv_generate_data(weights, 101, 1.0f / std::sqrt(9.0f * channels));
+
+    auto buffers = CPUPipe::ConvBuffers{};
+    const auto reference =
+        CPUPipe::ConvParams{CPUPipe::ConvAlgorithm::DIRECT, 0};
+    CPUPipe::convolve3(reference, outputs, channels, input, weights, buffers,
+                       output_ref, batch_size);
+
+    myprintf("\nStarted CPU convolution tuner.\n");
+    myprintf("Tuning %d -> %d channels, batch size %d, %d thread(s).\n",
+             channels, outputs, batch_size, m_threads);
+
+    const auto valid_params = build_valid_params(outputs);
+    myprintf("Will try %zu valid configurations.\n", valid_params.size());
+
+    // Multiply-adds of a plain convolution, for a comparable GFLOPS figure.
+    const auto total_flops =
+        batch_size * 2.0 * outputs * channels * 9 * NUM_INTERSECTIONS;
+
+    auto best_params = CPUPipe::ConvParams{};
+    auto best_time = Clock::duration::zero();
+    auto param_counter = size_t{0};
+    auto failed_error = 0;
+    auto min_error = 100.0f;
+
+    for (const auto& p : valid_params) {
+        param_counter++;
+
+        const auto prepared =
+            CPUPipe::prepare_conv3(p.algorithm, weights, outputs, channels);
+
+        // The first run also warms up the buffers.
+        CPUPipe::convolve3(p, outputs, channels, input, prepared, buffers,
+                           output, batch_size, m_pool);
+        auto max_error = 0.0f;
+        for (auto i = size_t{0}; i < output.size(); i++) {
+            max_error = std::max(max_error, std::abs(output[i] - output_ref[i]));
+        }
+        min_error = std::min(min_error, max_error);
+        if (max_error >= TUNER_MAX_ERROR) {
+            failed_error++;
+            continue;
+        }
+
+        // Stop timing a candidate as soon as it can no longer win.
+        auto sum = Clock::duration::zero();
+        auto completed = 0;
+        for (; completed < runs; completed++) {
+            if (best_time != Clock::duration::zero() && sum >= best_time) {
+                break;
+            }
+            const auto start = Clock::now();
+            CPUPipe::convolve3(p, outputs, channels, input, prepared, buffers,
+                               output, batch_size, m_pool);
+            sum += Clock::now() - start;
+        }
+
+        if (completed == runs
+            && (best_time == Clock::duration::zero() || sum < best_time)) {
+            const auto param_str = parameters_to_string(p);
+            const auto ns =
+                std::chrono::duration<double, std::nano>(sum).count() / runs;
+            // Timing is in nanoseconds (10^-9), Giga = 10^9, so this works out
+            myprintf("(%zu/%zu) %s %.4f ms (%.1f GFLOPS)\n", param_counter,
+                     valid_params.size(), param_str.c_str(), 1e-6 * ns,
+                     total_flops / ns);
+            best_time = sum;
+            best_params = p;
+        }
+    }
+    // Handles the case in which no working configuration was found.
+    if (best_time == Clock::duration::zero()) {
+        myprintf_error("Too high error: %d configurations\n", failed_error);
+        myprintf_error("Failed to find a working configuration.\n");
+        myprintf_error("Minimum error: %f. Error bound: %f\n", min_error,
+                       TUNER_MAX_ERROR);
+        throw std::runtime_error("Tuner failed to find working configuration.");
+    }
+    return best_params;
+}
+
+// Memorize the fastest parameters for the convolution shape.
+void CPUTuner::store_conv_tuning(const int channels, const int outputs,
+                                 const int batch_size,
+                                 const CPUPipe::ConvParams& params) {
+    auto tuner_file = leelaz_file(TUNER_FILE_LOCAL);
+    auto file_contents = std::vector<std::string>();
+    {
+        // Read the previous contents to string
+        auto file = std::ifstream{tuner_file};
+        if (file.good()) {
+            auto line = std::string{};
+            while (std::getline(file, line)) {
+                file_contents.emplace_back(line);
+            }
+        }
+    }
+    auto file = std::ofstream{tuner_file};
+
+    const auto cpu_name = get_cpu_name();
+    auto tuning_params = std::stringstream{};
+    tuning_params << channels << ";" << outputs << ";" << BOARD_SIZE << ";"
+                  << batch_size << ";" << m_threads;
+
+    const auto tuning_line_prefix = std::to_string(TUNER_VERSION) + ";"
+                                    + TUNER_KERNEL + ";"
+                                    + tuning_params.str() + ";";
+    const auto tuning_line =
+        tuning_line_prefix + parameters_to_string(params) + ";" + cpu_name;
+
+    // Write back previous data as long as it's not the CPU and
+    // shape we just tuned
+    for (const auto& line : file_contents) {
+        if (line.find(tuning_line_prefix) == std::string::npos
+            || line.find(cpu_name) == std::string::npos) {
+            file << line << std::endl;
+        }
+    }
+
+    // Write new tuning
+    file << tuning_line << std::endl;
+
+    if (file.fail()) {
+        myprintf("Could not save the tuning result.\n");
+        myprintf("Do I have write permissions on %s?\n", tuner_file.c_str());
+    }
+}
+
+bool CPUTuner::conv_tuning_from_line(const std::string& line,
+                                     const int channels, const int outputs,
+                                     const int batch_size,
+                                     CPUPipe::ConvParams& params) {
+    auto s = std::vector<std::string>{};
+    auto ss = std::stringstream{line};
+    auto item = std::string{};
+
+    while (std::getline(ss, item, ';')) {
+        s.emplace_back(item);
+    }
+
+    if (s.size() != 9) {
+        return false;
+    }
+
+    // Checks the tuner version, the layer shape, the threads and the CPU.
+    if (s[0] != std::to_string(TUNER_VERSION) || s[1] != TUNER_KERNEL
+        || s[2] != std::to_string(channels) || s[3] != std::to_string(outputs)
+        || s[4] != std::to_string(BOARD_SIZE)
+        || s[5] != std::to_string(batch_size)
+        || s[6] != std::to_string(m_threads) || s[8] != get_cpu_name()) {
+        return false;
+    }
+
+    return parameters_from_string(s[7], params);
+}
+
+CPUPipe::ConvParams CPUTuner::load_conv_tuning(const int channels,
+                                               const int outputs,
+                                               const int batch_size) {
+    auto tuner_file = leelaz_file(TUNER_FILE_LOCAL);
+    auto file = std::ifstream{tuner_file};
+
+    if (file.good()) {
+        auto line = std::string{};
+        auto params = CPUPipe::ConvParams{};
+        while (std::getline(file, line)) {
+            if (conv_tuning_from_line(line, channels, outputs, batch_size,
+                                      params)) {
+                myprintf("Loaded existing CPU convolution tuning.\n");
+                return params;
+            }
+        }
+    }
+    const auto params = tune_conv(channels, outputs, batch_size);
+    store_conv_tuning(channels, outputs, batch_size, params);
+    return params;
+}
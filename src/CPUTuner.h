@@ -0,0 +1,74 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef CPUTUNER_H_INCLUDED
+#define CPUTUNER_H_INCLUDED
+
+#include "config.h"
+
+#include <string>
+#include <vector>
+
+#include "CPUPipe.h"
+
+// Finds the fastest way to run the 3x3 convolutions of the CPU pipe for
+// a layer shape, and remembers it per CPU model in a tuning file.
+class CPUTuner {
+    // Helper threads and the number of threads a convolution may use.
+    Utils::ThreadPool* m_pool;
+    int m_threads;
+
+public:
+    CPUPipe::ConvParams tune_conv(int channels, int outputs, int batch_size,
+                                  int runs = 4);
+    CPUPipe::ConvParams load_conv_tuning(int channels, int outputs,
+                                         int batch_size);
+
+    // version 0 : Initial release
+    // version 1 : Thread count in the key, thread split (parameter threads)
+    static constexpr auto TUNER_VERSION = 1;
+
+    CPUTuner(Utils::ThreadPool* pool = nullptr, int threads = 1)
+        : m_pool(pool), m_threads(threads) {}
+
+    static std::string get_cpu_name();
+
+private:
+    void store_conv_tuning(int channels, int outputs, int batch_size,
+                           const CPUPipe::ConvParams& params);
+    std::string parameters_to_string(const CPUPipe::ConvParams& params);
+    bool parameters_from_string(const std::string& text,
+                                CPUPipe::ConvParams& params);
+    bool conv_tuning_from_line(const std::string& line, int channels,
+                               int outputs, int batch_size,
+                               CPUPipe::ConvParams& params);
+    std::vector<CPUPipe::ConvParams> build_valid_params(int outputs);
+};
+
+#endif
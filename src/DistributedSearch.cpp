@@ -0,0 +1,441 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <limits>
+#include <sstream>
+#include <unordered_map>
+#include <utility>
+
+#include "DistributedSearch.h"
+
+#include "FastBoard.h"
+#include "GTP.h"
+#include "Training.h"
+#include "UCTSearch.h"
+#include "Utils.h"
+
+using namespace Utils;
+
+// Messages are lines of text:
+//   search <id> <size> <komi> <color> <hash> <visits> <playouts>
+//          <moves> followed by <color> <vertex> for every move
+//   stop <id>
+//   report <id> <final> <children> followed by
+//          <move> <visits> <blackevals> <squared eval diff> for each,
+//          counting only what was gathered in this search
+
+using ChildBaseline = std::unordered_map<int, UCTNode::Stats>;
+
+// Statistics of the root children before the search.
+static ChildBaseline child_baseline(const UCTNode& root) {
+    auto baseline = ChildBaseline{};
+    for (const auto& child : root.get_children()) {
+        if (child.is_inflated() && child.get_visits() > 0) {
+            baseline.emplace(child.get_move(), child->get_stats());
+        }
+    }
+    return baseline;
+}
+
+// The statistics added since before, which undoes the pairwise update
+// of the sum of squares in UCTNode::merge_stats.
+static UCTNode::Stats stats_since(const UCTNode::Stats& now,
+                                  const UCTNode::Stats& before) {
+    auto added = UCTNode::Stats{now.visits - before.visits,
+                                now.blackevals - before.blackevals, 0.0};
+    if (added.visits <= 0) {
+        return {0, 0.0, 0.0};
+    }
+    const auto delta =
+        added.blackevals / added.visits - before.blackevals / before.visits;
+    added.squared_eval_diff =
+        std::max(0.0, now.squared_eval_diff - before.squared_eval_diff
+                          - delta * delta * before.visits * added.visits
+                                / now.visits);
+    return added;
+}
+
+static std::string report_message(const std::uint64_t id, const bool final,
+                                  const UCTNode& root,
+                                  const ChildBaseline& baseline) {
+    auto children = std::stringstream{};
+    children.precision(17);
+    auto count = 0;
+    for (const auto& child : root.get_children()) {
+        if (!child.is_inflated() || child.get_visits() == 0) {
+            continue;
+        }
+        auto stats = child->get_stats();
+        const auto before = baseline.find(child.get_move());
+        if (before != end(baseline)) {
+            stats = stats_since(stats, before->second);
+            if (stats.visits == 0) {
+                continue;
+            }
+        }
+        children << ' ' << child.get_move() << ' ' << stats.visits << ' '
+                 << stats.blackevals << ' ' << stats.squared_eval_diff;
+        count++;
+    }
+    auto message = std::stringstream{};
+    message << "report " << id << ' ' << final << ' ' << count
+            << children.str();
+    return message.str();
+}
+
+DistributedSearch::DistributedSearch(const std::vector<std::string>& workers) {
+    for (const auto& address : workers) {
+        m_workers.emplace_back(std::make_unique<Worker>());
+        m_workers.back()->address = address;
+        connect(*m_workers.back());
+    }
+    m_reconnector = std::thread([this]() { reconnect_lost(); });
+}
+
+DistributedSearch::~DistributedSearch() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_exit = true;
+    }
+    m_reconnect_condvar.notify_all();
+    m_reconnector.join();
+    for (auto& worker : m_workers) {
+        std::lock_guard<std::mutex> lock(worker->connection_mutex);
+        disconnect(*worker);
+    }
+}
+
+// Called with the connection mutex of the worker held, or before any
+// other thread knows about it.
+void DistributedSearch::connect(Worker& worker) {
+    worker.connection = Transport::connect(worker.address);
+    if (worker.connection) {
+        myprintf("Connected to search worker %s.\n", worker.address.c_str());
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            worker.connected = true;
+            // It joins in with the next search.
+            worker.finished = true;
+        }
+        worker.reader = std::thread([this, &worker]() {
+            read_reports(worker);
+        });
+    }
+}
+
+// Connecting can take long when a host is down, so it is done here
+// rather than when a search starts.
+void DistributedSearch::reconnect_lost() {
+    auto lock = std::unique_lock<std::mutex>(m_mutex);
+    while (!m_exit) {
+        m_reconnect_condvar.wait_for(lock,
+                                     std::chrono::milliseconds(RECONNECT_MS),
+                                     [this]() { return m_exit; });
+        for (auto& worker : m_workers) {
+            const auto now = std::chrono::steady_clock::now();
+            if (m_exit) {
+                break;
+            }
+            if (worker->connected || now < worker->next_attempt) {
+                continue;
+            }
+            lock.unlock();
+            {
+                std::lock_guard<std::mutex> connection_lock(
+                    worker->connection_mutex);
+                disconnect(*worker);
+                connect(*worker);
+                if (worker->connection) {
+                    worker->retry_delay =
+                        std::chrono::milliseconds(RECONNECT_MS);
+                } else {
+                    worker->next_attempt = now + worker->retry_delay;
+                    worker->retry_delay =
+                        std::min(worker->retry_delay * 2,
+                                 std::chrono::milliseconds(MAX_RECONNECT_MS));
+                }
+            }
+            lock.lock();
+        }
+    }
+}
+
+void DistributedSearch::send(Worker& worker, const std::string& message) {
+    // If the worker is being connected again it has no search to join,
+    // and waiting for that would hold up the search.
+    std::unique_lock<std::mutex> lock(worker.connection_mutex,
+                                      std::try_to_lock);
+    if (lock.owns_lock() && worker.connection) {
+        worker.connection->send(message);
+    }
+}
+
+void DistributedSearch::disconnect(Worker& worker) {
+    if (worker.connection) {
+        worker.connection->close();
+    }
+    if (worker.reader.joinable()) {
+        worker.reader.join();
+    }
+    worker.connection.reset();
+}
+
+void DistributedSearch::read_reports(Worker& worker) {
+    auto message = std::string{};
+    while (worker.connection->receive(message)) {
+        auto in = std::istringstream{message};
+        auto command = std::string{};
+        auto id = std::uint64_t{0};
+        auto final = false;
+        auto count = 0;
+        in >> command >> id >> final >> count;
+        if (!in || command != "report") {
+            continue;
+        }
+        auto stats = RootStats{};
+        for (auto i = 0; i < count; i++) {
+            auto child = ChildStats{};
+            in >> child.move >> child.stats.visits >> child.stats.blackevals
+                >> child.stats.squared_eval_diff;
+            stats.emplace_back(child);
+        }
+        if (!in) {
+            continue;
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (id == m_search_id) {
+            worker.stats = std::move(stats);
+            worker.finished = final;
+            m_condvar.notify_all();
+        }
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    myprintf("Search worker %s disconnected.\n", worker.address.c_str());
+    worker.connected = false;
+    worker.finished = true;
+    m_condvar.notify_all();
+}
+
+void DistributedSearch::start(const GameState& state, const int color,
+                              const int max_visits, const int max_playouts) {
+    // The moves leading to the root, the worker checks that it gets the
+    // same position out of them.
+    auto moves = std::stringstream{};
+    auto count = 0;
+    const auto& history = state.get_game_history();
+    for (auto i = size_t{1}; i <= state.get_movenum() && i < history.size();
+         i++) {
+        moves << ' ' << !history[i]->get_to_move() << ' '
+              << history[i]->get_last_move();
+        count++;
+    }
+    auto message = std::stringstream{};
+    message.precision(17);
+
+    auto lock = std::unique_lock<std::mutex>(m_mutex);
+    m_search_id++;
+    message << "search " << m_search_id << ' ' << state.board.get_boardsize()
+            << ' ' << state.get_komi() << ' ' << color << ' '
+            << state.board.get_hash() << ' ' << max_visits << ' '
+            << max_playouts << ' ' << count << moves.str();
+    lock.unlock();
+
+    // Workers that are not connected join in once they are again.
+    for (auto& worker : m_workers) {
+        lock.lock();
+        worker->stats.clear();
+        worker->finished = !worker->connected;
+        const auto connected = worker->connected;
+        lock.unlock();
+        if (connected) {
+            send(*worker, message.str());
+        }
+    }
+}
+
+DistributedSearch::RootStats DistributedSearch::finish() {
+    auto lock = std::unique_lock<std::mutex>(m_mutex);
+    const auto stop = "stop " + std::to_string(m_search_id);
+    lock.unlock();
+    for (auto& worker : m_workers) {
+        send(*worker, stop);
+    }
+
+    lock.lock();
+    const auto all_finished = [this]() {
+        for (const auto& worker : m_workers) {
+            if (!worker->finished) {
+                return false;
+            }
+        }
+        return true;
+    };
+    if (!m_condvar.wait_for(lock,
+                            std::chrono::milliseconds(FINISH_TIMEOUT_MS),
+                            all_finished)) {
+        myprintf("Some search workers did not answer, "
+                 "using their last report.\n");
+    }
+    auto stats = RootStats{};
+    for (const auto& worker : m_workers) {
+        stats.insert(end(stats), begin(worker->stats), end(worker->stats));
+    }
+    return stats;
+}
+
+// Searches the requests of one coordinator until it disconnects.
+static void serve_coordinator(Connection& connection, GameState& game,
+                              UCTSearch& search) {
+    std::mutex mutex;
+    std::condition_variable condvar;
+    auto requests = std::deque<std::string>{};
+    auto closed = false;
+    // Id of the last search the coordinator stopped.
+    auto stopped_id = std::atomic<std::uint64_t>{0};
+
+    auto reader = std::thread([&]() {
+        auto message = std::string{};
+        while (connection.receive(message)) {
+            auto in = std::istringstream{message};
+            auto command = std::string{};
+            auto id = std::uint64_t{0};
+            in >> command >> id;
+            if (command == "stop") {
+                stopped_id = id;
+            } else {
+                std::lock_guard<std::mutex> lock(mutex);
+                requests.emplace_back(std::move(message));
+                condvar.notify_one();
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        stopped_id = std::numeric_limits<std::uint64_t>::max();
+        condvar.notify_one();
+    });
+
+    for (;;) {
+        auto request = std::string{};
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condvar.wait(lock, [&]() { return closed || !requests.empty(); });
+            if (closed) {
+                break;
+            }
+            request = std::move(requests.front());
+            requests.pop_front();
+        }
+
+        auto in = std::istringstream{request};
+        auto command = std::string{};
+        auto id = std::uint64_t{0};
+        auto size = 0;
+        auto komi = 0.0f;
+        auto color = 0;
+        auto hash = std::uint64_t{0};
+        auto max_visits = 0;
+        auto max_playouts = 0;
+        auto count = 0;
+        in >> command >> id >> size >> komi >> color >> hash >> max_visits
+            >> max_playouts >> count;
+        if (!in || command != "search") {
+            continue;
+        }
+        game.init_game(size, komi);
+        game.set_timecontrol(0, 1, 0, 0); // Until stopped.
+        for (auto i = 0; i < count; i++) {
+            auto move_color = 0;
+            auto vertex = 0;
+            in >> move_color >> vertex;
+            game.play_move(move_color, vertex);
+        }
+        game.set_to_move(color);
+        if (!in || game.board.get_hash() != hash) {
+            myprintf("Can't set up the position to search.\n");
+            connection.send("report " + std::to_string(id) + " 1 0");
+            continue;
+        }
+
+        search.set_visit_limit(max_visits);
+        search.set_playout_limit(max_playouts);
+        auto last_report = std::chrono::steady_clock::now();
+        auto baseline = ChildBaseline{};
+        auto started = false;
+        search.set_tick_callback([&](const UCTNode& root, const bool done) {
+            if (!started) {
+                // The tree may be reused from the last search.
+                started = true;
+                baseline = child_baseline(root);
+                return true;
+            }
+            const auto now = std::chrono::steady_clock::now();
+            const auto interval =
+                std::chrono::milliseconds(DistributedSearch::REPORT_MS);
+            if (done || now - last_report >= interval) {
+                connection.send(report_message(id, done, root, baseline));
+                last_report = now;
+            }
+            return stopped_id < id;
+        });
+        search.think(color, UCTSearch::NORESIGN);
+        search.set_tick_callback(nullptr);
+        // Only the coordinator plays the game, don't let the training
+        // data of every search pile up here.
+        Training::clear_training();
+    }
+    connection.close();
+    reader.join();
+}
+
+void DistributedSearch::serve(const std::string& address, Network& network) {
+    auto listener = Transport::listen(address);
+    if (!listener) {
+        return;
+    }
+    myprintf("Search worker listening on %s.\n", address.c_str());
+
+    auto game = GameState{};
+    game.init_game(BOARD_SIZE, KOMI);
+    auto search = UCTSearch{game, network};
+    for (;;) {
+        auto connection = listener->accept();
+        if (!connection) {
+            continue;
+        }
+        myprintf("Coordinator connected.\n");
+        serve_coordinator(*connection, game, search);
+        myprintf("Coordinator disconnected.\n");
+    }
+}
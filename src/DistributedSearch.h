@@ -0,0 +1,123 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef DISTRIBUTEDSEARCH_H_INCLUDED
+#define DISTRIBUTEDSEARCH_H_INCLUDED
+
+#include "config.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "GameState.h"
+#include "Transport.h"
+#include "UCTNode.h"
+
+class Network;
+
+// Root parallel search over several processes.  The coordinator, the
+// process taking GTP commands, has its search workers search the same
+// root while it searches itself.  Each worker keeps its own tree and
+// reports the statistics the root children gathered in this search now
+// and then, and once more when it is stopped.  Visits of a reused tree
+// are left out, the coordinator counted them in an earlier search.  The
+// coordinator adds the last report of every worker to its own root
+// before it picks a move.
+class DistributedSearch {
+public:
+    // How often a worker reports while it searches.
+    static constexpr auto REPORT_MS = 100;
+    // How long the coordinator waits for the last reports.
+    static constexpr auto FINISH_TIMEOUT_MS = 2000;
+    // How often lost workers are connected to again, backing off up to
+    // the maximum while they stay away.
+    static constexpr auto RECONNECT_MS = 1000;
+    static constexpr auto MAX_RECONNECT_MS = 60000;
+
+    struct ChildStats {
+        int move;
+        UCTNode::Stats stats;
+    };
+    using RootStats = std::vector<ChildStats>;
+
+    // Coordinator side, with the addresses of the workers.  Connects to
+    // them right away, and to lost ones again in the background.
+    explicit DistributedSearch(const std::vector<std::string>& workers);
+    ~DistributedSearch();
+
+    // Starts the workers on the root of state, with color to move.
+    void start(const GameState& state, int color, int max_visits,
+               int max_playouts);
+    // Stops the workers and returns their last reports, one entry per
+    // worker and root child.
+    RootStats finish();
+
+    // Worker side: searches for one coordinator after another.  Only
+    // returns if the address can't be listened on.
+    static void serve(const std::string& address, Network& network);
+
+private:
+    struct Worker {
+        std::string address;
+        // Held while the connection is used or replaced.
+        std::mutex connection_mutex;
+        std::unique_ptr<Connection> connection;
+        std::thread reader;
+        // Last report of the current search.
+        RootStats stats;
+        bool finished{true};
+        // Cleared by the reader when the connection breaks.
+        bool connected{false};
+        // Only used by the thread connecting again.
+        std::chrono::steady_clock::time_point next_attempt;
+        std::chrono::milliseconds retry_delay{RECONNECT_MS};
+    };
+
+    void connect(Worker& worker);
+    void disconnect(Worker& worker);
+    void read_reports(Worker& worker);
+    void send(Worker& worker, const std::string& message);
+    void reconnect_lost();
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_condvar;
+    std::uint64_t m_search_id{0};
+    std::thread m_reconnector;
+    std::condition_variable m_reconnect_condvar;
+    bool m_exit{false};
+};
+
+#endif
@@ -109,14 +109,14 @@ void FastState::play_move(const int vertex) {
 
 // Plays the move.
 void FastState::play_move(const int color, const int vertex) {
-    board.m_hash ^= Zobrist::zobrist_ko[m_komove];
+    board.toggle_komove(m_komove);
     if (vertex == FastBoard::PASS) {
         // No Ko move
         m_komove = FastBoard::NO_VERTEX;
     } else {
         m_komove = board.update_board(color, vertex);
     }
-    board.m_hash ^= Zobrist::zobrist_ko[m_komove];
+    board.toggle_komove(m_komove);
 
     m_lastmove = vertex;
     m_movenum++;
@@ -32,6 +32,8 @@
 
 #include "config.h"
 
+#include <algorithm>
+#include <cstddef>
 #include <memory>
 #include <vector>
 
@@ -44,6 +46,9 @@ public:
         std::vector<std::vector<float>> m_conv_biases;
         std::vector<std::vector<float>> m_batchnorm_means;
         std::vector<std::vector<float>> m_batchnorm_stddevs;
+        // Tower convolutions before the Winograd transform, for pipes
+        // that evaluate them in other ways.
+        std::vector<std::vector<float>> m_conv_weights_raw;
 
         // Policy head
         std::vector<float> m_conv_pol_w;
@@ -62,6 +67,28 @@ public:
     virtual void forward(const std::vector<float>& input,
                          std::vector<float>& output_pol,
                          std::vector<float>& output_val) = 0;
+    // Evaluates batch_size positions laid out one after another in input.
+    // Pipes that can evaluate them in a single pass should override this.
+    virtual void forward_batch(const std::vector<float>& input,
+                               std::vector<float>& output_pol,
+                               std::vector<float>& output_val,
+                               const size_t batch_size) {
+        const auto in_size = input.size() / batch_size;
+        const auto out_pol_size = output_pol.size() / batch_size;
+        const auto out_val_size = output_val.size() / batch_size;
+        auto in = std::vector<float>(in_size);
+        auto out_pol = std::vector<float>(out_pol_size);
+        auto out_val = std::vector<float>(out_val_size);
+        for (auto b = size_t{0}; b < batch_size; b++) {
+            std::copy(begin(input) + b * in_size,
+                      begin(input) + (b + 1) * in_size, begin(in));
+            forward(in, out_pol, out_val);
+            std::copy(begin(out_pol), end(out_pol),
+                      begin(output_pol) + b * out_pol_size);
+            std::copy(begin(out_val), end(out_val),
+                      begin(output_val) + b * out_val_size);
+        }
+    }
     virtual void push_weights(
         unsigned int filter_size, unsigned int channels, unsigned int outputs,
         std::shared_ptr<const ForwardPipeWeights> weights) = 0;
@@ -42,6 +42,48 @@ using namespace Utils;
 
 // The FullBoard class extends FastBoard.
 
+static_assert(Network::NUM_SYMMETRIES == 8, "Symmetry count mismatch");
+
+FullBoard::SymmetryTable FullBoard::make_symmetry_table() {
+    constexpr auto sidevertices = BOARD_SIZE + 2;
+    auto table = SymmetryTable{};
+    for (auto sym = 0; sym < NUM_SYMMETRIES; sym++) {
+        // Points off the board map to themselves.
+        for (auto vertex = 0; vertex < NUM_VERTICES; vertex++) {
+            table[sym][vertex] = vertex;
+        }
+        for (auto y = 0; y < BOARD_SIZE; y++) {
+            for (auto x = 0; x < BOARD_SIZE; x++) {
+                const auto newvtx = Network::get_symmetry({x, y}, sym);
+                table[sym][(y + 1) * sidevertices + x + 1] =
+                    (newvtx.second + 1) * sidevertices + newvtx.first + 1;
+            }
+        }
+    }
+    return table;
+}
+
+const FullBoard::SymmetryTable FullBoard::s_symmetry_vertex =
+    FullBoard::make_symmetry_table();
+
+void FullBoard::toggle_stone(const int color, const int vertex) {
+    const auto key = Zobrist::zobrist[color][vertex];
+    m_hash ^= key;
+    m_ko_hash ^= key;
+    for (auto sym = 0; sym < NUM_SYMMETRIES; sym++) {
+        m_symmetry_delta[sym] ^=
+            key ^ Zobrist::zobrist[color][s_symmetry_vertex[sym][vertex]];
+    }
+}
+
+void FullBoard::toggle_komove(const int komove) {
+    const auto key = Zobrist::zobrist_ko[komove];
+    m_hash ^= key;
+    for (auto sym = 0; sym < NUM_SYMMETRIES; sym++) {
+        m_symmetry_delta[sym] ^=
+            key ^ Zobrist::zobrist_ko[s_symmetry_vertex[sym][komove]];
+    }
+}
 
 // Removes an entire group of stones.
 int FullBoard::remove_string(const int i) {
@@ -50,8 +92,7 @@ int FullBoard::remove_string(const int i) {
     int color = m_state[i];
 
     do {
-        m_hash    ^= Zobrist::zobrist[m_state[pos]][pos];
-        m_ko_hash ^= Zobrist::zobrist[m_state[pos]][pos];
+        toggle_stone(m_state[pos], pos);
 
         m_state[pos] = EMPTY;
         m_parent[pos] = NUM_VERTICES;
@@ -62,8 +103,7 @@ int FullBoard::remove_string(const int i) {
         m_empty[m_empty_cnt] = pos;
         m_empty_cnt++;
 
-        m_hash    ^= Zobrist::zobrist[m_state[pos]][pos];
-        m_ko_hash ^= Zobrist::zobrist[m_state[pos]][pos];
+        toggle_stone(m_state[pos], pos);
 
         removed++;
         pos = m_next[pos];
@@ -140,6 +180,17 @@ std::uint64_t FullBoard::get_ko_hash() const {
     return m_ko_hash;
 }
 
+std::pair<std::uint64_t, int> FullBoard::get_canonical_hash() const {
+    auto best = std::make_pair(m_hash, 0);
+    for (auto sym = 1; sym < NUM_SYMMETRIES; sym++) {
+        const auto hash = m_hash ^ m_symmetry_delta[sym];
+        if (hash < best.first) {
+            best = {hash, sym};
+        }
+    }
+    return best;
+}
+
 void FullBoard::set_to_move(const int tomove) {
     if (m_tomove != tomove) {
         m_hash ^= Zobrist::zobrist_blacktomove;
@@ -152,8 +203,7 @@ int FullBoard::update_board(const int color, const int i) {
     assert(i != FastBoard::PASS);
     assert(m_state[i] == EMPTY);
 
-    m_hash ^= Zobrist::zobrist[m_state[i]][i];
-    m_ko_hash ^= Zobrist::zobrist[m_state[i]][i];
+    toggle_stone(m_state[i], i);
 
     m_state[i] = vertex_t(color);
     m_next[i] = i;
@@ -161,8 +211,7 @@ int FullBoard::update_board(const int color, const int i) {
     m_libs[i] = count_pliberties(i);
     m_stones[i] = 1;
 
-    m_hash ^= Zobrist::zobrist[m_state[i]][i];
-    m_ko_hash ^= Zobrist::zobrist[m_state[i]][i];
+    toggle_stone(m_state[i], i);
 
     /* update neighbor liberties (they all lose 1) */
     add_neighbour(i, color);
@@ -240,7 +289,9 @@ void FullBoard::flip(const int starting, const int end, const int dir) {
     assert(tmp > 0 && tmp < NUM_VERTICES);
     while (tmp != end) {
         assert(tmp > 0 && tmp < NUM_VERTICES);
+        toggle_stone(m_state[tmp], tmp);
         m_state[tmp] = color;
+        toggle_stone(color, tmp);
         flip_neighbour(tmp, color);
         tmp += m_dirs[dir];
     }
@@ -304,7 +355,11 @@ void FullBoard::display_board(const int lastmove) {
 
 void FullBoard::reset_board(const int size) {
     FastBoard::reset_board(size);
+    assert(size == BOARD_SIZE);
 
     m_hash = calc_hash();
     m_ko_hash = calc_ko_hash();
+    for (auto sym = 0; sym < NUM_SYMMETRIES; sym++) {
+        m_symmetry_delta[sym] = m_hash ^ calc_symmetry_hash(NO_VERTEX, sym);
+    }
 }
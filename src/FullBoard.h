@@ -32,7 +32,9 @@
 
 #include "config.h"
 
+#include <array>
 #include <cstdint>
+#include <utility>
 
 #include "FastBoard.h"
 
@@ -43,7 +45,12 @@ public:
 
     std::uint64_t get_hash() const;
     std::uint64_t get_ko_hash() const;
+    // Smallest hash over the symmetries of the position, and the
+    // symmetry that transforms the board into that orientation.
+    std::pair<std::uint64_t, int> get_canonical_hash() const;
     void set_to_move(int tomove);
+    // Adds or removes the ko point from the hash.
+    void toggle_komove(int komove);
 
     void reset_board(int size);
     void display_board(int lastmove = -1);
@@ -60,8 +67,24 @@ public:
     std::uint64_t m_ko_hash;
 
 private:
+    static constexpr auto NUM_SYMMETRIES = 8;
+
     template <class Function>
     std::uint64_t calc_hash(int komove, Function transform) const;
+    // Adds or removes the given stone (or empty point) from the hashes.
+    void toggle_stone(int color, int vertex);
+
+    // m_hash ^ m_symmetry_delta[s] is the hash of the board transformed
+    // by symmetry s, kept up to date along with m_hash.
+    std::array<std::uint64_t, NUM_SYMMETRIES> m_symmetry_delta;
+
+    // Vertex mapped by each symmetry.  Built once at startup for
+    // BOARD_SIZE, the only size boards have, and never written again, as
+    // the boards of concurrent searches read it.
+    using SymmetryTable =
+        std::array<std::array<int, NUM_VERTICES>, NUM_SYMMETRIES>;
+    static SymmetryTable make_symmetry_table();
+    static const SymmetryTable s_symmetry_vertex;
 };
 
 #endif
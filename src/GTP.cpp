@@ -67,6 +67,8 @@ bool cfg_allow_pondering; // Determines if the AI can think during the
                           // opponent's turn.
 unsigned int cfg_num_threads; // Specifies the number of threads used
                               // for parallel processing.
+unsigned int cfg_gemm_threads; // Number of threads each CPU network
+                               // evaluation is split over.
 unsigned int cfg_batch_size; // Specifies size of input batches used.
 int cfg_max_playouts; // Maximum number of playouts allowed.
 int cfg_max_visits; // Maximum number of visits during search.
@@ -74,6 +76,21 @@ size_t cfg_max_memory; // Maximum memory allowed.
 size_t cfg_max_tree_size; // Maximum size of search tree.
 int cfg_max_cache_ratio_percent; // Percentage of memory allocated for
                                  // the NNCache.
+bool cfg_exact_cache; // Store full precision results in the NNCache.
+std::string cfg_cache_file; // NNCache file loaded at start, saved at exit.
+std::string cfg_cache_eviction; // NNCache eviction policy.
+bool cfg_shared_cache; // Use an NNCache in shared memory.
+bool cfg_huge_pages; // Back the search tree with huge pages.
+bool cfg_affinity; // Pin threads to cores and NUMA nodes.
+std::string cfg_serve_search; // Address to serve searches on as a worker.
+std::vector<std::string> cfg_search_workers; // Addresses of search workers.
+std::string cfg_nn_server; // Address to serve network evaluations on.
+std::string cfg_nn_client; // Inference server to evaluate the network with.
+std::string cfg_gtp_listen; // Address to serve GTP sessions on.
+unsigned int cfg_gtp_session_threads; // Search threads of every session.
+int cfg_gtp_session_visits; // Most visits of a search of a session.
+unsigned int cfg_gtp_max_sessions; // Most sessions open at once.
+bool cfg_transpositions; // Share nodes between move order transpositions.
 TimeManagement::enabled_t cfg_timemanage; // Configuration for TimeManagement.
 int cfg_lagbuffer_cs; // Lag buffer size in centiseconds, used for
                       // network latency compensation.
@@ -88,6 +105,11 @@ float cfg_random_temp; // Parameter for the level of random playouts
                        // (these are used for exploration purposes).
 std::uint64_t cfg_rng_seed; // Seed for the rng.
 bool cfg_dumbpass; // Determines if the AI should make simple evaluations to pass.
+int cfg_selfplay; // Number of self-play games played at once, 0 for GTP.
+int cfg_selfplay_games; // Number of self-play games to play, 0 for no end.
+std::string cfg_selfplay_output; // Base name of the self-play output files.
+std::string cfg_analyze_file; // File of positions to analyze, empty for GTP.
+int cfg_analyze_parallel; // Number of positions analyzed at once.
 #ifdef USE_OPENCL
 std::vector<int> cfg_gpus; // List of gpu IDs used for computation.
 bool cfg_sgemm_exhaustive; // Flag indicating whether the OpenCL SGEMM
@@ -114,7 +136,7 @@ bool cfg_quiet; // Determines if program suppresses output.
 std::string cfg_options_str;
 bool cfg_benchmark; // Flag indicating whether it's running in benchmark mode.
 bool cfg_cpu_only; // Flag indicating whether the AI should only use the CPU.
-AnalyzeTags cfg_analyze_tags;
+thread_local AnalyzeTags cfg_analyze_tags;
 
 /* Parses tags for the lz-analyze GTP command and friends */
 AnalyzeTags::AnalyzeTags(std::istringstream& cmdstream, const GameState& game) {
@@ -361,6 +383,24 @@ void GTP::initialize(std::unique_ptr<Network>&& net) {
         throw std::runtime_error("Error setting memory requirements.");
     }
     myprintf("%s\n", message.c_str());
+
+    // Fall back to the private cache if the shared one can't be used.
+    if (cfg_shared_cache) {
+        s_network->nncache_attach_shared();
+    }
+
+    // A missing file is fine, it will be created at exit.
+    if (!cfg_cache_file.empty() && std::ifstream{cfg_cache_file}) {
+        if (s_network->nncache_load(cfg_cache_file)) {
+            myprintf("Loaded NNCache from %s.\n", cfg_cache_file.c_str());
+        }
+    }
+}
+
+void GTP::save_cache_file() {
+    if (!cfg_cache_file.empty() && s_network) {
+        s_network->nncache_save(cfg_cache_file);
+    }
 }
 
 void GTP::setup_default_parameters() {
@@ -370,6 +410,8 @@ void GTP::setup_default_parameters() {
     // we will re-calculate this on Leela.cpp
     cfg_num_threads = 1;
     // we will re-calculate this on Leela.cpp
+    cfg_gemm_threads = 1;
+    // we will re-calculate this on Leela.cpp
     cfg_batch_size = 1;
 
     cfg_max_memory = UCTSearch::DEFAULT_MAX_MEMORY;
@@ -378,6 +420,21 @@ void GTP::setup_default_parameters() {
     // This will be overwriiten in initialize() after network size is known.
     cfg_max_tree_size = UCTSearch::DEFAULT_MAX_MEMORY;
     cfg_max_cache_ratio_percent = 10;
+    cfg_exact_cache = false;
+    cfg_cache_file.clear();
+    cfg_cache_eviction = "fifo";
+    cfg_shared_cache = false;
+    cfg_huge_pages = false;
+    cfg_affinity = false;
+    cfg_serve_search.clear();
+    cfg_search_workers.clear();
+    cfg_nn_server.clear();
+    cfg_nn_client.clear();
+    cfg_gtp_listen.clear();
+    cfg_gtp_session_threads = 1;
+    cfg_gtp_session_visits = UCTSearch::UNLIMITED_PLAYOUTS;
+    cfg_gtp_max_sessions = 4;
+    cfg_transpositions = false;
     cfg_timemanage = TimeManagement::AUTO;
     cfg_lagbuffer_cs = 100;
     cfg_weightsfile = leelaz_file("best-network");
@@ -405,6 +462,11 @@ void GTP::setup_default_parameters() {
     cfg_random_min_visits = 1;
     cfg_random_temp = 1.0f;
     cfg_dumbpass = false;
+    cfg_selfplay = 0;
+    cfg_selfplay_games = 0;
+    cfg_selfplay_output = "selfplay";
+    cfg_analyze_file.clear();
+    cfg_analyze_parallel = 8;
     cfg_logfile_handle = nullptr;
     cfg_quiet = false;
     cfg_benchmark = false;
@@ -462,7 +524,10 @@ const std::string GTP::s_commands[] = {
     "lz-analyze",
     "lz-genmove_analyze",
     "lz-memory_report",
+    "lz-cache_stats",
     "lz-setoption",
+    "lz-save_cache",
+    "lz-load_cache",
     "gomill-explain_last_move",
     ""
 };
@@ -477,6 +542,7 @@ const std::string GTP::s_options[] = {
     "option name Lagbuffer type spin default 0 min 0 max 3000",
     "option name Resign Percentage type spin default -1 min -1 max 30",
     "option name Pondering type check default true",
+    "option name Cache Eviction type combo default fifo var fifo var clock var tinylfu",
     ""
 };
 
@@ -511,11 +577,32 @@ std::string GTP::get_life_list(const GameState& game, const bool live) {
     return result;
 }
 
-// Executes GTP commands.
+// Executes GTP commands from stdin, the program ends with the session.
 void GTP::execute(GameState& game, const std::string& xinput) {
+    static auto session = Session{};
+    if (!execute(game, session, xinput)) {
+        exit(EXIT_SUCCESS);
+    }
+}
+
+// Creates the search of the session, with its limits.
+void GTP::new_search(GameState& game, Session& session) {
+    session.search = std::make_unique<UCTSearch>(game, *s_network);
+    session.search->set_thread_pool(*session.pool, session.threads);
+    session.search->set_visit_limit(
+        std::min(session.visits, session.max_visits));
+    session.search->set_playout_limit(session.playouts);
+}
+
+// Executes GTP commands.
+bool GTP::execute(GameState& game, Session& session,
+                  const std::string& xinput) {
     std::string input;
     // Initializes the search tree.
-    static auto search = std::make_unique<UCTSearch>(game, *s_network);
+    if (!session.search) {
+        new_search(game, session);
+    }
+    auto& search = session.search;
 
     bool transform_lowercase = true;
 
@@ -553,12 +640,15 @@ void GTP::execute(GameState& game, const std::string& xinput) {
     int id = -1;
 
     if (input == "") {
-        return;
+        return true;
     } else if (input == "exit") {
-        exit(EXIT_SUCCESS);
+        if (!session.shared) {
+            save_cache_file();
+        }
+        return false;
     } else if (input.find("#") == 0) {
         // Allows to ignore comments in the input.
-        return;
+        return true;
     } else if (std::isdigit(input[0])) {
         // Seperates the id from the command if there is an id in front.
         std::istringstream strm(input);
@@ -573,16 +663,19 @@ void GTP::execute(GameState& game, const std::string& xinput) {
     /* process commands */
     if (command == "protocol_version") {
         gtp_printf(id, "%d", GTP_VERSION);
-        return;
+        return true;
     } else if (command == "name") {
         gtp_printf(id, PROGRAM_NAME);
-        return;
+        return true;
     } else if (command == "version") {
         gtp_printf(id, PROGRAM_VERSION);
-        return;
+        return true;
     } else if (command == "quit") {
+        if (!session.shared) {
+            save_cache_file();
+        }
         gtp_printf(id, "");
-        exit(EXIT_SUCCESS);
+        return false;
     } else if (command.find("known_command") == 0) {
         // Checks if a command is present in the list of known commands.
         std::istringstream cmdstream(command);
@@ -594,19 +687,19 @@ void GTP::execute(GameState& game, const std::string& xinput) {
         for (int i = 0; s_commands[i].size() > 0; i++) {
             if (tmp == s_commands[i]) {
                 gtp_printf(id, "true");
-                return;
+                return true;
             }
         }
 
         gtp_printf(id, "false");
-        return;
+        return true;
     } else if (command.find("list_commands") == 0) {
         std::string outtmp(s_commands[0]);
         for (int i = 1; s_commands[i].size() > 0; i++) {
             outtmp = outtmp + "\n" + s_commands[i];
         }
         gtp_printf(id, outtmp.c_str());
-        return;
+        return true;
     } else if (command.find("boardsize") == 0) {
         // Resets a board with the desired size, but in the current
         // version it only accepts the predefined board size.
@@ -630,15 +723,14 @@ void GTP::execute(GameState& game, const std::string& xinput) {
             gtp_fail_printf(id, "syntax not understood");
         }
 
-        return;
+        return true;
     } else if (command.find("clear_board") == 0) {
         // Clears the board.
         Training::clear_training();
         game.reset_game();
-        search = std::make_unique<UCTSearch>(game, *s_network);
-        assert(UCTNodePointer::get_tree_size() == 0);
+        new_search(game, session);
         gtp_printf(id, "");
-        return;
+        return true;
     } else if (command.find("komi") == 0) {
         // Sets komi size.
         std::istringstream cmdstream(command);
@@ -658,7 +750,7 @@ void GTP::execute(GameState& game, const std::string& xinput) {
             gtp_fail_printf(id, "syntax not understood");
         }
 
-        return;
+        return true;
     } else if (command.find("play") == 0) {
         // Plays the move specifying color and vertex.
         std::istringstream cmdstream(command);
@@ -678,7 +770,7 @@ void GTP::execute(GameState& game, const std::string& xinput) {
         } else {
             gtp_fail_printf(id, "syntax not understood");
         }
-        return;
+        return true;
     } else if (command.find("genmove") == 0
                || command.find("lz-genmove_analyze") == 0) {
         // Generates a move for the specified player.
@@ -698,7 +790,7 @@ void GTP::execute(GameState& game, const std::string& xinput) {
             // avoid or allow moves.
             if (tags.invalid()) {
                 gtp_fail_printf(id, "cannot parse analyze tags");
-                return;
+                return true;
             }
             who = tags.who();
         } else {
@@ -710,7 +802,7 @@ void GTP::execute(GameState& game, const std::string& xinput) {
                 who = FastBoard::BLACK;
             } else {
                 gtp_fail_printf(id, "syntax error");
-                return;
+                return true;
             }
         }
 
@@ -751,7 +843,7 @@ void GTP::execute(GameState& game, const std::string& xinput) {
             gtp_printf_raw("\n");
         }
         cfg_analyze_tags = {};
-        return;
+        return true;
     } else if (command.find("lz-analyze") == 0) {
         // Ponders without making moves.
         std::istringstream cmdstream(command);
@@ -761,7 +853,7 @@ void GTP::execute(GameState& game, const std::string& xinput) {
         AnalyzeTags tags{cmdstream, game};
         if (tags.invalid()) {
             gtp_fail_printf(id, "cannot parse analyze tags");
-            return;
+            return true;
         }
         // Start multi-line response.
         if (id != -1) {
@@ -779,7 +871,7 @@ void GTP::execute(GameState& game, const std::string& xinput) {
         cfg_analyze_tags = {};
         // Terminate multi-line response
         gtp_printf_raw("\n");
-        return;
+        return true;
     } else if (command.find("kgs-genmove_cleanup") == 0) {
         std::istringstream cmdstream(command);
         std::string tmp;
@@ -795,7 +887,7 @@ void GTP::execute(GameState& game, const std::string& xinput) {
                 who = FastBoard::BLACK;
             } else {
                 gtp_fail_printf(id, "syntax error");
-                return;
+                return true;
             }
             // Sets the passes to 0.
             game.set_passes(0);
@@ -817,7 +909,7 @@ void GTP::execute(GameState& game, const std::string& xinput) {
         } else {
             gtp_fail_printf(id, "syntax not understood");
         }
-        return;
+        return true;
     } else if (command.find("undo") == 0) {
         // Fixes the board to previous state.
         if (game.undo_move()) {
@@ -825,12 +917,12 @@ void GTP::execute(GameState& game, const std::string& xinput) {
         } else {
             gtp_fail_printf(id, "cannot undo");
         }
-        return;
+        return true;
     } else if (command.find("showboard") == 0) {
         // Displays the board.
         gtp_printf(id, "");
         game.display_state();
-        return;
+        return true;
     } else if (command.find("final_score") == 0) {
         float ftmp = game.final_score();
         /* white wins */
@@ -841,7 +933,7 @@ void GTP::execute(GameState& game, const std::string& xinput) {
         } else {
             gtp_printf(id, "0");
         }
-        return;
+        return true;
     } else if (command.find("final_status_list") == 0) {
         if (command.find("alive") != std::string::npos) {
             std::string livelist = get_life_list(game, true);
@@ -852,7 +944,7 @@ void GTP::execute(GameState& game, const std::string& xinput) {
         } else {
             gtp_printf(id, "");
         }
-        return;
+        return true;
     } else if (command.find("time_settings") == 0) {
         // Sets up time.
         std::istringstream cmdstream(command);
@@ -869,7 +961,7 @@ void GTP::execute(GameState& game, const std::string& xinput) {
         } else {
             gtp_fail_printf(id, "syntax not understood");
         }
-        return;
+        return true;
     } else if (command.find("time_left") == 0) {
         // Sets up time left for the player we want.
         std::istringstream cmdstream(command);
@@ -887,7 +979,7 @@ void GTP::execute(GameState& game, const std::string& xinput) {
                 icolor = FastBoard::BLACK;
             } else {
                 gtp_fail_printf(id, "Color in time adjust not understood.\n");
-                return;
+                return true;
             }
 
             game.adjust_time(icolor, time * 100, stones);
@@ -904,7 +996,7 @@ void GTP::execute(GameState& game, const std::string& xinput) {
         } else {
             gtp_fail_printf(id, "syntax not understood");
         }
-        return;
+        return true;
     } else if (command.find("auto") == 0) {
         // Let program play on its own against itself.
         do {
@@ -914,7 +1006,7 @@ void GTP::execute(GameState& game, const std::string& xinput) {
 
         } while (game.get_passes() < 2 && !game.has_resigned());
 
-        return;
+        return true;
     } else if (command.find("go") == 0 && command.size() < 6) {
         // Plays one move on its own.
         int move = search->think(game.get_to_move());
@@ -922,7 +1014,7 @@ void GTP::execute(GameState& game, const std::string& xinput) {
 
         std::string vertex = game.move_to_text(move);
         myprintf("%s\n", vertex.c_str());
-        return;
+        return true;
     } else if (command.find("heatmap") == 0) {
         // Shows the value for each move.
         std::istringstream cmdstream(command);
@@ -956,7 +1048,7 @@ void GTP::execute(GameState& game, const std::string& xinput) {
         }
 
         gtp_printf(id, "");
-        return;
+        return true;
     } else if (command.find("fixed_handicap") == 0) {
         // Sets up handicap stones for black.
         std::istringstream cmdstream(command);
@@ -972,18 +1064,18 @@ void GTP::execute(GameState& game, const std::string& xinput) {
         } else {
             gtp_fail_printf(id, "Not a valid number of handicap stones");
         }
-        return;
+        return true;
     } else if (command.find("last_move") == 0) {
         // Displays last move played.
         auto last_move = game.get_last_move();
         if (last_move == FastBoard::NO_VERTEX) {
             gtp_fail_printf(id, "no previous move known");
-            return;
+            return true;
         }
         auto coordinate = game.move_to_text(last_move);
         auto color = game.get_to_move() == FastBoard::WHITE ? "black" : "white";
         gtp_printf(id, "%s %s", color, coordinate.c_str());
-        return;
+        return true;
     } else if (command.find("move_history") == 0) {
         // Gets the state history, then checks last move for each of
         // these to display history of moves.
@@ -1003,11 +1095,39 @@ void GTP::execute(GameState& game, const std::string& xinput) {
             gtp_printf_raw("%s %s\n", color, coordinate.c_str());
         }
         gtp_printf_raw("\n");
-        return;
+        return true;
     } else if (command.find("clear_cache") == 0) {
+        if (session.shared) {
+            gtp_fail_printf(id, "cache is shared by all sessions");
+            return true;
+        }
         s_network->nncache_clear();
         gtp_printf(id, "");
-        return;
+        return true;
+    } else if (command.find("lz-save_cache") == 0
+               || command.find("lz-load_cache") == 0) {
+        std::istringstream cmdstream(command);
+        std::string tmp, filename;
+
+        cmdstream >> tmp >> filename;
+        if (cmdstream.fail()) {
+            gtp_fail_printf(id, "syntax not understood");
+            return true;
+        } else if (session.shared) {
+            gtp_fail_printf(id, "cache is shared by all sessions");
+            return true;
+        }
+
+        auto success = tmp == "lz-save_cache"
+                           ? s_network->nncache_save(filename)
+                           : s_network->nncache_load(filename);
+        if (success) {
+            gtp_printf(id, "");
+        } else {
+            gtp_fail_printf(id, "cannot %s cache file",
+                            tmp == "lz-save_cache" ? "save" : "load");
+        }
+        return true;
     } else if (command.find("place_free_handicap") == 0) {
         // Places random free handicap stones for black.
         std::istringstream cmdstream(command);
@@ -1025,7 +1145,7 @@ void GTP::execute(GameState& game, const std::string& xinput) {
             gtp_fail_printf(id, "Not a valid number of handicap stones");
         }
 
-        return;
+        return true;
     } else if (command.find("set_free_handicap") == 0) {
         // Adds a handicap to black.
         std::istringstream cmdstream(command);
@@ -1050,9 +1170,13 @@ void GTP::execute(GameState& game, const std::string& xinput) {
         std::string stonestring = game.board.get_stone_list();
         gtp_printf(id, "%s", stonestring.c_str());
 
-        return;
+        return true;
     } else if (command.find("loadsgf") == 0) {
         // Loads a game from an SGF file.
+        if (session.shared) {
+            gtp_fail_printf(id, "no file access in shared sessions");
+            return true;
+        }
         std::istringstream cmdstream(command);
         std::string tmp, filename;
         int movenum;
@@ -1068,7 +1192,7 @@ void GTP::execute(GameState& game, const std::string& xinput) {
             }
         } else {
             gtp_fail_printf(id, "Missing filename.");
-            return;
+            return true;
         }
 
         auto sgftree = std::make_unique<SGFTree>();
@@ -1080,7 +1204,7 @@ void GTP::execute(GameState& game, const std::string& xinput) {
         } catch (const std::exception&) {
             gtp_fail_printf(id, "cannot load file");
         }
-        return;
+        return true;
     } else if (command.find("kgs-chat") == 0) {
         // kgs-chat (game|private) Name Message
         std::istringstream cmdstream(command);
@@ -1094,11 +1218,11 @@ void GTP::execute(GameState& game, const std::string& xinput) {
         } while (!cmdstream.fail());
 
         gtp_fail_printf(id, "I'm a go bot, not a chat bot.");
-        return;
+        return true;
     } else if (command.find("kgs-game_over") == 0) {
         // Do nothing. Particularly, don't ponder.
         gtp_printf(id, "");
-        return;
+        return true;
     } else if (command.find("kgs-time_settings") == 0) {
         // Sets the type of time control.
         // none, absolute, byoyomi, or canadian
@@ -1125,7 +1249,7 @@ void GTP::execute(GameState& game, const std::string& xinput) {
             game.set_timecontrol(maintime * 100, byotime * 100, 0, byoperiods);
         } else {
             gtp_fail_printf(id, "syntax not understood");
-            return;
+            return true;
         }
 
         if (!cmdstream.fail()) {
@@ -1133,7 +1257,7 @@ void GTP::execute(GameState& game, const std::string& xinput) {
         } else {
             gtp_fail_printf(id, "syntax not understood");
         }
-        return;
+        return true;
     } else if (command.find("netbench") == 0) {
         // Benchmarks the neural network.
         std::istringstream cmdstream(command);
@@ -1149,7 +1273,7 @@ void GTP::execute(GameState& game, const std::string& xinput) {
             s_network->benchmark(&game);
         }
         gtp_printf(id, "");
-        return;
+        return true;
 
     } else if (command.find("printsgf") == 0) {
         // Prints the game into an sgf file.
@@ -1166,6 +1290,8 @@ void GTP::execute(GameState& game, const std::string& xinput) {
 
         if (cmdstream.fail()) {
             gtp_printf(id, "%s\n", sgf_text.c_str());
+        } else if (session.shared) {
+            gtp_fail_printf(id, "no file access in shared sessions");
         } else {
             std::ofstream out(filename);
             out << sgf_text;
@@ -1173,8 +1299,12 @@ void GTP::execute(GameState& game, const std::string& xinput) {
             gtp_printf(id, "");
         }
 
-        return;
+        return true;
     } else if (command.find("load_training") == 0) {
+        if (session.shared) {
+            gtp_fail_printf(id, "no file access in shared sessions");
+            return true;
+        }
         std::istringstream cmdstream(command);
         std::string tmp, filename;
 
@@ -1189,8 +1319,12 @@ void GTP::execute(GameState& game, const std::string& xinput) {
             gtp_fail_printf(id, "syntax not understood");
         }
 
-        return;
+        return true;
     } else if (command.find("save_training") == 0) {
+        if (session.shared) {
+            gtp_fail_printf(id, "no file access in shared sessions");
+            return true;
+        }
         std::istringstream cmdstream(command);
         std::string tmp, filename;
 
@@ -1205,8 +1339,12 @@ void GTP::execute(GameState& game, const std::string& xinput) {
             gtp_fail_printf(id, "syntax not understood");
         }
 
-        return;
+        return true;
     } else if (command.find("dump_training") == 0) {
+        if (session.shared) {
+            gtp_fail_printf(id, "no file access in shared sessions");
+            return true;
+        }
         std::istringstream cmdstream(command);
         std::string tmp, winner_color, filename;
         int who_won;
@@ -1220,7 +1358,7 @@ void GTP::execute(GameState& game, const std::string& xinput) {
             who_won = FullBoard::BLACK;
         } else {
             gtp_fail_printf(id, "syntax not understood");
-            return;
+            return true;
         }
 
         Training::dump_training(who_won, filename);
@@ -1231,8 +1369,12 @@ void GTP::execute(GameState& game, const std::string& xinput) {
             gtp_fail_printf(id, "syntax not understood");
         }
 
-        return;
+        return true;
     } else if (command.find("dump_debug") == 0) {
+        if (session.shared) {
+            gtp_fail_printf(id, "no file access in shared sessions");
+            return true;
+        }
         std::istringstream cmdstream(command);
         std::string tmp, filename;
 
@@ -1247,8 +1389,12 @@ void GTP::execute(GameState& game, const std::string& xinput) {
             gtp_fail_printf(id, "syntax not understood");
         }
 
-        return;
+        return true;
     } else if (command.find("dump_supervised") == 0) {
+        if (session.shared) {
+            gtp_fail_printf(id, "no file access in shared sessions");
+            return true;
+        }
         std::istringstream cmdstream(command);
         std::string tmp, sgfname, outname;
 
@@ -1262,11 +1408,13 @@ void GTP::execute(GameState& game, const std::string& xinput) {
         } else {
             gtp_fail_printf(id, "syntax not understood");
         }
-        return;
+        return true;
     } else if (command.find("lz-memory_report") == 0) {
         auto base_memory = get_base_memory();
-        auto tree_size = add_overhead(UCTNodePointer::get_tree_size());
-        auto cache_size = add_overhead(s_network->get_estimated_cache_size());
+        // The tree lives in arenas, their size is exact.
+        auto tree_size = UCTNodePointer::get_tree_size();
+        // The cache is a single preallocated table, no per entry overhead.
+        auto cache_size = s_network->get_estimated_cache_size();
 
         auto total = base_memory + tree_size + cache_size;
         gtp_printf(id,
@@ -1274,15 +1422,21 @@ void GTP::execute(GameState& game, const std::string& xinput) {
                    "Network with overhead: %d MiB / Search tree: %d MiB / Network cache: %d\n",
                    total / MiB, base_memory / MiB, tree_size / MiB,
                    cache_size / MiB);
-        return;
+        return true;
+    } else if (command.find("lz-cache_stats") == 0) {
+        // Hit rates since startup, written to the log like the search info.
+        s_network->nncache_dump_stats();
+        gtp_printf(id, "");
+        return true;
     } else if (command.find("lz-setoption") == 0) {
-        return execute_setoption(*search.get(), id, command);
+        execute_setoption(session, id, command);
+        return true;
     } else if (command.find("gomill-explain_last_move") == 0) {
         gtp_printf(id, "%s\n", search->explain_last_think().c_str());
-        return;
+        return true;
     }
     gtp_fail_printf(id, "unknown command");
-    return;
+    return true;
 }
 
 std::pair<std::string, std::string> GTP::parse_option(std::istringstream& is) {
@@ -1333,11 +1487,8 @@ std::pair<bool, std::string> GTP::set_max_memory(
     auto max_cache_size =
         max_memory_for_search * cache_size_ratio_percent / 100;
 
-    auto max_cache_count =
-        (int)(remove_overhead(max_cache_size) / NNCache::ENTRY_SIZE);
-
     // Verify if the setting would not result in too little cache.
-    if (max_cache_count < NNCache::MIN_CACHE_COUNT) {
+    if (max_cache_size < NNCache::MIN_CACHE_COUNT * NNCache::ENTRY_SIZE) {
         return std::make_pair(false, "Not enough memory for cache.");
     }
     auto max_tree_size = max_memory_for_search - max_cache_size;
@@ -1350,9 +1501,9 @@ std::pair<bool, std::string> GTP::set_max_memory(
     cfg_max_memory = max_memory;
     cfg_max_cache_ratio_percent = cache_size_ratio_percent;
     // Set max_tree_size.
-    cfg_max_tree_size = remove_overhead(max_tree_size);
+    cfg_max_tree_size = max_tree_size;
     // Resize cache.
-    s_network->nncache_resize(max_cache_count);
+    s_network->nncache_resize(max_cache_size);
 
     return std::make_pair(
         true, "Setting max tree size to " + std::to_string(max_tree_size / MiB)
@@ -1362,7 +1513,7 @@ std::pair<bool, std::string> GTP::set_max_memory(
 
 // Sets up other options, like maximum number of visits, playouts,
 // lagbuffer, enable or disable pondering, resign percentage, etc.
-void GTP::execute_setoption(UCTSearch& search, const int id,
+void GTP::execute_setoption(Session& session, const int id,
                             const std::string& command) {
     std::istringstream cmdstream(command);
     std::string tmp, name_token;
@@ -1388,6 +1539,12 @@ void GTP::execute_setoption(UCTSearch& search, const int id,
     std::string name, value;
     std::tie(name, value) = parse_option(cmdstream);
 
+    // The limits of the search are the only options of a session.
+    if (session.shared && name != "visits" && name != "playouts") {
+        gtp_fail_printf(id, "option is shared by all sessions");
+        return;
+    }
+
     if (name == "maximum memory use (mib)") {
         std::istringstream valuestream(value);
         int max_memory_in_mib;
@@ -1433,38 +1590,45 @@ void GTP::execute_setoption(UCTSearch& search, const int id,
         std::istringstream valuestream(value);
         int visits;
         valuestream >> visits;
-        cfg_max_visits = visits;
+        session.visits = visits;
 
         // 0 may be specified to mean "no limit"
-        if (cfg_max_visits == 0) {
-            cfg_max_visits = UCTSearch::UNLIMITED_PLAYOUTS;
+        if (session.visits == 0) {
+            session.visits = UCTSearch::UNLIMITED_PLAYOUTS;
+        }
+        if (!session.shared) {
+            cfg_max_visits = session.visits;
         }
         // Note that if the visits are changed but no
         // explicit command to set memory usage is given,
         // we will stick with the initial guess we made on startup.
-        search.set_visit_limit(cfg_max_visits);
+        session.search->set_visit_limit(
+            std::min(session.visits, session.max_visits));
 
         gtp_printf(id, "");
     } else if (name == "playouts") {
         std::istringstream valuestream(value);
         int playouts;
         valuestream >> playouts;
-        cfg_max_playouts = playouts;
 
         // 0 may be specified to mean "no limit"
-        if (cfg_max_playouts == 0) {
-            cfg_max_playouts = UCTSearch::UNLIMITED_PLAYOUTS;
+        if (playouts == 0) {
+            playouts = UCTSearch::UNLIMITED_PLAYOUTS;
         } else if (cfg_allow_pondering) {
             // Limiting playouts while pondering is still enabled
             // makes no sense.
             gtp_fail_printf(id, "incorrect value");
             return;
         }
+        session.playouts = playouts;
+        if (!session.shared) {
+            cfg_max_playouts = session.playouts;
+        }
 
         // Note that if the playouts are changed but no
         // explicit command to set memory usage is given,
         // we will stick with the initial guess we made on startup.
-        search.set_playout_limit(cfg_max_playouts);
+        session.search->set_playout_limit(session.playouts);
 
         gtp_printf(id, "");
     } else if (name == "lagbuffer") {
@@ -1490,6 +1654,18 @@ void GTP::execute_setoption(UCTSearch& search, const int id,
             return;
         }
         gtp_printf(id, "");
+    } else if (name == "cache eviction") {
+        std::istringstream valuestream(value);
+        std::string policy;
+        valuestream >> policy;
+        auto eviction = NNCache::Eviction{};
+        if (!NNCache::eviction_from_string(policy, eviction)) {
+            gtp_fail_printf(id, "incorrect value");
+            return;
+        }
+        cfg_cache_eviction = policy;
+        s_network->nncache_set_eviction(eviction);
+        gtp_printf(id, "");
     } else if (name == "resign percentage") {
         std::istringstream valuestream(value);
         int resignpct;
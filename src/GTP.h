@@ -39,6 +39,7 @@
 #include "GameState.h"
 #include "Network.h"
 #include "UCTSearch.h"
+#include "Utils.h"
 
 struct MoveToAvoid {
     int color;
@@ -81,12 +82,28 @@ private:
 extern bool cfg_gtp_mode;
 extern bool cfg_allow_pondering;
 extern unsigned int cfg_num_threads;
+extern unsigned int cfg_gemm_threads;
 extern unsigned int cfg_batch_size;
 extern int cfg_max_playouts;
 extern int cfg_max_visits;
 extern size_t cfg_max_memory;
 extern size_t cfg_max_tree_size;
 extern int cfg_max_cache_ratio_percent;
+extern bool cfg_exact_cache;
+extern std::string cfg_cache_file;
+extern std::string cfg_cache_eviction;
+extern bool cfg_shared_cache;
+extern bool cfg_huge_pages;
+extern bool cfg_affinity;
+extern std::string cfg_serve_search;
+extern std::vector<std::string> cfg_search_workers;
+extern std::string cfg_nn_server;
+extern std::string cfg_nn_client;
+extern std::string cfg_gtp_listen;
+extern unsigned int cfg_gtp_session_threads;
+extern int cfg_gtp_session_visits;
+extern unsigned int cfg_gtp_max_sessions;
+extern bool cfg_transpositions;
 extern TimeManagement::enabled_t cfg_timemanage;
 extern int cfg_lagbuffer_cs;
 extern int cfg_resignpct;
@@ -96,6 +113,11 @@ extern int cfg_random_min_visits;
 extern float cfg_random_temp;
 extern std::uint64_t cfg_rng_seed;
 extern bool cfg_dumbpass;
+extern int cfg_selfplay;
+extern int cfg_selfplay_games;
+extern std::string cfg_selfplay_output;
+extern std::string cfg_analyze_file;
+extern int cfg_analyze_parallel;
 #ifdef USE_OPENCL
 extern std::vector<int> cfg_gpus;
 extern bool cfg_sgemm_exhaustive;
@@ -122,7 +144,8 @@ extern bool cfg_quiet;
 extern std::string cfg_options_str;
 extern bool cfg_benchmark;
 extern bool cfg_cpu_only;
-extern AnalyzeTags cfg_analyze_tags;
+// Set by the thread running a GTP command, the search workers take it over.
+extern thread_local AnalyzeTags cfg_analyze_tags;
 
 static constexpr size_t MiB = 1024LL * 1024LL;
 
@@ -133,10 +156,29 @@ static constexpr size_t MiB = 1024LL * 1024LL;
 */
 class GTP {
 public:
+    // What one stream of GTP commands searches with.  Sessions of the
+    // GTP server have their own threads and limits, and are shared:
+    // they may not change what other sessions use too.
+    struct Session {
+        std::unique_ptr<UCTSearch> search;
+        Utils::ThreadPool* pool{&thread_pool};
+        size_t threads{cfg_num_threads};
+        int visits{cfg_max_visits};
+        int playouts{cfg_max_playouts};
+        // Visits of any one search, whatever lz-setoption asks for.
+        int max_visits{UCTSearch::UNLIMITED_PLAYOUTS};
+        bool shared{false};
+    };
+
     static std::unique_ptr<Network> s_network;
     static void initialize(std::unique_ptr<Network>&& network);
     static void execute(GameState& game, const std::string& xinput);
+    // Returns false when the session ends with quit or exit.
+    static bool execute(GameState& game, Session& session,
+                        const std::string& xinput);
     static void setup_default_parameters();
+    // Write the NNCache to --cache-file, if one was given.
+    static void save_cache_file();
 
 private:
     static constexpr int GTP_VERSION = 2;
@@ -148,17 +190,12 @@ private:
         std::istringstream& is);
     static std::pair<bool, std::string> set_max_memory(
         size_t max_memory, int cache_size_ratio_percent);
-    static void execute_setoption(UCTSearch& search, int id,
+    static void new_search(GameState& game, Session& session);
+    static void execute_setoption(Session& session, int id,
                                   const std::string& command);
 
     // Memory estimation helpers
     static size_t get_base_memory();
-    static size_t add_overhead(const size_t s) {
-        return s * 11LL / 10LL;
-    }
-    static size_t remove_overhead(const size_t s) {
-        return s * 10LL / 11LL;
-    }
 };
 
 #endif
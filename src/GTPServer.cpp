@@ -0,0 +1,104 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include "GTPServer.h"
+
+#include "GTP.h"
+#include "GameState.h"
+#include "ThreadPool.h"
+#include "Transport.h"
+#include "Utils.h"
+
+using namespace Utils;
+
+// Sessions open now, up to --gtp-max-sessions.
+static std::atomic<unsigned int> s_open_sessions{0};
+
+static void run_session(const std::unique_ptr<Connection> connection,
+                        const int number) {
+    myprintf("GTP session %d opened.\n", number);
+    set_gtp_connection(connection.get());
+
+    auto pool = ThreadPool{};
+    pool.initialize(cfg_gtp_session_threads);
+    auto game = std::make_unique<GameState>();
+    game->init_game(BOARD_SIZE, KOMI);
+    auto session = GTP::Session{};
+    session.pool = &pool;
+    session.threads = cfg_gtp_session_threads;
+    session.max_visits = cfg_gtp_session_visits;
+    session.shared = true;
+
+    auto input = std::string{};
+    while (connection->receive(input)) {
+        log_input(input);
+        if (!GTP::execute(*game, session, input)) {
+            break;
+        }
+    }
+    // The search works on the pool and the game.
+    session.search.reset();
+
+    set_gtp_connection(nullptr);
+    myprintf("GTP session %d closed.\n", number);
+    s_open_sessions--;
+}
+
+void GTPServer::serve(const std::string& address) {
+    auto listener = Transport::listen(address, Framing::LINES);
+    if (!listener) {
+        return;
+    }
+    myprintf("GTP server listening on %s.\n", address.c_str());
+
+    // Sessions search at the same time.
+    GTP::s_network->set_shared(true);
+    auto sessions = 0;
+    for (;;) {
+        auto connection = listener->accept();
+        if (!connection) {
+            continue;
+        }
+        // Every session has its own threads and tree.
+        if (s_open_sessions >= cfg_gtp_max_sessions) {
+            myprintf("Turned away a GTP client, %u sessions are open.\n",
+                     cfg_gtp_max_sessions);
+            connection->send("? too many sessions\n\n");
+            continue;
+        }
+        s_open_sessions++;
+        std::thread(run_session, std::move(connection), ++sessions).detach();
+    }
+}
@@ -0,0 +1,47 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef GTPSERVER_H_INCLUDED
+#define GTPSERVER_H_INCLUDED
+
+#include "config.h"
+
+#include <string>
+
+// Serves GTP to several clients at once, one text line per command.
+// Every connection is a session with its own game, search and threads,
+// while all sessions evaluate with the one network, so that they share
+// its cache and the batching of its evaluations.  Clients beyond
+// --gtp-max-sessions get a GTP error and are disconnected.
+namespace GTPServer {
+    // Runs until the program is killed, returns if it can't listen.
+    void serve(const std::string& address);
+}
+
+#endif
@@ -41,11 +41,17 @@
 #include <string>
 #include <vector>
 
+#include "Affinity.h"
+#include "BatchAnalysis.h"
+#include "DistributedSearch.h"
 #include "GTP.h"
+#include "GTPServer.h"
 #include "GameState.h"
 #include "NNCache.h"
 #include "Network.h"
 #include "Random.h"
+#include "RemotePipe.h"
+#include "SelfPlay.h"
 #include "ThreadPool.h"
 #include "Utils.h"
 #include "Zobrist.h"
@@ -77,6 +83,17 @@ static void calculate_thread_count_cpu(
     } else {
         cfg_num_threads = cfg_max_threads;
     }
+
+    // Spread the cores that the search threads leave idle over the
+    // network evaluations only when asked to, as other engines may be
+    // using them.
+    if (vm["gemm-threads"].as<unsigned int>() > 0) {
+        cfg_gemm_threads = std::min(vm["gemm-threads"].as<unsigned int>(),
+                                    unsigned(cfg_max_threads));
+    } else {
+        cfg_gemm_threads =
+            std::max(size_t{1}, SMP::get_num_cpus() / cfg_num_threads);
+    }
 }
 
 // Decides on thread count if it's allowed to use on the gpu.
@@ -147,6 +164,11 @@ static void parse_commandline(const int argc, const char* const argv[]) {
         ("gtp,g", "Enable GTP mode.")
         ("threads,t", po::value<unsigned int>()->default_value(0),
                       "Number of threads to use. Select 0 to let leela-zero pick a reasonable default.")
+        ("gemm-threads", po::value<unsigned int>()->default_value(1),
+                         "Number of threads each CPU network evaluation is "
+                         "split over. Select 0 to use all the cores left "
+                         "over by the search threads, which oversubscribes "
+                         "a machine that runs several engines.")
         ("playouts,p", po::value<int>(),
                        "Weaken engine by limiting the number of playouts. "
                        "Requires --noponder.")
@@ -170,8 +192,33 @@ static void parse_commandline(const int argc, const char* const argv[]) {
                        "fast = Same as on but always plays faster.\n"
                        "no_pruning = For self play training use.\n")
         ("noponder", "Disable thinking on opponent's time.")
+        ("exact-cache", "Keep full precision network outputs in the cache "
+                        "instead of quantized ones. Holds about three times "
+                        "fewer positions.")
+        ("cache-eviction", po::value<std::string>()->default_value(cfg_cache_eviction),
+                           "[fifo|clock|tinylfu] Which network cache entries "
+                           "make room for new ones.")
+        ("shared-cache", "Keep the network cache in shared memory, so that "
+                         "all processes on this host running the same "
+                         "network share it.")
+        ("huge-pages", "Ask the OS to back the search tree with huge pages.")
+        ("affinity", "Pin search and network threads to cores. On NUMA "
+                     "machines, also keep the network weights and the "
+                     "search tree on the node that uses them.")
+        ("transpositions", "Search a graph: positions reached by different "
+                           "move orders share one node.")
+        ("cache-file", po::value<std::string>(),
+                       "Load the network cache from this file at startup "
+                       "and save it there on exit.")
         ("benchmark", "Test network and exit. Default args:\n-v3200 --noponder "
                       "-m0 -t1 -s1.")
+        ("analyze-file", po::value<std::string>(),
+                         "Analyze the positions listed in this file, one "
+                         "JSON line each on stdout, and exit. Requires "
+                         "--visits or --playouts.")
+        ("analyze-parallel", po::value<int>()->default_value(cfg_analyze_parallel),
+                             "Number of positions --analyze-file searches "
+                             "at once, each with --threads threads.")
 #ifndef USE_CPU_ONLY
         ("cpu-only", "Use CPU-only implementation and do not use OpenCL device(s).")
 #endif
@@ -192,6 +239,34 @@ static void parse_commandline(const int argc, const char* const argv[]) {
 #endif
         ;
 #endif
+    po::options_description dist_desc("Distributed search options");
+    dist_desc.add_options()
+        ("search-workers", po::value<std::vector<std::string>>()->multitoken(),
+                           "Addresses of search workers that search every "
+                           "root together with this process, as host:port "
+                           "or unix:path.")
+        ("serve-search", po::value<std::string>(),
+                         "Run as a search worker on this address instead "
+                         "of reading GTP commands.")
+        ("nn-server", po::value<std::string>(),
+                      "Run as an inference server on this address, "
+                      "like unix:path, evaluating the network for the "
+                      "engines started with --nn-client.")
+        ("nn-client", po::value<std::string>(),
+                      "Evaluate the network in the inference server on "
+                      "this address, on the same machine.")
+        ("gtp-listen", po::value<std::string>(),
+                       "Serve GTP on this address to several clients at "
+                       "once, instead of reading commands from stdin.")
+        ("gtp-session-threads", po::value<unsigned int>(),
+                                "Search threads of every GTP server "
+                                "session. Default: --threads.")
+        ("gtp-session-visits", po::value<int>(),
+                               "Most visits of any search of a GTP server "
+                               "session, whatever it sets itself.")
+        ("gtp-max-sessions", po::value<unsigned int>(),
+                             "Most GTP server sessions open at once, "
+                             "more clients are turned away. Default: 4.");
     po::options_description selfplay_desc("Self-play options");
     selfplay_desc.add_options()
         ("noise,n", "Enable policy network randomization.")
@@ -203,7 +278,18 @@ static void parse_commandline(const int argc, const char* const argv[]) {
         ("randomvisits", po::value<int>()->default_value(cfg_random_min_visits),
                          "Don't play random moves if they have <= x visits.")
         ("randomtemp", po::value<float>()->default_value(cfg_random_temp),
-                       "Temperature to use for random move selection.");
+                       "Temperature to use for random move selection.")
+        ("selfplay", po::value<int>(),
+                     "Play this many self-play games at once, each with "
+                     "--threads search threads, instead of reading GTP "
+                     "commands. Requires --visits or --playouts.")
+        ("selfplay-games", po::value<int>()->default_value(cfg_selfplay_games),
+                           "Stop after this many self-play games, "
+                           "0 for no end.")
+        ("selfplay-output", po::value<std::string>()
+                                ->default_value(cfg_selfplay_output),
+                            "Base name of the training data chunks and "
+                            "the SGF file of the self-play games.");
 #ifdef USE_TUNER
     po::options_description tuner_desc("Tuning options");
     tuner_desc.add_options()
@@ -231,6 +317,7 @@ static void parse_commandline(const int argc, const char* const argv[]) {
 #ifdef USE_OPENCL
         .add(gpu_desc)
 #endif
+        .add(dist_desc)
         .add(selfplay_desc)
 #ifdef USE_TUNER
         .add(tuner_desc);
@@ -377,6 +464,10 @@ static void parse_commandline(const int argc, const char* const argv[]) {
 #endif
     }
     myprintf("Using %d thread(s).\n", cfg_num_threads);
+    if (cfg_gemm_threads > 1) {
+        myprintf("Splitting CPU evaluations over %d thread(s).\n",
+                 cfg_gemm_threads);
+    }
 
     if (vm.count("seed")) {
         cfg_rng_seed = vm["seed"].as<std::uint64_t>();
@@ -391,6 +482,79 @@ static void parse_commandline(const int argc, const char* const argv[]) {
         cfg_allow_pondering = false;
     }
 
+    if (vm.count("exact-cache")) {
+        cfg_exact_cache = true;
+    }
+
+    if (vm.count("cache-eviction")) {
+        auto eviction = NNCache::Eviction{};
+        cfg_cache_eviction = vm["cache-eviction"].as<std::string>();
+        if (!NNCache::eviction_from_string(cfg_cache_eviction, eviction)) {
+            printf("Invalid cache-eviction value.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (vm.count("shared-cache")) {
+        cfg_shared_cache = true;
+    }
+
+    if (vm.count("huge-pages")) {
+        cfg_huge_pages = true;
+    }
+
+    if (vm.count("affinity")) {
+        cfg_affinity = true;
+    }
+
+    if (vm.count("search-workers")) {
+        cfg_search_workers =
+            vm["search-workers"].as<std::vector<std::string>>();
+    }
+
+    if (vm.count("serve-search")) {
+        cfg_serve_search = vm["serve-search"].as<std::string>();
+    }
+
+    if (vm.count("nn-server")) {
+        cfg_nn_server = vm["nn-server"].as<std::string>();
+    }
+
+    if (vm.count("nn-client")) {
+        cfg_nn_client = vm["nn-client"].as<std::string>();
+    }
+
+    if (vm.count("gtp-listen")) {
+        cfg_gtp_listen = vm["gtp-listen"].as<std::string>();
+        cfg_gtp_mode = true;
+    }
+
+    cfg_gtp_session_threads = cfg_num_threads;
+    if (vm.count("gtp-session-threads")) {
+        cfg_gtp_session_threads =
+            std::max(1u, vm["gtp-session-threads"].as<unsigned int>());
+    }
+
+    if (vm.count("gtp-session-visits")) {
+        cfg_gtp_session_visits = vm["gtp-session-visits"].as<int>();
+        if (cfg_gtp_session_visits == 0) {
+            cfg_gtp_session_visits = UCTSearch::UNLIMITED_PLAYOUTS;
+        }
+    }
+
+    if (vm.count("gtp-max-sessions")) {
+        cfg_gtp_max_sessions =
+            std::max(1u, vm["gtp-max-sessions"].as<unsigned int>());
+    }
+
+    if (vm.count("transpositions")) {
+        cfg_transpositions = true;
+    }
+
+    if (vm.count("cache-file")) {
+        cfg_cache_file = vm["cache-file"].as<std::string>();
+    }
+
     if (vm.count("noise")) {
         cfg_noise = true;
     }
@@ -423,6 +587,18 @@ static void parse_commandline(const int argc, const char* const argv[]) {
         }
     }
 
+    if (vm.count("selfplay")) {
+        cfg_selfplay = vm["selfplay"].as<int>();
+        cfg_selfplay_games = vm["selfplay-games"].as<int>();
+        cfg_selfplay_output = vm["selfplay-output"].as<std::string>();
+        cfg_allow_pondering = false;
+        if (!vm.count("playouts") && !vm.count("visits")) {
+            printf("Self-play needs a search limit, "
+                   "add --visits or --playouts.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
     if (vm.count("resignpct")) {
         cfg_resignpct = vm["resignpct"].as<int>();
     }
@@ -483,6 +659,19 @@ static void parse_commandline(const int argc, const char* const argv[]) {
         }
     }
 
+    if (vm.count("analyze-file")) {
+        cfg_analyze_file = vm["analyze-file"].as<std::string>();
+        cfg_analyze_parallel = std::max(1, vm["analyze-parallel"].as<int>());
+        cfg_allow_pondering = false;
+        // Give every position the whole search.
+        cfg_timemanage = TimeManagement::OFF;
+        if (!vm.count("playouts") && !vm.count("visits")) {
+            printf("Analysis needs a search limit, "
+                   "add --visits or --playouts.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
     // Do not lower the expected eval for root moves that are likely not
     // the best if we have introduced noise there exactly to explore more.
     cfg_fpu_root_reduction = cfg_noise ? 0.0f : cfg_fpu_reduction;
@@ -508,7 +697,14 @@ static void initialize_network() {
 
 // Setup global objects after command line has been parsed
 void init_global_objects() {
-    thread_pool.initialize(cfg_num_threads);
+    if (cfg_affinity) {
+        Affinity::initialize();
+        for (auto i = size_t{0}; i < cfg_num_threads; i++) {
+            thread_pool.add_thread([]() { Affinity::pin_thread(); });
+        }
+    } else {
+        thread_pool.initialize(cfg_num_threads);
+    }
 
     // Use deterministic random numbers for hashing
     auto rng = std::make_unique<Random>(5489);
@@ -549,13 +745,16 @@ int main(int argc, char* argv[]) {
     std::cerr.setf(std::ios::unitbuf);
     std::cin.setf(std::ios::unitbuf);
 
+    // GTP replies go out with one write each.  stderr is unbuffered
+    // already; myprintf writes it from the calling thread and only
+    // hands the log file copy to its background thread.
     setbuf(stdout, nullptr);
-    setbuf(stderr, nullptr);
 #ifndef _WIN32
     setbuf(stdin, nullptr);
 #endif
 
-    if (!cfg_gtp_mode && !cfg_benchmark) {
+    // Keep stdout clean for the JSON lines of --analyze-file.
+    if (!cfg_gtp_mode && !cfg_benchmark && cfg_analyze_file.empty()) {
         license_blurb();
     }
 
@@ -572,6 +771,34 @@ int main(int argc, char* argv[]) {
         return 0;
     }
 
+    if (!cfg_serve_search.empty()) {
+        DistributedSearch::serve(cfg_serve_search, *GTP::s_network);
+        return 1;
+    }
+
+    if (!cfg_analyze_file.empty()) {
+        return BatchAnalysis(*GTP::s_network)
+                       .run(cfg_analyze_file, cfg_analyze_parallel)
+                   ? EXIT_SUCCESS
+                   : EXIT_FAILURE;
+    }
+
+    if (cfg_selfplay > 0) {
+        SelfPlay(*GTP::s_network, cfg_selfplay_output)
+            .run(cfg_selfplay, cfg_selfplay_games);
+        return 0;
+    }
+
+    if (!cfg_nn_server.empty()) {
+        RemotePipe::serve(cfg_nn_server, *GTP::s_network);
+        return 1;
+    }
+
+    if (!cfg_gtp_listen.empty()) {
+        GTPServer::serve(cfg_gtp_listen);
+        return 1;
+    }
+
     for (;;) {
         // Program loop.
         if (!cfg_gtp_mode) {
@@ -586,14 +813,9 @@ int main(int argc, char* argv[]) {
         } else {
             // eof or other error
             std::cout << std::endl;
+            GTP::save_cache_file();
             break;
         }
-
-        // Force a flush of the logfile
-        if (cfg_logfile_handle) {
-            fclose(cfg_logfile_handle);
-            cfg_logfile_handle = fopen(cfg_logfile.c_str(), "a");
-        }
     }
 
     return 0;
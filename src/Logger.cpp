@@ -0,0 +1,194 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <cstdint>
+#include <utility>
+
+#include "Logger.h"
+
+Logger::Logger() : m_slots(std::make_unique<Slot[]>(SLOTS)) {
+    for (auto i = size_t{0}; i < SLOTS; i++) {
+        m_slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    m_running = true;
+    m_thread = std::thread([this]() { run(); });
+}
+
+Logger::~Logger() {
+    stop();
+}
+
+bool Logger::push(Entry&& entry) {
+    auto pos = m_tail.load(std::memory_order_relaxed);
+    for (;;) {
+        auto& slot = m_slots[pos % SLOTS];
+        const auto sequence = slot.sequence.load(std::memory_order_acquire);
+        const auto diff = std::intptr_t(sequence) - std::intptr_t(pos);
+        if (diff == 0) {
+            if (m_tail.compare_exchange_weak(pos, pos + 1,
+                                             std::memory_order_relaxed)) {
+                slot.entry = std::move(entry);
+                slot.sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            // The writer hasn't taken this slot yet, the ring is full.
+            return false;
+        } else {
+            pos = m_tail.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool Logger::pop(Entry& entry) {
+    auto& slot = m_slots[m_head % SLOTS];
+    if (slot.sequence.load(std::memory_order_acquire) != m_head + 1) {
+        return false;
+    }
+    entry = std::move(slot.entry);
+    slot.sequence.store(m_head + SLOTS, std::memory_order_release);
+    m_head++;
+    return true;
+}
+
+void Logger::write(std::string&& text, const bool console, FILE* const log) {
+    if (console) {
+        fwrite(text.data(), 1, text.size(), stderr);
+    }
+    if (!log) {
+        return;
+    }
+    auto entry = Entry{std::move(text), log};
+    while (!push(std::move(entry))) {
+        if (!m_running.load(std::memory_order_acquire)) {
+            // No writer makes room any more.
+            write_late_entries();
+            continue;
+        }
+        m_condvar.notify_one();
+        std::this_thread::yield();
+    }
+    // stop() may have taken the last entries before this one went in.
+    // Either it sees the entry or this sees it stopped.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!m_running.load(std::memory_order_relaxed)) {
+        write_late_entries();
+    }
+}
+
+void Logger::flush(const bool wait) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (!m_running) {
+        if (m_logfile) {
+            fflush(m_logfile);
+        }
+        return;
+    }
+    const auto request = ++m_flush_requests;
+    m_condvar.notify_one();
+    if (wait) {
+        m_flushed_condvar.wait(lock, [this, request]() {
+            return m_flushes >= request || !m_running;
+        });
+    }
+}
+
+void Logger::stop() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running) {
+            return;
+        }
+        m_stop = true;
+    }
+    m_condvar.notify_one();
+    m_thread.join();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_running = false;
+    }
+    m_flushed_condvar.notify_all();
+    // Text queued while the writer was finishing.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    write_late_entries();
+}
+
+// Once the writer is gone, the ring is emptied under the mutex, by
+// stop() and by the producers that raced with it.
+void Logger::write_late_entries() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    write_entries();
+    if (m_logfile) {
+        fflush(m_logfile);
+    }
+}
+
+// Writes all queued entries with one write.
+void Logger::write_entries() {
+    auto log = std::string{};
+    auto entry = Entry{};
+    while (pop(entry)) {
+        // Entries for another log file are written before it is used.
+        if (m_logfile && m_logfile != entry.log && !log.empty()) {
+            fwrite(log.data(), 1, log.size(), m_logfile);
+            log.clear();
+        }
+        m_logfile = entry.log;
+        log += entry.text;
+    }
+    if (!log.empty()) {
+        fwrite(log.data(), 1, log.size(), m_logfile);
+    }
+}
+
+void Logger::run() {
+    auto stopping = false;
+    while (!stopping) {
+        auto request = size_t{0};
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condvar.wait_for(lock, WRITE_INTERVAL, [this]() {
+                return m_stop || m_flush_requests != m_flushes;
+            });
+            stopping = m_stop;
+            request = m_flush_requests;
+        }
+        write_entries();
+        if (m_logfile && (request != m_flushes || stopping)) {
+            fflush(m_logfile);
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (request != m_flushes) {
+            m_flushes = request;
+            m_flushed_condvar.notify_all();
+        }
+    }
+}
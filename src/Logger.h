@@ -0,0 +1,103 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef LOGGER_H_INCLUDED
+#define LOGGER_H_INCLUDED
+
+#include "config.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Writes text for the log file on a background thread, so that the
+// threads producing it don't wait for the disk.  Text is queued in a
+// bounded lock-free ring, and the writer takes everything queued at
+// once, for a single write.  Text for stderr is written right away, so
+// that it shows up at once and isn't lost when the program aborts.
+class Logger {
+public:
+    Logger();
+    ~Logger();
+
+    // Writes the text to stderr if console is set, and queues it for
+    // the log file if log is not nullptr.
+    void write(std::string&& text, bool console, FILE* log);
+    // Has everything queued so far written and the log file flushed,
+    // waiting for it if wait is set.
+    void flush(bool wait = false);
+    // Writes what is left and ends the background thread.  Text is
+    // written right away from then on.
+    void stop();
+
+private:
+    static constexpr size_t SLOTS = 4096;
+    // Longest the writer sleeps while text is queued.
+    static constexpr auto WRITE_INTERVAL = std::chrono::milliseconds(20);
+
+    struct Entry {
+        std::string text;
+        FILE* log{nullptr};
+    };
+    // A slot is free for the producer of position p when its sequence
+    // is p, and holds an entry for the writer when it is p + 1.
+    struct Slot {
+        std::atomic<size_t> sequence;
+        Entry entry;
+    };
+
+    bool push(Entry&& entry);
+    bool pop(Entry& entry);
+    void write_entries();
+    // Writes the entries pushed after the writer ended.
+    void write_late_entries();
+    void run();
+
+    std::unique_ptr<Slot[]> m_slots;
+    std::atomic<size_t> m_tail{0};
+    // Only the writer moves the head.
+    size_t m_head{0};
+    std::atomic<bool> m_running{false};
+    FILE* m_logfile{nullptr};
+
+    std::mutex m_mutex;
+    std::condition_variable m_condvar;
+    std::condition_variable m_flushed_condvar;
+    size_t m_flush_requests{0};
+    size_t m_flushes{0};
+    bool m_stop{false};
+    std::thread m_thread;
+};
+
+#endif
@@ -29,11 +29,31 @@
 
 #include "config.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <functional>
 #include <memory>
+#include <new>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include "NNCache.h"
 
+#include "Affinity.h"
 #include "GTP.h"
 #include "UCTSearch.h"
 #include "Utils.h"
@@ -42,61 +62,650 @@ const int NNCache::MAX_CACHE_COUNT;
 const int NNCache::MIN_CACHE_COUNT;
 const size_t NNCache::ENTRY_SIZE;
 
-NNCache::NNCache(const int size) : m_size(size) {}
+// Compact policies are stored as round(LOG_SCALE * ln(p)) + 255, so
+// 255 is p = 1 and 1 is p ~= 1.3e-7.  0 stands for exactly zero.
+// Each step is a relative change of about 6%.
+static constexpr auto LOG_SCALE = 16.0f;
 
-// Looks up a cache entry based on a hash, each entry contains a NetResult.
-bool NNCache::lookup(const std::uint64_t hash, Netresult& result) {
-    std::lock_guard<std::mutex> lock(m_mutex);
-    ++m_lookups;
+static std::uint8_t quantize_policy(const float p) {
+    if (!(p > 0.0f)) {
+        return 0;
+    }
+    const auto q = std::lround(255.0f + LOG_SCALE * std::log(p));
+    // Keep tiny but non zero priors non zero.
+    return std::uint8_t(std::min(255L, std::max(1L, q)));
+}
+
+static float dequantize_policy(const std::uint8_t q) {
+    if (q == 0) {
+        return 0.0f;
+    }
+    return std::exp((q - 255.0f) / LOG_SCALE);
+}
+
+NNCache::NNCache(const size_t bytes)
+    : m_encoding(cfg_exact_cache ? Encoding::FULL : Encoding::COMPACT),
+      m_slot_words(slot_words()),
+      m_eviction(Eviction::FIFO) {
+    auto eviction = Eviction::FIFO;
+    eviction_from_string(cfg_cache_eviction, eviction);
+    m_eviction = eviction;
+    resize(bytes);
+}
+
+std::string NNCache::eviction_to_string(const Eviction eviction) {
+    switch (eviction) {
+        case Eviction::FIFO:
+            return "fifo";
+        case Eviction::CLOCK:
+            return "clock";
+        case Eviction::TINYLFU:
+            return "tinylfu";
+    }
+    return "unknown";
+}
+
+bool NNCache::eviction_from_string(const std::string& name,
+                                   Eviction& eviction) {
+    for (auto i = 0; i < EVICTION_POLICIES; i++) {
+        if (name == eviction_to_string(Eviction(i))) {
+            eviction = Eviction(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+void NNCache::set_eviction(const Eviction eviction) {
+    // The sketch has to be there before any thread sees TINYLFU.
+    if (eviction == Eviction::TINYLFU && m_sketch == nullptr) {
+        allocate_sketch();
+    }
+    m_eviction.store(eviction, std::memory_order_release);
+}
+
+void NNCache::allocate_sketch() {
+    // About four counters per slot.
+    auto words = size_t{64};
+    while (words * 4 < m_slots) {
+        words *= 2;
+    }
+    m_sketch = std::make_unique<std::atomic<std::uint64_t>[]>(words);
+    for (auto i = size_t{0}; i < words; i++) {
+        m_sketch[i].store(0, std::memory_order_relaxed);
+    }
+    m_sketch_mask = words - 1;
+    m_sketch_samples = 0;
+}
+
+// Counter i of the hash is nibble (h >> 60) of word (h >> 32) & mask,
+// with h a different odd multiple of the hash for every row.
+static constexpr std::array<std::uint64_t, 4> SKETCH_SEEDS = {
+    0x9E3779B97F4A7C15ULL, 0xC2B2AE3D27D4EB4FULL,
+    0x165667B19E3779F9ULL, 0xD6E8FEB86659FD93ULL};
+
+void NNCache::sketch_increment(const std::uint64_t hash) {
+    for (const auto seed : SKETCH_SEEDS) {
+        const auto h = hash * seed;
+        auto& word = m_sketch[(h >> 32) & m_sketch_mask];
+        const auto shift = (h >> 60) * 4;
+        // Lost updates between threads only make the count approximate.
+        const auto value = word.load(std::memory_order_relaxed);
+        if (((value >> shift) & 15) != 15) {
+            word.store(value + (std::uint64_t{1} << shift),
+                       std::memory_order_relaxed);
+        }
+    }
+
+    // Age the counts, so that positions popular a while ago fade out:
+    // every word is halved once per period, one word at a time.
+    const auto period = std::max(size_t{1024}, 10 * m_slots);
+    const auto stride = std::max(size_t{1}, period / (m_sketch_mask + 1));
+    const auto samples =
+        m_sketch_samples.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (samples % stride == 0) {
+        auto& aged = m_sketch[(samples / stride) & m_sketch_mask];
+        const auto value = aged.load(std::memory_order_relaxed);
+        aged.store((value >> 1) & 0x7777777777777777ULL,
+                   std::memory_order_relaxed);
+    }
+}
+
+int NNCache::sketch_estimate(const std::uint64_t hash) const {
+    auto estimate = 15;
+    for (const auto seed : SKETCH_SEEDS) {
+        const auto h = hash * seed;
+        const auto value =
+            m_sketch[(h >> 32) & m_sketch_mask].load(std::memory_order_relaxed);
+        estimate = std::min(estimate, int((value >> ((h >> 60) * 4)) & 15));
+    }
+    return estimate;
+}
 
-    auto iter = m_cache.find(hash);
-    if (iter == m_cache.end()) {
-        return false; // Not found.
+NNCache::~NNCache() {
+    detach_shared();
+}
+
+#ifndef _WIN32
+bool NNCache::attach_shared(const std::uint64_t network_hash,
+                            const size_t bytes) {
+    // One table per network and encoding.
+    char name[64];
+    std::snprintf(name, sizeof(name), "/leelaz-nncache-%016" PRIx64 "-%s",
+                  network_hash,
+                  m_encoding == Encoding::FULL ? "exact" : "compact");
+
+    auto slots = std::max(size_t{PROBE_SLOTS}, bytes / entry_size());
+    auto fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    const auto creator = fd >= 0;
+    if (!creator && errno == EEXIST) {
+        fd = shm_open(name, O_RDWR, 0600);
+    }
+    if (fd < 0) {
+        Utils::myprintf("Could not open shared NNCache %s.\n", name);
+        return false;
+    }
+
+    auto size = sizeof(SharedHeader) + slots * entry_size();
+    if (creator) {
+        if (ftruncate(fd, off_t(size)) != 0) {
+            Utils::myprintf("Could not size shared NNCache %s.\n", name);
+            close(fd);
+            shm_unlink(name);
+            return false;
+        }
+    } else {
+        // Wait for the creator to size the table, it then knows its size.
+        struct stat st {};
+        for (auto tries = 0; tries < 500; tries++) {
+            if (fstat(fd, &st) == 0
+                && size_t(st.st_size) > sizeof(SharedHeader)) {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        size = size_t(st.st_size);
+    }
+
+    const auto map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                          fd, 0);
+    close(fd);
+    if (map == MAP_FAILED || size <= sizeof(SharedHeader)) {
+        Utils::myprintf("Could not map shared NNCache %s.\n", name);
+        if (map != MAP_FAILED) {
+            munmap(map, size);
+        }
+        return false;
     }
+    const auto header = static_cast<SharedHeader*>(map);
 
-    // Since the entry is the second element in m_cache and it's the
-    // one that contains the NetResult.
-    const auto& entry = iter->second;
+    if (creator) {
+        // The mapping is zero filled, so all slots are empty already.
+        std::memcpy(header->magic, "LZNNSHM", sizeof(header->magic));
+        header->version = SHARED_VERSION;
+        header->slot_words = std::uint32_t(m_slot_words);
+        header->slots = slots;
+        header->network_hash = network_hash;
+        header->ready.store(1, std::memory_order_release);
+    } else {
+        for (auto tries = 0; tries < 500; tries++) {
+            if (header->ready.load(std::memory_order_acquire) != 0) {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        slots = header->slots;
+        if (header->ready.load(std::memory_order_acquire) == 0
+            || std::memcmp(header->magic, "LZNNSHM", sizeof(header->magic))
+            || header->version != SHARED_VERSION
+            || header->slot_words != m_slot_words
+            || header->network_hash != network_hash
+            || size < sizeof(SharedHeader) + slots * entry_size()) {
+            Utils::myprintf("Shared NNCache %s is not usable.\n", name);
+            munmap(map, size);
+            return false;
+        }
+    }
+
+    detach_shared();
+    m_storage.reset();
+    m_shared = header;
+    m_shared_size = size;
+    m_table = reinterpret_cast<std::atomic<std::uint32_t>*>(header + 1);
+    m_slots = slots;
+    m_generation = &header->generation;
+    m_entries = &header->entries;
+    if (get_eviction() == Eviction::TINYLFU) {
+        allocate_sketch();
+    }
 
-    // Found it.
-    ++m_hits;
-    // The result is returned.
-    result = entry->result;
-    // Lookup was successful.
+    Utils::myprintf("%s shared NNCache %s with %zu entries.\n",
+                    creator ? "Created" : "Attached to", name, slots);
     return true;
 }
 
+void NNCache::detach_shared() {
+    if (m_shared == nullptr) {
+        return;
+    }
+    munmap(m_shared, m_shared_size);
+    m_shared = nullptr;
+    m_table = nullptr;
+    m_slots = 0;
+    m_generation = &m_local_generation;
+    m_entries = &m_local_entries;
+}
+#else
+bool NNCache::attach_shared(const std::uint64_t, const size_t) {
+    Utils::myprintf("Shared NNCache is not supported on this platform.\n");
+    return false;
+}
+
+void NNCache::detach_shared() {}
+#endif
+
+void NNCache::FreeDeleter::operator()(void* const p) const {
+    std::free(p);
+}
+
+void NNCache::allocate(const size_t slots) {
+    constexpr auto CACHE_LINE = size_t{64};
+    const auto bytes = slots * entry_size() + CACHE_LINE;
+    m_storage.reset(std::calloc(bytes, 1));
+    if (m_storage == nullptr) {
+        throw std::bad_alloc();
+    }
+    // Every search thread probes all of the table, so no node is closer
+    // to it than the others.
+    Affinity::interleave(m_storage.get(), bytes);
+    auto aligned = reinterpret_cast<std::uintptr_t>(m_storage.get());
+    aligned = (aligned + CACHE_LINE - 1) & ~(CACHE_LINE - 1);
+    m_table = reinterpret_cast<std::atomic<std::uint32_t>*>(aligned);
+    m_slots = slots;
+    m_entries->store(0);
+}
+
+std::atomic<std::uint32_t>* NNCache::slot(const size_t index) const {
+    return m_table + index * m_slot_words;
+}
+
+// Maps the hash onto [0, m_slots) without a division.
+size_t NNCache::first_slot(const std::uint64_t hash) const {
+    return size_t((std::uint64_t{std::uint32_t(hash >> 32)} * m_slots) >> 32);
+}
+
+size_t NNCache::payload_words(const Encoding encoding) {
+    return encoding == Encoding::FULL ? FULL_PAYLOAD_WORDS
+                                      : COMPACT_PAYLOAD_WORDS;
+}
+
+size_t NNCache::slot_words() const {
+    return m_encoding == Encoding::FULL ? FULL_SLOT_WORDS : COMPACT_SLOT_WORDS;
+}
+
+std::uint64_t NNCache::read_key(const std::atomic<std::uint32_t>* const slot) {
+    return std::uint64_t{slot[KEY_WORD].load(std::memory_order_relaxed)} << 32
+           | slot[KEY_WORD + 1].load(std::memory_order_relaxed);
+}
+
+void NNCache::encode(const Encoding encoding, const Netresult& result,
+                     Payload& payload) {
+    if (encoding == Encoding::FULL) {
+        std::memcpy(payload.data(), result.policy.data(),
+                    sizeof(float) * NUM_INTERSECTIONS);
+        std::memcpy(&payload[NUM_INTERSECTIONS], &result.policy_pass,
+                    sizeof(float));
+        std::memcpy(&payload[NUM_INTERSECTIONS + 1], &result.winrate,
+                    sizeof(float));
+        return;
+    }
+
+    std::memcpy(&payload[0], &result.winrate, sizeof(float));
+    auto bytes = PolicyBytes{};
+    for (auto idx = size_t{0}; idx < NUM_INTERSECTIONS; idx++) {
+        bytes[idx] = quantize_policy(result.policy[idx]);
+    }
+    bytes[NUM_INTERSECTIONS] = quantize_policy(result.policy_pass);
+    std::memcpy(&payload[1], bytes.data(), bytes.size());
+}
+
+void NNCache::decode(const Encoding encoding, const Payload& payload,
+                     Netresult& result) {
+    if (encoding == Encoding::FULL) {
+        std::memcpy(result.policy.data(), payload.data(),
+                    sizeof(float) * NUM_INTERSECTIONS);
+        std::memcpy(&result.policy_pass, &payload[NUM_INTERSECTIONS],
+                    sizeof(float));
+        std::memcpy(&result.winrate, &payload[NUM_INTERSECTIONS + 1],
+                    sizeof(float));
+        return;
+    }
+
+    std::memcpy(&result.winrate, &payload[0], sizeof(float));
+    auto bytes = PolicyBytes{};
+    std::memcpy(bytes.data(), &payload[1], bytes.size());
+    for (auto idx = size_t{0}; idx < NUM_INTERSECTIONS; idx++) {
+        result.policy[idx] = dequantize_policy(bytes[idx]);
+    }
+    result.policy_pass = dequantize_policy(bytes[NUM_INTERSECTIONS]);
+}
+
+bool NNCache::read_slot(const std::atomic<std::uint32_t>* const entry,
+                        std::uint64_t& key, Payload& payload) const {
+    const auto seq = entry[SEQ_WORD].load(std::memory_order_acquire);
+    // Never written, or a writer is busy with it.
+    if (seq == 0 || (seq & 1) != 0) {
+        return false;
+    }
+    key = read_key(entry);
+    const auto words = payload_words(m_encoding);
+    for (auto w = size_t{0}; w < words; w++) {
+        payload[w] = entry[PAYLOAD_WORD + w].load(std::memory_order_relaxed);
+    }
+    // Only trust the copy if nobody rewrote the slot meanwhile.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return entry[SEQ_WORD].load(std::memory_order_relaxed) == seq;
+}
+
+// Looks up a cache entry based on a hash, each entry contains a NetResult.
+bool NNCache::lookup(const std::uint64_t hash, Netresult& result) {
+    const auto eviction = m_eviction.load(std::memory_order_acquire);
+    m_lookups.fetch_add(1, std::memory_order_relaxed);
+    m_policy_lookups[int(eviction)].fetch_add(1, std::memory_order_relaxed);
+    if (eviction == Eviction::TINYLFU) {
+        sketch_increment(hash);
+    }
+
+    const auto first = first_slot(hash);
+    for (auto i = size_t{0}; i < PROBE_SLOTS; i++) {
+        const auto entry = slot((first + i) % m_slots);
+        // Cheap check of the hash before copying the whole entry.
+        if (read_key(entry) != hash) {
+            continue;
+        }
+        auto key = std::uint64_t{};
+        auto payload = Payload{};
+        if (!read_slot(entry, key, payload) || key != hash) {
+            continue;
+        }
+        decode(m_encoding, payload, result);
+        if (eviction != Eviction::FIFO) {
+            // Avoid dirtying the cache line if the bit is already set.
+            const auto gen = entry[GEN_WORD].load(std::memory_order_relaxed);
+            if ((gen & REFERENCED) == 0) {
+                entry[GEN_WORD].fetch_or(REFERENCED,
+                                         std::memory_order_relaxed);
+            }
+        }
+        m_hits.fetch_add(1, std::memory_order_relaxed);
+        m_policy_hits[int(eviction)].fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
 // Adds a new element in the cache, associating the hash of the board
-// with the NetResult.
+// with the NetResult.  An empty slot is used if there is one, otherwise
+// the eviction policy picks one of the slots the hash may live in.
 void NNCache::insert(const std::uint64_t hash, const Netresult& result) {
-    std::lock_guard<std::mutex> lock(m_mutex);
+    const auto eviction = m_eviction.load(std::memory_order_acquire);
+    const auto generation =
+        m_generation->load(std::memory_order_relaxed) & GENERATION_MASK;
+    const auto first = first_slot(hash);
+
+    auto window = std::array<std::atomic<std::uint32_t>*, PROBE_SLOTS>{};
+    auto victim = static_cast<std::atomic<std::uint32_t>*>(nullptr);
+    auto victim_age = std::uint32_t{0};
+    auto victim_referenced = true;
+    auto empty = false;
+    for (auto i = size_t{0}; i < PROBE_SLOTS; i++) {
+        const auto entry = slot((first + i) % m_slots);
+        window[i] = entry;
+        const auto seq = entry[SEQ_WORD].load(std::memory_order_acquire);
+        if (seq == 0) {
+            victim = entry;
+            empty = true;
+            break;
+        }
+        if ((seq & 1) == 0 && read_key(entry) == hash) {
+            return; // Already in the cache.
+        }
+        const auto gen = entry[GEN_WORD].load(std::memory_order_relaxed);
+        const auto age = (generation - gen) & GENERATION_MASK;
+        // FIFO ignores the referenced bit, it is never set then.
+        const auto referenced = (gen & REFERENCED) != 0;
+        if (victim == nullptr || (victim_referenced && !referenced)
+            || (victim_referenced == referenced && age > victim_age)) {
+            victim = entry;
+            victim_age = age;
+            victim_referenced = referenced;
+        }
+    }
+
+    if (!empty && eviction != Eviction::FIFO) {
+        // Entries older than the victim used up their second chance.
+        for (const auto entry : window) {
+            const auto gen = entry[GEN_WORD].load(std::memory_order_relaxed);
+            const auto age = (generation - gen) & GENERATION_MASK;
+            if ((gen & REFERENCED) != 0 && age > victim_age) {
+                entry[GEN_WORD].fetch_and(GENERATION_MASK,
+                                          std::memory_order_relaxed);
+            }
+        }
+        if (eviction == Eviction::TINYLFU
+            && sketch_estimate(hash) < sketch_estimate(read_key(victim))) {
+            m_rejected.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+
+    auto payload = Payload{};
+    encode(m_encoding, result, payload);
+
+    // Take the slot, unless another thread is writing it.
+    auto seq = victim[SEQ_WORD].load(std::memory_order_relaxed);
+    if ((seq & 1) != 0
+        || !victim[SEQ_WORD].compare_exchange_strong(
+            seq, seq + 1, std::memory_order_acquire)) {
+        return;
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+
+    victim[GEN_WORD].store(generation, std::memory_order_relaxed);
+    victim[KEY_WORD].store(std::uint32_t(hash >> 32),
+                           std::memory_order_relaxed);
+    victim[KEY_WORD + 1].store(std::uint32_t(hash), std::memory_order_relaxed);
+    const auto words = payload_words(m_encoding);
+    for (auto w = size_t{0}; w < words; w++) {
+        victim[PAYLOAD_WORD + w].store(payload[w], std::memory_order_relaxed);
+    }
+    victim[SEQ_WORD].store(seq + 2, std::memory_order_release);
+
+    if (seq == 0) {
+        m_entries->fetch_add(1, std::memory_order_relaxed);
+    }
+    m_generation->fetch_add(1, std::memory_order_relaxed);
+    m_inserts.fetch_add(1, std::memory_order_relaxed);
+}
 
-    if (m_cache.find(hash) != m_cache.end()) {
-        return; // Already in the cache.
+std::vector<size_t> NNCache::slots_by_age() const {
+    const auto generation = m_generation->load(std::memory_order_relaxed);
+    auto order = std::vector<std::pair<std::uint32_t, size_t>>{};
+    for (auto i = size_t{0}; i < m_slots; i++) {
+        const auto entry = slot(i);
+        if (entry[SEQ_WORD].load(std::memory_order_relaxed) != 0) {
+            const auto gen = entry[GEN_WORD].load(std::memory_order_relaxed);
+            order.emplace_back((generation - gen) & GENERATION_MASK, i);
+        }
     }
+    std::sort(begin(order), end(order), std::greater<>());
 
-    m_cache.emplace(hash, std::make_unique<Entry>(result));
-    m_order.push_back(hash);
-    ++m_inserts;
+    auto slots = std::vector<size_t>{};
+    slots.reserve(order.size());
+    for (const auto& aged : order) {
+        slots.emplace_back(aged.second);
+    }
+    return slots;
+}
+
+void NNCache::resize(const size_t bytes) {
+    m_bytes = bytes;
+    if (is_shared()) {
+        return;
+    }
+    const auto slots = std::max(size_t{PROBE_SLOTS}, bytes / entry_size());
+    if (slots == m_slots) {
+        return;
+    }
+    if (m_storage == nullptr) {
+        allocate(slots);
+        if (get_eviction() == Eviction::TINYLFU) {
+            allocate_sketch();
+        }
+        return;
+    }
+
+    // Move the entries over, oldest first, so that the newest ones
+    // win if the table shrinks.
+    const auto order = slots_by_age();
+    const auto inserts = m_inserts.load();
+    auto old_storage = std::move(m_storage);
+    const auto old_table = m_table;
+    allocate(slots);
+    if (get_eviction() == Eviction::TINYLFU) {
+        allocate_sketch();
+    }
+
+    auto key = std::uint64_t{};
+    auto payload = Payload{};
+    auto result = Netresult{};
+    for (const auto index : order) {
+        if (read_slot(old_table + index * m_slot_words, key, payload)) {
+            decode(m_encoding, payload, result);
+            insert(key, result);
+        }
+    }
+    m_inserts = inserts;
+}
+
+bool NNCache::save(const std::string& filename,
+                   const std::uint64_t network_hash) {
+    auto out = std::ofstream{filename, std::ios::binary | std::ios::trunc};
+    if (!out) {
+        Utils::myprintf("Could not open cache file %s for writing.\n",
+                        filename.c_str());
+        return false;
+    }
+
+    const auto words = payload_words(m_encoding);
+    // Key plus payload, rounded up to keep the keys 8 byte aligned.
+    const auto record_words = (2 + words + 1) / 2 * 2;
+    const auto order = slots_by_age();
+
+    auto header = FileHeader{};
+    std::memcpy(header.magic, "LZNNCACH", sizeof(header.magic));
+    header.version = FILE_VERSION;
+    header.encoding = std::uint32_t(m_encoding);
+    header.intersections = NUM_INTERSECTIONS;
+    header.record_words = std::uint32_t(record_words);
+    header.network_hash = network_hash;
+    header.count = 0;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    auto key = std::uint64_t{};
+    auto payload = Payload{};
+    auto record = std::vector<std::uint32_t>(record_words);
+    for (const auto index : order) {
+        if (!read_slot(slot(index), key, payload)) {
+            continue;
+        }
+        std::memcpy(record.data(), &key, sizeof(key));
+        std::copy(begin(payload), begin(payload) + words, begin(record) + 2);
+        out.write(reinterpret_cast<const char*>(record.data()),
+                  record_words * sizeof(std::uint32_t));
+        header.count++;
+    }
 
-    // If the cache is too large, remove the oldest entry.
-    if (m_order.size() > m_size) {
-        m_cache.erase(m_order.front());
-        m_order.pop_front();
+    // Now that we know the number of records.
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.close();
+    if (!out) {
+        Utils::myprintf("Error writing cache file %s.\n", filename.c_str());
+        return false;
     }
+    return true;
 }
 
-void NNCache::resize(const int size) {
-    m_size = size;
-    while (m_order.size() > m_size) {
-        m_cache.erase(m_order.front());
-        m_order.pop_front();
+bool NNCache::load(const std::string& filename,
+                   const std::uint64_t network_hash) {
+    auto in = std::ifstream{filename, std::ios::binary};
+    if (!in) {
+        Utils::myprintf("Could not open cache file %s.\n", filename.c_str());
+        return false;
+    }
+
+    auto header = FileHeader{};
+    in.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!in || std::memcmp(header.magic, "LZNNCACH", sizeof(header.magic))
+        || header.version != FILE_VERSION
+        || header.intersections != NUM_INTERSECTIONS
+        || header.encoding > std::uint32_t(Encoding::COMPACT)) {
+        Utils::myprintf("%s is not a cache file for this program.\n",
+                        filename.c_str());
+        return false;
+    }
+    if (header.network_hash != network_hash) {
+        Utils::myprintf("Cache file %s was made with another network.\n",
+                        filename.c_str());
+        return false;
+    }
+
+    // The file may use the other encoding, which costs a conversion.
+    const auto encoding = Encoding(header.encoding);
+    const auto words = payload_words(encoding);
+    const auto record_words = size_t{header.record_words};
+    if (record_words < 2 + words) {
+        Utils::myprintf("Cache file %s is corrupt.\n", filename.c_str());
+        return false;
+    }
+
+    auto key = std::uint64_t{};
+    auto payload = Payload{};
+    auto result = Netresult{};
+    auto record = std::vector<std::uint32_t>(record_words);
+    for (auto i = std::uint64_t{0}; i < header.count; i++) {
+        in.read(reinterpret_cast<char*>(record.data()),
+                record_words * sizeof(std::uint32_t));
+        if (!in) {
+            Utils::myprintf("Cache file %s is truncated.\n", filename.c_str());
+            return false;
+        }
+        std::memcpy(&key, record.data(), sizeof(key));
+        std::copy(begin(record) + 2, begin(record) + 2 + words, begin(payload));
+        decode(encoding, payload, result);
+        insert(key, result);
     }
+    return true;
 }
 
 void NNCache::clear() {
-    m_cache.clear();
-    m_order.clear();
+    if (is_shared()) {
+        return;
+    }
+    allocate(m_slots);
+}
+
+void NNCache::set_encoding(const Encoding encoding) {
+    if (encoding == m_encoding || is_shared()) {
+        return;
+    }
+    m_encoding = encoding;
+    m_slot_words = slot_words();
+    m_storage.reset();
+    m_table = nullptr;
+    m_slots = 0;
+    resize(m_bytes);
 }
 
 // Estimates max cache size based on settings.
@@ -109,16 +718,45 @@ void NNCache::set_size_from_playouts(const int max_playouts) {
         std::min(max_playouts, UCTSearch::UNLIMITED_PLAYOUTS / num_cache_moves);
     auto max_size = num_cache_moves * max_playouts_per_move;
     max_size = std::min(MAX_CACHE_COUNT, std::max(MIN_CACHE_COUNT, max_size));
-    resize(max_size);
+    resize(max_size * entry_size());
 }
 
 void NNCache::dump_stats() {
-    Utils::myprintf(
-        "NNCache: %d/%d hits/lookups = %.1f%% hitrate, %d inserts, %u size\n",
-        m_hits, m_lookups, 100. * m_hits / (m_lookups + 1), m_inserts,
-        m_cache.size());
+    if (is_shared()) {
+        // Other processes use the table too, only its size is shared.
+        Utils::myprintf(
+            "NNCache (this process): %d/%d hits/lookups = %.1f%% hitrate, "
+            "%d inserts\n",
+            m_hits.load(), m_lookups.load(), 100. * m_hits / (m_lookups + 1),
+            m_inserts.load());
+        Utils::myprintf("NNCache (shared): %u/%zu size (%zu bytes/entry)\n",
+                        m_entries->load(), m_slots, entry_size());
+    } else {
+        Utils::myprintf(
+            "NNCache: %d/%d hits/lookups = %.1f%% hitrate, %d inserts, "
+            "%u/%zu size (%zu bytes/entry)\n",
+            m_hits.load(), m_lookups.load(), 100. * m_hits / (m_lookups + 1),
+            m_inserts.load(), m_entries->load(), m_slots, entry_size());
+    }
+    for (auto i = 0; i < EVICTION_POLICIES; i++) {
+        const auto lookups = m_policy_lookups[i].load();
+        if (lookups == 0) {
+            continue;
+        }
+        const auto hits = m_policy_hits[i].load();
+        Utils::myprintf("NNCache %s%s: %d/%d hits/lookups = %.1f%% hitrate",
+                        eviction_to_string(Eviction(i)).c_str(),
+                        Eviction(i) == get_eviction() ? " (active)" : "", hits,
+                        lookups, 100. * hits / lookups);
+        if (Eviction(i) == Eviction::TINYLFU) {
+            Utils::myprintf(", %d rejected", m_rejected.load());
+        }
+        Utils::myprintf("\n");
+    }
 }
 
 size_t NNCache::get_estimated_size() {
-    return m_order.size() * NNCache::ENTRY_SIZE;
+    const auto sketch_size =
+        m_sketch == nullptr ? 0 : (m_sketch_mask + 1) * sizeof(std::uint64_t);
+    return m_slots * entry_size() + sketch_size;
 }
@@ -33,11 +33,18 @@
 #include "config.h"
 
 #include <array>
-#include <deque>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <memory>
-#include <mutex>
-#include <unordered_map>
+#include <string>
+#include <vector>
 
+// Fixed-size open addressing table of network results.  Every slot is
+// guarded by its own sequence counter (a seqlock), so lookups never
+// block and never allocate: a reader that races with a writer just
+// treats the slot as a miss.  Writers that find a slot busy drop their
+// insert, which is harmless for a cache.
 class NNCache {
 public:
     // Maximum size of the cache in number of items.
@@ -61,25 +68,117 @@ public:
         }
     };
 
-    static constexpr size_t ENTRY_SIZE = sizeof(Netresult)
-                                         + sizeof(std::uint64_t)
-                                         + sizeof(std::unique_ptr<Netresult>);
+    enum class Encoding {
+        // All outputs as floats, bit exact.
+        FULL,
+        // Winrate as a float, policy log-quantized to 8 bits.
+        COMPACT
+    };
+
+    // Which entry makes room for a new one, among the slots a hash
+    // may live in.
+    enum class Eviction {
+        // The oldest one.
+        FIFO,
+        // The oldest one that was not hit since it was last passed
+        // over (second chance).
+        CLOCK,
+        // As CLOCK, but the new entry is only admitted if it was
+        // looked up at least as often as the one it would replace.
+        TINYLFU
+    };
+    static constexpr auto EVICTION_POLICIES = 3;
+    static std::string eviction_to_string(Eviction eviction);
+    static bool eviction_from_string(const std::string& name,
+                                     Eviction& eviction);
+
+private:
+    // Slot layout, in 32-bit words: sequence counter, insertion
+    // generation plus the referenced bit, hash (two words), then the
+    // encoded result.
+    static constexpr size_t SEQ_WORD = 0;
+    static constexpr size_t GEN_WORD = 1;
+    static constexpr size_t KEY_WORD = 2;
+    static constexpr size_t PAYLOAD_WORD = 4;
+    static constexpr size_t FULL_PAYLOAD_WORDS = NUM_INTERSECTIONS + 2;
+    static constexpr size_t COMPACT_PAYLOAD_WORDS =
+        1 + (NUM_INTERSECTIONS + 1 + 3) / 4;
+    // The quantized policy of a compact payload, after the winrate.
+    using PolicyBytes =
+        std::array<std::uint8_t,
+                   sizeof(std::uint32_t) * (COMPACT_PAYLOAD_WORDS - 1)>;
+
+    // Slots are a multiple of this many words, so that the header of
+    // a slot never straddles a cache line.
+    static constexpr size_t SLOT_ALIGN_WORDS = 8;
+    static constexpr size_t FULL_SLOT_WORDS =
+        (PAYLOAD_WORD + FULL_PAYLOAD_WORDS + SLOT_ALIGN_WORDS - 1)
+        / SLOT_ALIGN_WORDS * SLOT_ALIGN_WORDS;
+    static constexpr size_t COMPACT_SLOT_WORDS =
+        (PAYLOAD_WORD + COMPACT_PAYLOAD_WORDS + SLOT_ALIGN_WORDS - 1)
+        / SLOT_ALIGN_WORDS * SLOT_ALIGN_WORDS;
+
+    static constexpr std::uint32_t REFERENCED = 0x80000000;
+    static constexpr std::uint32_t GENERATION_MASK = 0x7FFFFFFF;
+
+    // Number of consecutive slots a hash may live in.
+    static constexpr size_t PROBE_SLOTS = 4;
 
-    NNCache(int size = MAX_CACHE_COUNT); // ~ 208MiB
+    using Payload = std::array<std::uint32_t, FULL_PAYLOAD_WORDS>;
+
+public:
+    // Bytes taken by one entry with full precision.
+    static constexpr size_t ENTRY_SIZE =
+        FULL_SLOT_WORDS * sizeof(std::uint32_t);
+
+    NNCache(size_t bytes = MIN_CACHE_COUNT * ENTRY_SIZE);
+    ~NNCache();
+
+    // Replace the private table with one in POSIX shared memory, which
+    // is created with the given size by the first process using this
+    // network and encoding, and attached by the others.  The shared
+    // table keeps its size: resize() and clear() no longer touch it.
+    bool attach_shared(std::uint64_t network_hash, size_t bytes);
+    bool is_shared() const {
+        return m_shared != nullptr;
+    }
 
     // Set a reasonable size gives max number of playouts
     void set_size_from_playouts(int max_playouts);
 
-    // Resize NNCache
-    void resize(int size);
+    // Resize NNCache to the given number of bytes, keeping as many
+    // entries as fit.  Not safe while other threads use the cache.
+    void resize(size_t bytes);
     void clear();
 
+    // Switch the entry encoding, which empties the cache.
+    void set_encoding(Encoding encoding);
+    Encoding get_encoding() const {
+        return m_encoding;
+    }
+    // Switch the eviction policy, entries are kept.  Safe while other
+    // threads use the cache.
+    void set_eviction(Eviction eviction);
+    Eviction get_eviction() const {
+        return m_eviction.load(std::memory_order_relaxed);
+    }
+
+    // Bytes taken by one entry with the current encoding.
+    size_t entry_size() const {
+        return m_slot_words * sizeof(std::uint32_t);
+    }
+
     // Try and find an existing entry.
     bool lookup(std::uint64_t hash, Netresult& result);
 
     // Insert a new entry.
     void insert(std::uint64_t hash, const Netresult& result);
 
+    // Write all entries to a file, or read them back.  The network
+    // hash makes sure results of another network are never loaded.
+    bool save(const std::string& filename, std::uint64_t network_hash);
+    bool load(const std::string& filename, std::uint64_t network_hash);
+
     // Return the hit rate ratio.
     std::pair<int, int> hit_rate() const {
         return {m_hits, m_lookups};
@@ -91,24 +190,100 @@ public:
     size_t get_estimated_size();
 
 private:
-    std::mutex m_mutex;
+    // Zero filled, so that untouched pages of a large table stay
+    // unallocated until used.
+    void allocate(size_t slots);
+
+    std::atomic<std::uint32_t>* slot(size_t index) const;
+    size_t first_slot(std::uint64_t hash) const;
+    size_t slot_words() const;
+    static std::uint64_t read_key(const std::atomic<std::uint32_t>* slot);
+
+    // Copy out a slot, false if it is empty or being written.
+    bool read_slot(const std::atomic<std::uint32_t>* entry,
+                   std::uint64_t& key, Payload& payload) const;
+    // Occupied slots, oldest entry first.
+    std::vector<size_t> slots_by_age() const;
+
+    // Count-min sketch of how often hashes are looked up, used by
+    // TINYLFU.  Sixteen 4-bit counters per word.
+    void allocate_sketch();
+    void sketch_increment(std::uint64_t hash);
+    int sketch_estimate(std::uint64_t hash) const;
 
-    size_t m_size;
+    static size_t payload_words(Encoding encoding);
+    static void encode(Encoding encoding, const Netresult& result,
+                       Payload& payload);
+    static void decode(Encoding encoding, const Payload& payload,
+                       Netresult& result);
 
-    // Statistics
-    int m_hits{0};
-    int m_lookups{0};
-    int m_inserts{0};
+    // Layout of a cache file: this header followed by records of the
+    // hash and the encoded result, in the native byte order.  All
+    // records have the same size and are 8 byte aligned, so the file
+    // can be mapped into memory as is.
+    struct FileHeader {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t encoding;
+        std::uint32_t intersections;
+        std::uint32_t record_words;
+        std::uint64_t network_hash;
+        std::uint64_t count;
+        std::uint64_t reserved[3];
+    };
+    static constexpr std::uint32_t FILE_VERSION = 2;
+
+    // Start of a shared memory table, the slots follow it.
+    struct alignas(64) SharedHeader {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t slot_words;
+        std::uint64_t slots;
+        std::uint64_t network_hash;
+        std::atomic<std::uint32_t> ready;
+        std::atomic<std::uint32_t> generation;
+        // Occupied slots.
+        std::atomic<std::uint32_t> entries;
+    };
+    static constexpr std::uint32_t SHARED_VERSION = 2;
+    void detach_shared();
 
-    struct Entry {
-        Entry(const Netresult& r) : result(r) {}
-        Netresult result; // ~ 1.4KiB
+    struct FreeDeleter {
+        void operator()(void* p) const;
     };
+    std::unique_ptr<void, FreeDeleter> m_storage;
+    std::atomic<std::uint32_t>* m_table{nullptr};
+    size_t m_slots{0};
+    size_t m_bytes{0};
+
+    SharedHeader* m_shared{nullptr};
+    size_t m_shared_size{0};
+
+    // Insertion counter, shared between processes with a shared table.
+    std::atomic<std::uint32_t> m_local_generation{0};
+    std::atomic<std::uint32_t>* m_generation{&m_local_generation};
+    // Occupied slots, likewise.
+    std::atomic<std::uint32_t> m_local_entries{0};
+    std::atomic<std::uint32_t>* m_entries{&m_local_entries};
+
+    Encoding m_encoding;
+    size_t m_slot_words;
+    // May change while other threads look up and insert.
+    std::atomic<Eviction> m_eviction;
+
+    std::unique_ptr<std::atomic<std::uint64_t>[]> m_sketch;
+    size_t m_sketch_mask{0};
+    // Increments since the sketch was allocated, which pace the aging.
+    std::atomic<size_t> m_sketch_samples{0};
 
-    // Map from hash to {features, result}
-    std::unordered_map<std::uint64_t, std::unique_ptr<const Entry>> m_cache;
-    // Order entries were added to the map.
-    std::deque<size_t> m_order;
+    // Statistics of this process, even with a shared table.
+    std::atomic<int> m_hits{0};
+    std::atomic<int> m_lookups{0};
+    std::atomic<int> m_inserts{0};
+    std::atomic<int> m_rejected{0};
+    // Hits and lookups while each eviction policy was in use.
+    std::array<std::atomic<int>, EVICTION_POLICIES> m_policy_hits{};
+    std::array<std::atomic<int>, EVICTION_POLICIES> m_policy_lookups{};
 };
 
 #endif
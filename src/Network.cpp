@@ -55,11 +55,14 @@
 #endif
 #include "CPUPipe.h"
 #include "Network.h"
+#include "NumaPipe.h"
+#include "RemotePipe.h"
 #include "zlib.h"
 #ifdef USE_OPENCL
 #include "OpenCLScheduler.h"
 #include "UCTNode.h"
 #endif
+#include "Affinity.h"
 #include "FastBoard.h"
 #include "FastState.h"
 #include "FullBoard.h"
@@ -67,6 +70,7 @@
 #include "GameState.h"
 #include "NNCache.h"
 #include "Random.h"
+#include "SMP.h"
 #include "ThreadPool.h"
 #include "Timing.h"
 #include "Utils.h"
@@ -77,10 +81,8 @@ using namespace Utils;
 #ifndef USE_BLAS
 // Eigen helpers
 template <typename T>
-using EigenVectorMap = Eigen::Map<Eigen::Matrix<T, Eigen::Dynamic, 1>>;
-template <typename T>
-using ConstEigenVectorMap =
-    Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, 1>>;
+using EigenMatrixMap =
+    Eigen::Map<Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>>;
 template <typename T>
 using ConstEigenMatrixMap =
     Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>>;
@@ -388,6 +390,9 @@ std::pair<int, int> Network::load_network_file(const std::string& filename) {
     auto buffer = std::stringstream{};
     constexpr auto chunkBufferSize = 64 * 1024;
     std::vector<char> chunkBuffer(chunkBufferSize);
+    // FNV-1a over the uncompressed weights, so that the same network
+    // is recognized whether it is gzipped or not.
+    m_network_hash = 0xcbf29ce484222325ULL;
     while (true) {
         auto bytesRead = gzread(gzhandle, chunkBuffer.data(), chunkBufferSize);
         if (bytesRead == 0) break;
@@ -397,6 +402,10 @@ std::pair<int, int> Network::load_network_file(const std::string& filename) {
             return {0, 0};
         }
         assert(bytesRead <= chunkBufferSize);
+        for (auto i = 0; i < bytesRead; i++) {
+            m_network_hash ^= std::uint8_t(chunkBuffer[i]);
+            m_network_hash *= 0x100000001b3ULL;
+        }
         buffer.write(chunkBuffer.data(), bytesRead);
     }
     gzclose(gzhandle);
@@ -426,6 +435,15 @@ std::pair<int, int> Network::load_network_file(const std::string& filename) {
     return {0, 0};
 }
 
+// A CPU pipe, replicated on every NUMA node if there are several.
+static std::unique_ptr<ForwardPipe> make_cpu_pipe() {
+    if (Affinity::get_num_nodes() > 1) {
+        return std::make_unique<NumaPipe>(
+            []() { return std::make_unique<CPUPipe>(); });
+    }
+    return std::make_unique<CPUPipe>();
+}
+
 // Preprocesses input data and initializes the network
 std::unique_ptr<ForwardPipe>&& Network::init_net(
     const int channels, std::unique_ptr<ForwardPipe>&& pipe) {
@@ -517,53 +535,22 @@ void Network::select_precision(const int channels) {
 }
 #endif
 
-void Network::initialize(const int playouts, const std::string& weightsfile) {
-#ifdef USE_BLAS
-#ifndef __APPLE__
-#ifdef USE_OPENBLAS
-    openblas_set_num_threads(1);
-    myprintf("BLAS Core: %s\n", openblas_get_corename());
-#endif
-#ifdef USE_MKL
-    // mkl_set_threading_layer(MKL_THREADING_SEQUENTIAL);
-    mkl_set_num_threads(1);
-    MKLVersion Version;
-    mkl_get_version(&Version);
-    myprintf("BLAS core: MKL %s\n", Version.Processor);
-#endif
-#endif
-#else
-    myprintf("BLAS Core: built-in Eigen %d.%d.%d library.\n",
-             EIGEN_WORLD_VERSION, EIGEN_MAJOR_VERSION, EIGEN_MINOR_VERSION);
-#endif
-
+// Reads the weights file and prepares the weights for the pipes.
+// Returns the number of channels, 0 if the file can't be used.
+size_t Network::load_weights(const std::string& weightsfile) {
     m_fwd_weights = std::make_shared<ForwardPipeWeights>();
 
-    // Make a guess at a good size as long as the user doesn't
-    // explicitly set a maximum memory usage.
-    m_nncache.set_size_from_playouts(playouts);
-
-    // Prepare symmetry table
-    for (auto s = 0; s < NUM_SYMMETRIES; ++s) {
-        for (auto v = 0; v < NUM_INTERSECTIONS; ++v) {
-            const auto newvtx =
-                get_symmetry({v % BOARD_SIZE, v / BOARD_SIZE}, s);
-            symmetry_nn_idx_table[s][v] =
-                (newvtx.second * BOARD_SIZE) + newvtx.first;
-            assert(symmetry_nn_idx_table[s][v] >= 0
-                   && symmetry_nn_idx_table[s][v] < NUM_INTERSECTIONS);
-        }
-    }
-
     // Load network from file
     size_t channels, residual_blocks;
     // Calls the load network function and returns the weights
     // into the channels and residual_blocks variables
     std::tie(channels, residual_blocks) = load_network_file(weightsfile);
     if (channels == 0) {
-        exit(EXIT_FAILURE);
+        return 0;
     }
 
+    m_fwd_weights->m_conv_weights_raw = m_fwd_weights->m_conv_weights;
+
     auto weight_index = size_t{0};
     // Input convolution
     // Winograd transform convolution weights
@@ -602,10 +589,75 @@ void Network::initialize(const int playouts, const std::string& weightsfile) {
         m_fwd_weights->m_conv_pol_b[i] = 0.0f;
     }
 
+    return channels;
+}
+
+std::shared_ptr<const ForwardPipe::ForwardPipeWeights>
+Network::load_tower_weights(const std::string& weightsfile,
+                            const std::uint64_t network_hash) {
+    // A network of its own, the heads of this one are in use.
+    auto network = std::make_unique<Network>();
+    if (network->load_weights(weightsfile) == 0) {
+        return nullptr;
+    }
+    if (network->m_network_hash != network_hash) {
+        myprintf("Weights file %s has changed.\n", weightsfile.c_str());
+        return nullptr;
+    }
+    return network->m_fwd_weights;
+}
+
+void Network::initialize(const int playouts, const std::string& weightsfile) {
+#ifdef USE_BLAS
+#ifndef __APPLE__
+#ifdef USE_OPENBLAS
+    openblas_set_num_threads(1);
+    myprintf("BLAS Core: %s\n", openblas_get_corename());
+#endif
+#ifdef USE_MKL
+    // mkl_set_threading_layer(MKL_THREADING_SEQUENTIAL);
+    mkl_set_num_threads(1);
+    MKLVersion Version;
+    mkl_get_version(&Version);
+    myprintf("BLAS core: MKL %s\n", Version.Processor);
+#endif
+#endif
+#else
+    myprintf("BLAS Core: built-in Eigen %d.%d.%d library.\n",
+             EIGEN_WORLD_VERSION, EIGEN_MAJOR_VERSION, EIGEN_MINOR_VERSION);
+#endif
+
+    // Make a guess at a good size as long as the user doesn't
+    // explicitly set a maximum memory usage.
+    m_nncache.set_size_from_playouts(playouts);
+
+    // Prepare symmetry table
+    for (auto s = 0; s < NUM_SYMMETRIES; ++s) {
+        for (auto v = 0; v < NUM_INTERSECTIONS; ++v) {
+            const auto newvtx =
+                get_symmetry({v % BOARD_SIZE, v / BOARD_SIZE}, s);
+            symmetry_nn_idx_table[s][v] =
+                (newvtx.second * BOARD_SIZE) + newvtx.first;
+            assert(symmetry_nn_idx_table[s][v] >= 0
+                   && symmetry_nn_idx_table[s][v] < NUM_INTERSECTIONS);
+        }
+    }
+
+    const auto channels = load_weights(weightsfile);
+    if (channels == 0) {
+        exit(EXIT_FAILURE);
+    }
+
 #ifdef USE_OPENCL
-    if (cfg_cpu_only) {
+    if (!cfg_nn_client.empty()) {
+        myprintf("Initializing remote evaluation.\n");
+        m_forward = init_net(
+            channels,
+            std::make_unique<RemotePipe>(cfg_nn_client, weightsfile,
+                                         m_network_hash));
+    } else if (cfg_cpu_only) {
         myprintf("Initializing CPU-only evaluation.\n");
-        m_forward = init_net(channels, std::make_unique<CPUPipe>());
+        m_forward = init_net(channels, make_cpu_pipe());
     } else {
 #ifdef USE_OPENCL_SELFCHECK
         // initialize CPU reference first, so that we can self-check
@@ -620,12 +672,23 @@ void Network::initialize(const int playouts, const std::string& weightsfile) {
         myprintf("Initializing OpenCL (single precision).\n");
         m_forward =
             init_net(channels, std::make_unique<OpenCLScheduler<float>>());
+#endif
+#ifdef USE_OPENCL_SELFCHECK
+        m_selfcheck_thread = std::thread([this]() { selfcheck_worker(); });
 #endif
     }
 
 #else // !USE_OPENCL
-    myprintf("Initializing CPU-only evaluation.\n");
-    m_forward = init_net(channels, std::make_unique<CPUPipe>());
+    if (!cfg_nn_client.empty()) {
+        myprintf("Initializing remote evaluation.\n");
+        m_forward = init_net(
+            channels,
+            std::make_unique<RemotePipe>(cfg_nn_client, weightsfile,
+                                         m_network_hash));
+    } else {
+        myprintf("Initializing CPU-only evaluation.\n");
+        m_forward = init_net(channels, make_cpu_pipe());
+    }
 #endif
 
     // Need to estimate size before clearing up the pipe.
@@ -634,34 +697,48 @@ void Network::initialize(const int playouts, const std::string& weightsfile) {
 }
 
 // Calculates the output of a fully connected layer with the option to apply ReLu
+// The input may hold batch_size vectors one after another, in which case
+// the output does too.
 template <unsigned int inputs, unsigned int outputs, bool ReLU, size_t W>
 std::vector<float> innerproduct(const std::vector<float>& input,
                                 const std::array<float, W>& weights,
-                                const std::array<float, outputs>& biases) {
+                                const std::array<float, outputs>& biases,
+                                const size_t batch_size = 1) {
     // Initializes the output vector with the size of outputs
-    std::vector<float> output(outputs);
+    std::vector<float> output(outputs * batch_size);
 
 #ifdef USE_BLAS
     // These two options calculate the output vector
-    cblas_sgemv(CblasRowMajor, CblasNoTrans,
-                // M     K
-                outputs, inputs,
-                1.0f, &weights[0], inputs,
-                &input[0], 1,
-                0.0f, &output[0], 1);
+    if (batch_size == 1) {
+        cblas_sgemv(CblasRowMajor, CblasNoTrans,
+                    // M     K
+                    outputs, inputs,
+                    1.0f, &weights[0], inputs,
+                    &input[0], 1,
+                    0.0f, &output[0], 1);
+    } else {
+        cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans,
+                    // M         N        K
+                    batch_size, outputs, inputs,
+                    1.0f, &input[0], inputs,
+                    &weights[0], inputs,
+                    0.0f, &output[0], outputs);
+    }
 #else
-    EigenVectorMap<float> y(output.data(), outputs);
+    EigenMatrixMap<float> y(output.data(), outputs, batch_size);
     y.noalias() =
         ConstEigenMatrixMap<float>(weights.data(), inputs, outputs).transpose()
-        * ConstEigenVectorMap<float>(input.data(), inputs);
+        * ConstEigenMatrixMap<float>(input.data(), inputs, batch_size);
 #endif
     // End portion that calculates the output vector
-    for (unsigned int o = 0; o < outputs; o++) {
-        auto val = biases[o] + output[o];
-        if (ReLU) {
-            val = std::max(0.0f, val);
+    for (auto b = size_t{0}; b < batch_size; b++) {
+        for (unsigned int o = 0; o < outputs; o++) {
+            auto val = biases[o] + output[b * outputs + o];
+            if (ReLU) {
+                val = std::max(0.0f, val);
+            }
+            output[b * outputs + o] = val;
         }
-        output[o] = val;
     }
 
     return output;
@@ -679,10 +756,13 @@ void batchnorm(const size_t channels,
                const float* const means,
                const float* const stddivs,
                const float* const eltwise = nullptr) {
-    for (auto c = size_t{0}; c < channels; ++c) {
+    // data may hold several positions, each with the given channels
+    const auto rows = data.size() / spatial_size;
+    for (auto row = size_t{0}; row < rows; ++row) {
+        const auto c = row % channels;
         const auto mean = means[c];
         const auto scale_stddiv = stddivs[c];
-        const auto arr = &data[c * spatial_size];
+        const auto arr = &data[row * spatial_size];
 
         if (eltwise == nullptr) {
             // Classical BN
@@ -691,7 +771,7 @@ void batchnorm(const size_t channels,
             }
         } else {
             // BN + residual add
-            const auto res = &eltwise[c * spatial_size];
+            const auto res = &eltwise[row * spatial_size];
             for (auto b = size_t{0}; b < spatial_size; b++) {
                 arr[b] =
                     std::max(0.0f, (scale_stddiv * (arr[b] - mean)) + res[b]);
@@ -700,6 +780,19 @@ void batchnorm(const size_t channels,
     }
 }
 
+Network::~Network() {
+#ifdef USE_OPENCL_SELFCHECK
+    {
+        std::lock_guard<std::mutex> lock(m_selfcheck_mutex);
+        m_selfcheck_exit = true;
+    }
+    m_selfcheck_cv.notify_all();
+    if (m_selfcheck_thread.joinable()) {
+        m_selfcheck_thread.join();
+    }
+#endif
+}
+
 #ifdef USE_OPENCL_SELFCHECK
 // Checks if OpenCL calculations are accurate
 void Network::compare_net_outputs(const Netresult& data, const Netresult& ref) {
@@ -726,6 +819,51 @@ void Network::compare_net_outputs(const Netresult& data, const Netresult& ref) {
         throw std::runtime_error("OpenCL self-check mismatch.");
     }
 }
+
+// Hands a self-check to the background worker.  If the worker is still
+// busy with earlier ones the check is dropped: they are random samples
+// anyway, and the queue should never grow on a slow CPU.
+void Network::queue_selfcheck(std::vector<float>&& input_data,
+                              const int symmetry, const Netresult& result) {
+    constexpr auto max_pending = size_t{2};
+    {
+        std::lock_guard<std::mutex> lock(m_selfcheck_mutex);
+        if (m_selfcheck_queue.size() >= max_pending) {
+            return;
+        }
+        m_selfcheck_queue.push_back({std::move(input_data), symmetry, result});
+    }
+    m_selfcheck_cv.notify_one();
+}
+
+void Network::selfcheck_worker() {
+    // The checks are samples, they can wait for otherwise idle cores.
+    SMP::lower_thread_priority();
+    for (;;) {
+        auto entry = SelfCheckEntry{};
+        {
+            std::unique_lock<std::mutex> lock(m_selfcheck_mutex);
+            m_selfcheck_cv.wait(lock, [this] {
+                return m_selfcheck_exit || !m_selfcheck_queue.empty();
+            });
+            if (m_selfcheck_exit) {
+                return;
+            }
+            entry = std::move(m_selfcheck_queue.front());
+            m_selfcheck_queue.pop_front();
+        }
+        try {
+            const auto result_ref =
+                get_output_internal(entry.input_data, entry.symmetry, true);
+            compare_net_outputs(entry.result, result_ref);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(m_selfcheck_mutex);
+            m_selfcheck_error = std::current_exception();
+            m_selfcheck_failed = true;
+            return;
+        }
+    }
+}
 #endif
 
 // Applies the softmax function to the input data, giving percentages
@@ -751,36 +889,42 @@ std::vector<float> softmax(const std::vector<float>& input,
     return output;
 }
 
-// Checks if the evalutaions for the current board state (or
-// symmetrical board states) is present in cache
+// Checks if the evaluation of the current board state, or of any
+// symmetrical board state, is present in cache.  Results are stored in
+// the canonical orientation of the position, so one probe is enough.
 bool Network::probe_cache(const GameState* const state,
                           Network::Netresult& result) {
-    if (m_nncache.lookup(state->board.get_hash(), result)) {
-        return true;
-    }
-    // If we are not generating a self-play game, try to find
-    // symmetries if we are in the early opening.
-    if (!cfg_noise && !cfg_random_cnt
-        && state->get_movenum()
-               < (state->get_timecontrol().opening_moves(BOARD_SIZE) / 2)) {
-        for (auto sym = 0; sym < Network::NUM_SYMMETRIES; ++sym) {
-            if (sym == Network::IDENTITY_SYMMETRY) {
-                continue;
-            }
-            const auto hash = state->get_symmetry_hash(sym);
-            if (m_nncache.lookup(hash, result)) {
-                decltype(result.policy) corrected_policy;
-                for (auto idx = size_t{0}; idx < NUM_INTERSECTIONS; ++idx) {
-                    const auto sym_idx = symmetry_nn_idx_table[sym][idx];
-                    corrected_policy[idx] = result.policy[sym_idx];
-                }
-                result.policy = std::move(corrected_policy);
-                return true;
-            }
+    const auto canonical = state->board.get_canonical_hash();
+    if (!m_nncache.lookup(canonical.first, result)) {
+        return false;
+    }
+    const auto sym = canonical.second;
+    if (sym != Network::IDENTITY_SYMMETRY) {
+        decltype(result.policy) corrected_policy;
+        for (auto idx = size_t{0}; idx < NUM_INTERSECTIONS; ++idx) {
+            const auto sym_idx = symmetry_nn_idx_table[sym][idx];
+            corrected_policy[idx] = result.policy[sym_idx];
         }
+        result.policy = std::move(corrected_policy);
     }
+    return true;
+}
 
-    return false;
+// Stores the evaluation in the canonical orientation of the position.
+void Network::insert_cache(const GameState* const state,
+                           const Network::Netresult& result) {
+    const auto canonical = state->board.get_canonical_hash();
+    const auto sym = canonical.second;
+    if (sym == Network::IDENTITY_SYMMETRY) {
+        m_nncache.insert(canonical.first, result);
+        return;
+    }
+    auto canonical_result = result;
+    for (auto idx = size_t{0}; idx < NUM_INTERSECTIONS; ++idx) {
+        const auto sym_idx = symmetry_nn_idx_table[sym][idx];
+        canonical_result.policy[sym_idx] = result.policy[idx];
+    }
+    m_nncache.insert(canonical.first, canonical_result);
 }
 
 // Produces the output of the network.  A Netresult is a data
@@ -794,6 +938,12 @@ Network::Netresult Network::get_output(
         return result;
     }
 
+#ifdef USE_OPENCL_SELFCHECK
+    if (m_selfcheck_failed) {
+        std::rethrow_exception(m_selfcheck_error);
+    }
+#endif
+
     if (read_cache) {
         // See if we already have this in the cache.
         if (probe_cache(state, result)) {
@@ -806,18 +956,7 @@ Network::Netresult Network::get_output(
         result = get_output_internal(state, symmetry);
     } else if (ensemble == AVERAGE) {
         assert(symmetry == -1);
-        for (auto sym = 0; sym < NUM_SYMMETRIES; ++sym) {
-            auto tmpresult = get_output_internal(state, sym);
-            result.winrate +=
-                tmpresult.winrate / static_cast<float>(NUM_SYMMETRIES);
-            result.policy_pass +=
-                tmpresult.policy_pass / static_cast<float>(NUM_SYMMETRIES);
-
-            for (auto idx = size_t{0}; idx < NUM_INTERSECTIONS; idx++) {
-                result.policy[idx] +=
-                    tmpresult.policy[idx] / static_cast<float>(NUM_SYMMETRIES);
-            }
-        }
+        result = get_output_average(state);
     } else {
         assert(ensemble == RANDOM_SYMMETRY);
         assert(symmetry == -1);
@@ -828,11 +967,17 @@ Network::Netresult Network::get_output(
         // running both with a probability of 1/2000.
         // selfcheck is done here because this is the only place NN
         // evaluation is done on actual gameplay.
-        if (m_forward_cpu != nullptr
-            && (force_selfcheck
-                || Random::get_Rng().randfix<SELFCHECK_PROBABILITY>() == 0)) {
-            auto result_ref = get_output_internal(state, rand_sym, true);
-            compare_net_outputs(result, result_ref);
+        // Forced checks (precision detection) need the answer right away,
+        // the sampled ones are done in the background.
+        if (m_forward_cpu != nullptr) {
+            if (force_selfcheck) {
+                auto result_ref = get_output_internal(state, rand_sym, true);
+                compare_net_outputs(result, result_ref);
+            } else if (Random::get_Rng().randfix<SELFCHECK_PROBABILITY>()
+                       == 0) {
+                queue_selfcheck(gather_features(state, rand_sym), rand_sym,
+                                result);
+            }
         }
 #else
         (void)force_selfcheck;
@@ -848,7 +993,7 @@ Network::Netresult Network::get_output(
 
     if (write_cache) {
         // Insert result into cache.
-        m_nncache.insert(state->board.get_hash(), result);
+        insert_cache(state, result);
     }
 
     return result;
@@ -862,10 +1007,18 @@ Network::Netresult Network::get_output_internal(const GameState* const state,
                                                 const int symmetry,
                                                 bool selfcheck) {
     assert(symmetry >= 0 && symmetry < NUM_SYMMETRIES);
+    const auto input_data = gather_features(state, symmetry);
+    return get_output_internal(input_data, symmetry, selfcheck);
+}
+
+// Evaluates input planes that were gathered with the given symmetry.
+Network::Netresult Network::get_output_internal(
+    const std::vector<float>& input_data, const int symmetry,
+    bool selfcheck) {
+    assert(symmetry >= 0 && symmetry < NUM_SYMMETRIES);
     constexpr auto width = BOARD_SIZE;
     constexpr auto height = BOARD_SIZE;
 
-    const auto input_data = gather_features(state, symmetry);
     std::vector<float> policy_data(OUTPUTS_POLICY * width * height);
     std::vector<float> value_data(OUTPUTS_VALUE * width * height);
 #ifdef USE_OPENCL_SELFCHECK
@@ -879,37 +1032,113 @@ Network::Netresult Network::get_output_internal(const GameState* const state,
     (void)selfcheck;
 #endif
 
+    std::vector<float> outputs;
+    std::vector<float> winrates;
+    evaluate_heads(policy_data, value_data, 1, outputs, winrates);
+
+    Netresult result;
+
+    for (auto idx = size_t{0}; idx < NUM_INTERSECTIONS; idx++) {
+        const auto sym_idx = symmetry_nn_idx_table[symmetry][idx];
+        result.policy[sym_idx] = outputs[idx];
+    }
+
+    result.policy_pass = outputs[NUM_INTERSECTIONS];
+    result.winrate = winrates[0];
+
+    return result;
+}
+
+void Network::forward_tower(const std::vector<float>& input,
+                            std::vector<float>& output_pol,
+                            std::vector<float>& output_val,
+                            const size_t batch_size) {
+    m_forward->forward_batch(input, output_pol, output_val, batch_size);
+}
+
+// Evaluates all symmetries of the position as a single batch, then
+// undoes each symmetry and averages the results.
+Network::Netresult Network::get_output_average(const GameState* const state) {
+    constexpr auto in_size = INPUT_CHANNELS * NUM_INTERSECTIONS;
+
+    auto input_data = std::vector<float>(NUM_SYMMETRIES * in_size);
+    for (auto sym = 0; sym < NUM_SYMMETRIES; ++sym) {
+        const auto features = gather_features(state, sym);
+        std::copy(begin(features), end(features),
+                  begin(input_data) + sym * in_size);
+    }
+    std::vector<float> policy_data(NUM_SYMMETRIES * OUTPUTS_POLICY
+                                   * NUM_INTERSECTIONS);
+    std::vector<float> value_data(NUM_SYMMETRIES * OUTPUTS_VALUE
+                                  * NUM_INTERSECTIONS);
+    m_forward->forward_batch(input_data, policy_data, value_data,
+                             NUM_SYMMETRIES);
+
+    std::vector<float> outputs;
+    std::vector<float> winrates;
+    evaluate_heads(policy_data, value_data, NUM_SYMMETRIES, outputs, winrates);
+
+    Netresult result;
+
+    for (auto sym = 0; sym < NUM_SYMMETRIES; ++sym) {
+        const auto sym_outputs = &outputs[sym * POTENTIAL_MOVES];
+        const auto& sym_table = symmetry_nn_idx_table[sym];
+        for (auto idx = size_t{0}; idx < NUM_INTERSECTIONS; idx++) {
+            result.policy[sym_table[idx]] += sym_outputs[idx];
+        }
+        result.policy_pass += sym_outputs[NUM_INTERSECTIONS];
+        result.winrate += winrates[sym];
+    }
+
+    constexpr auto scale = 1.0f / NUM_SYMMETRIES;
+    for (auto& policy : result.policy) {
+        policy *= scale;
+    }
+    result.policy_pass *= scale;
+    result.winrate *= scale;
+
+    return result;
+}
+
+// Runs the policy and value heads over the outputs of the forward pipe
+// for batch_size positions.  Gives the softmaxed policy of every
+// position, POTENTIAL_MOVES entries each, and their winrates.
+void Network::evaluate_heads(std::vector<float>& policy_data,
+                             std::vector<float>& value_data,
+                             const size_t batch_size,
+                             std::vector<float>& policy_out,
+                             std::vector<float>& winrate_out) {
     // Get the moves
     batchnorm<NUM_INTERSECTIONS>(OUTPUTS_POLICY, policy_data,
                                  m_bn_pol_w1.data(), m_bn_pol_w2.data());
-    const auto policy_out =
+    const auto policy_logits =
         innerproduct<OUTPUTS_POLICY * NUM_INTERSECTIONS, POTENTIAL_MOVES,
-                     false>(policy_data, m_ip_pol_w, m_ip_pol_b);
-    const auto outputs = softmax(policy_out, cfg_softmax_temp);
+                     false>(policy_data, m_ip_pol_w, m_ip_pol_b, batch_size);
+
+    policy_out.resize(batch_size * POTENTIAL_MOVES);
+    for (auto b = size_t{0}; b < batch_size; b++) {
+        const auto first = begin(policy_logits) + b * POTENTIAL_MOVES;
+        const auto outputs = softmax(
+            std::vector<float>(first, first + POTENTIAL_MOVES),
+            cfg_softmax_temp);
+        std::copy(begin(outputs), end(outputs),
+                  begin(policy_out) + b * POTENTIAL_MOVES);
+    }
 
     // Now get the value
     batchnorm<NUM_INTERSECTIONS>(OUTPUTS_VALUE, value_data, m_bn_val_w1.data(),
                                  m_bn_val_w2.data());
     const auto winrate_data =
         innerproduct<OUTPUTS_VALUE * NUM_INTERSECTIONS, VALUE_LAYER, true>(
-            value_data, m_ip1_val_w, m_ip1_val_b);
-    const auto winrate_out = innerproduct<VALUE_LAYER, 1, false>(
-        winrate_data, m_ip2_val_w, m_ip2_val_b);
+            value_data, m_ip1_val_w, m_ip1_val_b, batch_size);
+    const auto winrate_logits = innerproduct<VALUE_LAYER, 1, false>(
+        winrate_data, m_ip2_val_w, m_ip2_val_b, batch_size);
 
     // Map TanH output range [-1..1] to [0..1] range
-    const auto winrate = (1.0f + std::tanh(winrate_out[0])) / 2.0f;
-
-    Netresult result;
-
-    for (auto idx = size_t{0}; idx < NUM_INTERSECTIONS; idx++) {
-        const auto sym_idx = symmetry_nn_idx_table[symmetry][idx];
-        result.policy[sym_idx] = outputs[idx];
+    winrate_out.resize(batch_size);
+    for (auto b = size_t{0}; b < batch_size; b++) {
+        winrate_out[b] = (1.0f + std::tanh(winrate_logits[b])) / 2.0f;
     }
-
-    result.policy_pass = outputs[NUM_INTERSECTIONS];
-    result.winrate = winrate;
-
-    return result;
 }
 
 // Shows a visual representation of the neural network's policy output
@@ -1099,18 +1328,48 @@ size_t Network::get_estimated_cache_size() {
     return m_nncache.get_estimated_size();
 }
 
-void Network::nncache_resize(const int max_count) {
-    return m_nncache.resize(max_count);
+void Network::nncache_resize(const size_t bytes) {
+    return m_nncache.resize(bytes);
 }
 
 void Network::nncache_clear() {
     m_nncache.clear();
 }
 
+void Network::nncache_dump_stats() {
+    m_nncache.dump_stats();
+}
+
+void Network::nncache_set_eviction(const NNCache::Eviction eviction) {
+    m_nncache.set_eviction(eviction);
+}
+
+// The shared table gets the size the private one has now.
+bool Network::nncache_attach_shared() {
+    return m_nncache.attach_shared(m_network_hash,
+                                   m_nncache.get_estimated_size());
+}
+
+bool Network::nncache_save(const std::string& filename) {
+    return m_nncache.save(filename, m_network_hash);
+}
+
+bool Network::nncache_load(const std::string& filename) {
+    return m_nncache.load(filename, m_network_hash);
+}
+
 void Network::drain_evals() {
-    m_forward->drain();
+    if (!m_shared) {
+        m_forward->drain();
+    }
 }
 
 void Network::resume_evals() {
-    m_forward->resume();
+    if (!m_shared) {
+        m_forward->resume();
+    }
+}
+
+void Network::set_shared(const bool shared) {
+    m_shared = shared;
 }
@@ -51,6 +51,12 @@
 #include "OpenCLScheduler.h"
 #endif
 #ifdef USE_OPENCL_SELFCHECK
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+
 #include "SMP.h"
 #endif
 
@@ -78,7 +84,7 @@ public:
     using PolicyVertexPair = std::pair<float, int>;
     using Netresult = NNCache::Netresult;
 
-    virtual ~Network() = default;
+    virtual ~Network();
 
     Netresult get_output(const GameState* state, Ensemble ensemble,
                          int symmetry = -1, bool read_cache = true,
@@ -91,6 +97,12 @@ public:
     static constexpr auto VALUE_LAYER = 256;
 
     void initialize(int playouts, const std::string& weightsfile);
+    // Reads the residual tower weights from the file again, for a pipe
+    // that let go of them.  nullptr if the file can't be read or is no
+    // longer the network with the given hash.
+    static std::shared_ptr<const ForwardPipe::ForwardPipeWeights>
+    load_tower_weights(const std::string& weightsfile,
+                       std::uint64_t network_hash);
 
     float benchmark_time(int centiseconds);
     void benchmark(const GameState* state, int iterations = 1600);
@@ -105,8 +117,24 @@ public:
 
     size_t get_estimated_size();
     size_t get_estimated_cache_size();
-    void nncache_resize(int max_count);
+    void nncache_resize(size_t bytes);
     void nncache_clear();
+    void nncache_dump_stats();
+    void nncache_set_eviction(NNCache::Eviction eviction);
+    bool nncache_attach_shared();
+    bool nncache_save(const std::string& filename);
+    bool nncache_load(const std::string& filename);
+
+    // Runs only the residual tower of the local pipe on batch_size
+    // positions, for the inference server.
+    void forward_tower(const std::vector<float>& input,
+                       std::vector<float>& output_pol,
+                       std::vector<float>& output_val, size_t batch_size);
+
+    // Hash of the weights, identifies the network in cache files.
+    std::uint64_t get_network_hash() const {
+        return m_network_hash;
+    }
 
     // 'Drain' evaluations.  Threads with an evaluation will throw a
     // NetworkHaltException if possible, or will just proceed and drain ASAP.
@@ -116,12 +144,18 @@ public:
     // Flag the network to be open for business.
     virtual void resume_evals();
 
+    // Several searches evaluate at once, so that draining for one of
+    // them would halt the others.  Both calls above then do nothing.
+    void set_shared(bool shared);
+
+    static std::vector<float> winograd_transform_f(const std::vector<float>& f,
+                                                   int outputs, int channels);
+
 private:
     std::pair<int, int> load_v1_network(std::istream& wtfile);
     std::pair<int, int> load_network_file(const std::string& filename);
+    size_t load_weights(const std::string& weightsfile);
 
-    static std::vector<float> winograd_transform_f(const std::vector<float>& f,
-                                                   int outputs, int channels);
     static std::vector<float> zeropad_U(const std::vector<float>& U,
                                         int outputs, int channels,
                                         int outputs_pad, int channels_pad);
@@ -140,23 +174,52 @@ private:
                                std::vector<float>& M, int C, int K);
     Netresult get_output_internal(const GameState* state, int symmetry,
                                   bool selfcheck = false);
+    Netresult get_output_internal(const std::vector<float>& input_data,
+                                  int symmetry, bool selfcheck = false);
+    Netresult get_output_average(const GameState* state);
+    void evaluate_heads(std::vector<float>& policy_data,
+                        std::vector<float>& value_data, size_t batch_size,
+                        std::vector<float>& policy_out,
+                        std::vector<float>& winrate_out);
     static void fill_input_plane_pair(const FullBoard& board,
                                       std::vector<float>::iterator black,
                                       std::vector<float>::iterator white,
                                       int symmetry);
     bool probe_cache(const GameState* state, Network::Netresult& result);
+    void insert_cache(const GameState* state, const Netresult& result);
     std::unique_ptr<ForwardPipe>&& init_net(
         int channels, std::unique_ptr<ForwardPipe>&& pipe);
 #ifdef USE_HALF
     void select_precision(int channels);
 #endif
     std::unique_ptr<ForwardPipe> m_forward;
+    bool m_shared{false};
 #ifdef USE_OPENCL_SELFCHECK
     void compare_net_outputs(const Netresult& data, const Netresult& ref);
+    void queue_selfcheck(std::vector<float>&& input_data, int symmetry,
+                         const Netresult& result);
+    void selfcheck_worker();
     std::unique_ptr<ForwardPipe> m_forward_cpu;
+
+    // Randomly sampled self-checks run on a background thread, so that
+    // the slow CPU reference does not stall a search thread.  A failure
+    // is rethrown from the next get_output() call.
+    struct SelfCheckEntry {
+        std::vector<float> input_data;
+        int symmetry;
+        Netresult result;
+    };
+    std::thread m_selfcheck_thread;
+    std::mutex m_selfcheck_mutex;
+    std::condition_variable m_selfcheck_cv;
+    std::deque<SelfCheckEntry> m_selfcheck_queue;
+    bool m_selfcheck_exit{false};
+    std::atomic<bool> m_selfcheck_failed{false};
+    std::exception_ptr m_selfcheck_error;
 #endif
 
     NNCache m_nncache;
+    std::uint64_t m_network_hash{0};
 
     size_t estimated_size{0};
 
@@ -0,0 +1,137 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <algorithm>
+#include <cassert>
+#include <new>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#include "NodeArena.h"
+
+#include "GTP.h"
+
+std::atomic<size_t> NodeArena::s_total_size{0};
+std::atomic<std::uint64_t> NodeArena::s_next_id{1};
+
+// The chunk the thread allocates from.  It belongs to the arena with
+// the given id, ids are never reused so a stale chunk is never touched.
+struct LocalChunk {
+    std::uint64_t arena_id{0};
+    char* next{nullptr};
+    char* end{nullptr};
+};
+static thread_local LocalChunk tl_chunk;
+// The arena of the tree the thread is searching.
+static thread_local NodeArena* tl_active{nullptr};
+
+NodeArena::NodeArena() : m_id(s_next_id++) {}
+
+NodeArena::~NodeArena() {
+    if (tl_active == this) {
+        tl_active = nullptr;
+    }
+    for (const auto& block : m_blocks) {
+        ::operator delete(block.data, std::align_val_t{BLOCK_SIZE});
+        s_total_size -= block.size;
+    }
+}
+
+NodeArena& NodeArena::get_active() {
+    assert(tl_active != nullptr);
+    return *tl_active;
+}
+
+NodeArena* NodeArena::set_active(NodeArena* const arena) {
+    return std::exchange(tl_active, arena);
+}
+
+size_t NodeArena::get_total_size() {
+    return s_total_size.load(std::memory_order_relaxed);
+}
+
+char* NodeArena::allocate_block(const size_t size) {
+    const auto data = static_cast<char*>(
+        ::operator new(size, std::align_val_t{BLOCK_SIZE}));
+#ifdef __linux__
+    if (cfg_huge_pages) {
+        madvise(data, size, MADV_HUGEPAGE);
+    }
+#endif
+    Affinity::prefer_current_node(data, size);
+    m_blocks.push_back({data, size});
+    m_size += size;
+    s_total_size += size;
+    return data;
+}
+
+// Takes bytes out of the current block.  Called with m_mutex held.
+char* NodeArena::allocate_locked(const size_t bytes) {
+    if (bytes > BLOCK_SIZE / 4) {
+        // Big enough to get a block of its own.
+        const auto size = (bytes + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+        return allocate_block(size);
+    }
+    auto& cursor = m_cursors[Affinity::get_current_node()];
+    if (size_t(cursor.end - cursor.next) < bytes) {
+        cursor.next = allocate_block(BLOCK_SIZE);
+        cursor.end = cursor.next + BLOCK_SIZE;
+    }
+    const auto result = cursor.next;
+    cursor.next += bytes;
+    return result;
+}
+
+void* NodeArena::allocate(size_t bytes) {
+    bytes = (std::max(bytes, size_t{1}) + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+
+    auto& chunk = tl_chunk;
+    if (chunk.arena_id == m_id && size_t(chunk.end - chunk.next) >= bytes) {
+        const auto result = chunk.next;
+        chunk.next += bytes;
+        return result;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (bytes > CHUNK_SIZE / 4) {
+        return allocate_locked(bytes);
+    }
+    // Whatever is left of the old chunk is abandoned.
+    chunk.arena_id = m_id;
+    chunk.next = allocate_locked(CHUNK_SIZE);
+    chunk.end = chunk.next + CHUNK_SIZE;
+
+    const auto result = chunk.next;
+    chunk.next += bytes;
+    return result;
+}
@@ -0,0 +1,134 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef NODEARENA_H_INCLUDED
+#define NODEARENA_H_INCLUDED
+
+#include "config.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "Affinity.h"
+
+// Bump allocator for search tree nodes and child lists.  Every thread
+// carves private chunks out of large blocks, so an allocation takes no
+// lock and never calls into malloc.  Nothing is freed on its own: the
+// whole arena goes away at once, without running any destructors, when
+// the tree it holds is dropped.  Whatever lives in the arena must
+// therefore own no memory outside of it.  With --affinity, threads on
+// different NUMA nodes take their chunks from blocks on their own node.
+class NodeArena {
+public:
+    // Blocks are huge page sized and aligned.
+    static constexpr size_t BLOCK_SIZE = 2 * 1024 * 1024;
+    static constexpr size_t CHUNK_SIZE = 64 * 1024;
+    static constexpr size_t ALIGNMENT = 16;
+
+    NodeArena();
+    ~NodeArena();
+    NodeArena(const NodeArena&) = delete;
+    NodeArena& operator=(const NodeArena&) = delete;
+
+    void* allocate(size_t bytes);
+
+    template <class T, class... Args>
+    T* construct(Args&&... args) {
+        return new (allocate(sizeof(T))) T(std::forward<Args>(args)...);
+    }
+
+    // The arena new tree nodes are allocated from by the calling thread.
+    // Threads searching the same tree must all activate its arena.
+    static NodeArena& get_active();
+    // Gives the arena that was active before.
+    static NodeArena* set_active(NodeArena* arena);
+
+    // Memory taken by this arena.
+    size_t size() const {
+        return m_size.load(std::memory_order_relaxed);
+    }
+    // Memory taken by all arenas.
+    static size_t get_total_size();
+
+private:
+    struct Block {
+        char* data;
+        size_t size;
+    };
+    // Free space left in the current block of a node.
+    struct Cursor {
+        char* next{nullptr};
+        char* end{nullptr};
+    };
+    char* allocate_block(size_t size);
+    char* allocate_locked(size_t bytes);
+
+    const std::uint64_t m_id;
+    std::mutex m_mutex;
+    std::vector<Block> m_blocks;
+    std::array<Cursor, Affinity::MAX_NODES> m_cursors;
+    std::atomic<size_t> m_size{0};
+
+    static std::atomic<size_t> s_total_size;
+    static std::atomic<std::uint64_t> s_next_id;
+};
+
+// Allocator for standard containers inside the tree.  Memory comes from
+// the active arena, and is only given back with the whole arena.
+template <class T>
+class ArenaAllocator {
+public:
+    using value_type = T;
+
+    ArenaAllocator() = default;
+    template <class U>
+    ArenaAllocator(const ArenaAllocator<U>&) {}
+
+    T* allocate(const size_t n) {
+        return static_cast<T*>(NodeArena::get_active().allocate(n * sizeof(T)));
+    }
+    void deallocate(T*, size_t) {}
+
+    template <class U>
+    bool operator==(const ArenaAllocator<U>&) const {
+        return true;
+    }
+    template <class U>
+    bool operator!=(const ArenaAllocator<U>&) const {
+        return false;
+    }
+};
+
+#endif
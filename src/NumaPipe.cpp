@@ -0,0 +1,93 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include "NumaPipe.h"
+
+#include "Affinity.h"
+
+NumaPipe::NumaPipe(const PipeFactory& factory) {
+    m_pipes.resize(Affinity::get_num_nodes());
+    for (auto node = size_t{0}; node < m_pipes.size(); node++) {
+        Affinity::run_on_node(node, [&]() { m_pipes[node] = factory(); });
+    }
+}
+
+void NumaPipe::initialize(const int channels) {
+    for (auto node = size_t{0}; node < m_pipes.size(); node++) {
+        Affinity::run_on_node(
+            node, [&]() { m_pipes[node]->initialize(channels); });
+    }
+}
+
+bool NumaPipe::needs_autodetect() {
+    return m_pipes.front()->needs_autodetect();
+}
+
+ForwardPipe& NumaPipe::local_pipe() {
+    return *m_pipes[Affinity::get_current_node() % m_pipes.size()];
+}
+
+void NumaPipe::forward(const std::vector<float>& input,
+                       std::vector<float>& output_pol,
+                       std::vector<float>& output_val) {
+    local_pipe().forward(input, output_pol, output_val);
+}
+
+void NumaPipe::forward_batch(const std::vector<float>& input,
+                             std::vector<float>& output_pol,
+                             std::vector<float>& output_val,
+                             const size_t batch_size) {
+    local_pipe().forward_batch(input, output_pol, output_val, batch_size);
+}
+
+void NumaPipe::push_weights(
+    const unsigned int filter_size, const unsigned int channels,
+    const unsigned int outputs,
+    std::shared_ptr<const ForwardPipeWeights> weights) {
+    for (auto node = size_t{0}; node < m_pipes.size(); node++) {
+        Affinity::run_on_node(node, [&]() {
+            m_pipes[node]->push_weights(filter_size, channels, outputs,
+                                        weights);
+        });
+    }
+}
+
+void NumaPipe::drain() {
+    for (auto& pipe : m_pipes) {
+        pipe->drain();
+    }
+}
+
+void NumaPipe::resume() {
+    for (auto& pipe : m_pipes) {
+        pipe->resume();
+    }
+}
@@ -0,0 +1,72 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef NUMAPIPE_H_INCLUDED
+#define NUMAPIPE_H_INCLUDED
+
+#include "config.h"
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "ForwardPipe.h"
+
+// One pipe per NUMA node, each set up from a thread on its node so that
+// its copy of the weights lives there.  Threads evaluate with the pipe
+// of the node they are pinned to.
+class NumaPipe : public ForwardPipe {
+public:
+    using PipeFactory = std::function<std::unique_ptr<ForwardPipe>()>;
+
+    explicit NumaPipe(const PipeFactory& factory);
+
+    virtual void initialize(int channels);
+    virtual bool needs_autodetect();
+    virtual void forward(const std::vector<float>& input,
+                         std::vector<float>& output_pol,
+                         std::vector<float>& output_val);
+    virtual void forward_batch(const std::vector<float>& input,
+                               std::vector<float>& output_pol,
+                               std::vector<float>& output_val,
+                               size_t batch_size);
+    virtual void push_weights(
+        unsigned int filter_size, unsigned int channels, unsigned int outputs,
+        std::shared_ptr<const ForwardPipeWeights> weights);
+    virtual void drain();
+    virtual void resume();
+
+private:
+    ForwardPipe& local_pipe();
+
+    std::vector<std::unique_ptr<ForwardPipe>> m_pipes;
+};
+
+#endif
@@ -30,6 +30,7 @@
 
 #ifdef USE_OPENCL
 
+#include "Affinity.h"
 #include "GTP.h"
 #include "Network.h"
 #include "OpenCLScheduler.h"
@@ -294,13 +295,60 @@ void OpenCLScheduler<net_t>::forward(const std::vector<float>& input,
     // Notifies one of the worker threads that there is a forward pass
     // request to work on.
     m_cv.notify_one();
-    entry->cv.wait(lk);
+    entry->cv.wait(lk, [&entry]() { return entry->done; });
 
     if (m_draining) {
         throw NetworkHaltException();
     }
 }
 
+// Queues all positions of the batch at once, so that the batch workers
+// can pick them up together and run them in a single kernel launch.
+template <typename net_t>
+void OpenCLScheduler<net_t>::forward_batch(const std::vector<float>& input,
+                                           std::vector<float>& output_pol,
+                                           std::vector<float>& output_val,
+                                           const size_t batch_size) {
+    const auto in_size = input.size() / batch_size;
+    const auto out_pol_size = output_pol.size() / batch_size;
+    const auto out_val_size = output_val.size() / batch_size;
+
+    auto inputs = std::vector<std::vector<float>>(batch_size);
+    auto outputs_pol = std::vector<std::vector<float>>(
+        batch_size, std::vector<float>(out_pol_size));
+    auto outputs_val = std::vector<std::vector<float>>(
+        batch_size, std::vector<float>(out_val_size));
+    auto entries = std::vector<std::shared_ptr<ForwardQueueEntry>>();
+    for (auto b = size_t{0}; b < batch_size; b++) {
+        inputs[b].assign(begin(input) + b * in_size,
+                         begin(input) + (b + 1) * in_size);
+        entries.emplace_back(std::make_shared<ForwardQueueEntry>(
+            inputs[b], outputs_pol[b], outputs_val[b]));
+    }
+    {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        std::copy(begin(entries), end(entries),
+                  std::back_inserter(m_forward_queue));
+    }
+    m_cv.notify_all();
+
+    for (auto& entry : entries) {
+        std::unique_lock<std::mutex> lk(entry->mutex);
+        entry->cv.wait(lk, [&entry]() { return entry->done; });
+    }
+
+    if (m_draining) {
+        throw NetworkHaltException();
+    }
+
+    for (auto b = size_t{0}; b < batch_size; b++) {
+        std::copy(begin(outputs_pol[b]), end(outputs_pol[b]),
+                  begin(output_pol) + b * out_pol_size);
+        std::copy(begin(outputs_val[b]), end(outputs_val[b]),
+                  begin(output_val) + b * out_val_size);
+    }
+}
+
 #ifndef NDEBUG
 struct batch_stats_t batch_stats;
 #endif
@@ -314,6 +362,9 @@ void OpenCLScheduler<net_t>::batch_worker(const size_t gnum) {
     constexpr auto out_val_size =
         Network::OUTPUTS_VALUE * BOARD_SIZE * BOARD_SIZE;
 
+    if (cfg_affinity) {
+        Affinity::pin_thread();
+    }
     OpenCLContext context;
 
     // batch scheduling heuristic.
@@ -426,6 +477,10 @@ void OpenCLScheduler<net_t>::batch_worker(const size_t gnum) {
             std::copy(begin(batch_output_val) + out_val_size * index,
                       begin(batch_output_val) + out_val_size * (index + 1),
                       begin(x->out_v));
+            {
+                std::unique_lock<std::mutex> lk(x->mutex);
+                x->done = true;
+            }
             x->cv.notify_all();
             index++;
         }
@@ -453,8 +508,9 @@ void OpenCLScheduler<net_t>::drain() {
 
     for (auto& x : fq) {
         {
-            // dummy lock/unlock to make sure thread in forward() is sleeping
+            // lock to make sure thread in forward() is sleeping
             std::unique_lock<std::mutex> lk(x->mutex);
+            x->done = true;
         }
         x->cv.notify_all();
     }
@@ -57,6 +57,8 @@ class OpenCLScheduler : public ForwardPipe {
         const std::vector<float>& in;
         std::vector<float>& out_p;
         std::vector<float>& out_v;
+        // Set under mutex once the outputs are filled in or drained
+        bool done{false};
         ForwardQueueEntry(const std::vector<float>& input,
                           std::vector<float>& output_pol,
                           std::vector<float>& output_val)
@@ -71,6 +73,10 @@ public:
     virtual void forward(const std::vector<float>& input,
                          std::vector<float>& output_pol,
                          std::vector<float>& output_val);
+    virtual void forward_batch(const std::vector<float>& input,
+                               std::vector<float>& output_pol,
+                               std::vector<float>& output_val,
+                               size_t batch_size);
     virtual bool needs_autodetect();
     virtual void push_weights(
         unsigned int filter_size, unsigned int channels, unsigned int outputs,
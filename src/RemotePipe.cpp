@@ -0,0 +1,581 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iterator>
+#include <sstream>
+#include <utility>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "RemotePipe.h"
+
+#include "CPUPipe.h"
+#include "Network.h"
+#include "Utils.h"
+
+using namespace Utils;
+
+// Messages are lines of text:
+//   hello <network hash> <channels> <shared memory name>
+//   ok, or error <reason>
+//   eval <slot>...
+//   done <slot>...
+// A slot holds the input planes of one position, then its policy and
+// value outputs.
+
+constexpr auto INPUT_SIZE =
+    size_t{Network::INPUT_CHANNELS} * NUM_INTERSECTIONS;
+constexpr auto OUTPUT_POL_SIZE =
+    size_t{Network::OUTPUTS_POLICY} * NUM_INTERSECTIONS;
+constexpr auto OUTPUT_VAL_SIZE =
+    size_t{Network::OUTPUTS_VALUE} * NUM_INTERSECTIONS;
+constexpr auto SLOT_SIZE = INPUT_SIZE + OUTPUT_POL_SIZE + OUTPUT_VAL_SIZE;
+
+struct SlotsHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t slots;
+    std::uint32_t input_size;
+    std::uint32_t output_pol_size;
+    std::uint32_t output_val_size;
+    std::uint32_t padding;
+};
+
+constexpr auto SLOTS_VERSION = std::uint32_t{1};
+
+static float* slot_data(void* const map, const size_t slot) {
+    return reinterpret_cast<float*>(static_cast<SlotsHeader*>(map) + 1)
+           + slot * SLOT_SIZE;
+}
+
+RemotePipe::RemotePipe(const std::string& address,
+                       const std::string& weightsfile,
+                       const std::uint64_t network_hash)
+    : m_address(address),
+      m_weightsfile(weightsfile),
+      m_network_hash(network_hash) {}
+
+RemotePipe::~RemotePipe() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_connected = false;
+    }
+    if (m_connection) {
+        m_connection->close();
+    }
+    if (m_reader.joinable()) {
+        m_reader.join();
+    }
+    unmap_slots();
+}
+
+void RemotePipe::initialize(const int channels) {
+    m_channels = channels;
+    static auto s_pipes = std::atomic<int>{0};
+    char name[64];
+#ifndef _WIN32
+    std::snprintf(name, sizeof(name), "/leelaz-nnpipe-%ld-%d", long(getpid()),
+                  s_pipes++);
+#else
+    std::snprintf(name, sizeof(name), "/leelaz-nnpipe-%d", s_pipes++);
+#endif
+    if (!map_slots(name)) {
+        exit(EXIT_FAILURE);
+    }
+
+    m_connection = Transport::connect(m_address);
+    auto reply = std::string{};
+    if (m_connection) {
+        auto hello = std::stringstream{};
+        hello << "hello " << std::hex << m_network_hash << std::dec << ' '
+              << channels << ' ' << name;
+        if (!m_connection->send(hello.str())
+            || !m_connection->receive(reply)) {
+            reply = "error connection closed";
+        }
+    }
+#ifndef _WIN32
+    // The server has mapped the slots by now, or never will.
+    shm_unlink(name);
+#endif
+    if (!m_connection) {
+        exit(EXIT_FAILURE);
+    }
+    if (reply != "ok") {
+        myprintf("Inference server %s refused us: %s\n", m_address.c_str(),
+                 reply.c_str());
+        exit(EXIT_FAILURE);
+    }
+
+    myprintf("Connected to inference server %s.\n", m_address.c_str());
+    m_connected = true;
+    m_reader = std::thread([this]() { read_replies(); });
+}
+
+#ifndef _WIN32
+bool RemotePipe::map_slots(const std::string& name) {
+    const auto fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        myprintf("Could not create shared memory %s.\n", name.c_str());
+        return false;
+    }
+    const auto size = sizeof(SlotsHeader) + SLOTS * SLOT_SIZE * sizeof(float);
+    auto map = MAP_FAILED;
+    if (ftruncate(fd, off_t(size)) == 0) {
+        map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        myprintf("Could not map shared memory %s.\n", name.c_str());
+        shm_unlink(name.c_str());
+        return false;
+    }
+
+    const auto header = static_cast<SlotsHeader*>(map);
+    std::memcpy(header->magic, "LZNNPIP", sizeof(header->magic));
+    header->version = SLOTS_VERSION;
+    header->slots = SLOTS;
+    header->input_size = INPUT_SIZE;
+    header->output_pol_size = OUTPUT_POL_SIZE;
+    header->output_val_size = OUTPUT_VAL_SIZE;
+
+    m_map = map;
+    m_map_size = size;
+    for (auto i = size_t{0}; i < SLOTS; i++) {
+        const auto data = slot_data(map, i);
+        m_slots.emplace_back(Slot{data, data + INPUT_SIZE,
+                                  data + INPUT_SIZE + OUTPUT_POL_SIZE, false,
+                                  false});
+    }
+    m_free_slots = SLOTS;
+    return true;
+}
+
+void RemotePipe::unmap_slots() {
+    if (m_map != nullptr) {
+        munmap(m_map, m_map_size);
+        m_map = nullptr;
+    }
+}
+#else
+bool RemotePipe::map_slots(const std::string&) {
+    myprintf("The inference server is not supported on this platform.\n");
+    return false;
+}
+
+void RemotePipe::unmap_slots() {}
+#endif
+
+void RemotePipe::read_replies() {
+    auto message = std::string{};
+    while (m_connection->receive(message)) {
+        auto in = std::istringstream{message};
+        auto command = std::string{};
+        in >> command;
+        if (command != "done") {
+            continue;
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto slot = size_t{0};
+        while (in >> slot) {
+            if (slot < m_slots.size()) {
+                m_slots[slot].done = true;
+            }
+        }
+        m_condvar.notify_all();
+    }
+
+    lost_connection();
+}
+
+void RemotePipe::lost_connection() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_connected) {
+            return;
+        }
+        myprintf("Lost connection to inference server %s, "
+                 "evaluating locally.\n",
+                 m_address.c_str());
+        m_connected = false;
+    }
+    m_condvar.notify_all();
+    // Makes the reader stop if it is still waiting for replies.
+    m_connection->close();
+}
+
+ForwardPipe& RemotePipe::local_pipe() {
+    std::lock_guard<std::mutex> lock(m_local_mutex);
+    if (!m_local) {
+        const auto weights =
+            Network::load_tower_weights(m_weightsfile, m_network_hash);
+        if (!weights) {
+            myprintf("Can't evaluate without the inference server.\n");
+            // The searches are still running, exit() would destroy
+            // what they use.
+            std::quick_exit(EXIT_FAILURE);
+        }
+        m_local = std::make_unique<CPUPipe>();
+        m_local->initialize(m_channels);
+        m_local->push_weights(m_filter_size, m_input_channels, m_outputs,
+                              weights);
+    }
+    return *m_local;
+}
+
+void RemotePipe::forward(const std::vector<float>& input,
+                         std::vector<float>& output_pol,
+                         std::vector<float>& output_val) {
+    forward_batch(input, output_pol, output_val, 1);
+}
+
+void RemotePipe::forward_batch(const std::vector<float>& input,
+                               std::vector<float>& output_pol,
+                               std::vector<float>& output_val,
+                               const size_t batch_size) {
+    if (!forward_remote(input, output_pol, output_val, batch_size)) {
+        local_pipe().forward_batch(input, output_pol, output_val, batch_size);
+    }
+}
+
+void RemotePipe::release_slots(const std::vector<size_t>& slots) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const auto slot : slots) {
+            m_slots[slot].busy = false;
+        }
+        m_free_slots += int(slots.size());
+    }
+    m_condvar.notify_all();
+}
+
+bool RemotePipe::forward_remote(const std::vector<float>& input,
+                                std::vector<float>& output_pol,
+                                std::vector<float>& output_val,
+                                const size_t batch_size) {
+    assert(input.size() == batch_size * INPUT_SIZE);
+    assert(output_pol.size() == batch_size * OUTPUT_POL_SIZE);
+    assert(output_val.size() == batch_size * OUTPUT_VAL_SIZE);
+
+    auto slots = std::vector<size_t>{};
+    for (auto first = size_t{0}; first < batch_size; first += SLOTS) {
+        const auto count = std::min(size_t{SLOTS}, batch_size - first);
+
+        // Take all the slots at once, so that threads can't block each
+        // other with a part of their slots each.
+        slots.clear();
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condvar.wait(lock, [this, count]() {
+                return size_t(m_free_slots) >= count || !m_connected;
+            });
+            if (!m_connected) {
+                return false;
+            }
+            for (auto i = size_t{0}; slots.size() < count; i++) {
+                if (!m_slots[i].busy) {
+                    m_slots[i].busy = true;
+                    m_slots[i].done = false;
+                    slots.emplace_back(i);
+                }
+            }
+            m_free_slots -= int(count);
+        }
+
+        auto message = std::stringstream{};
+        message << "eval";
+        for (auto b = size_t{0}; b < count; b++) {
+            const auto in = begin(input) + (first + b) * INPUT_SIZE;
+            std::copy(in, in + INPUT_SIZE, m_slots[slots[b]].input);
+            message << ' ' << slots[b];
+        }
+        if (!m_connection->send(message.str())) {
+            lost_connection();
+            release_slots(slots);
+            return false;
+        }
+
+        auto done = false;
+        {
+            const auto all_done = [this, &slots]() {
+                return std::all_of(
+                    begin(slots), end(slots),
+                    [this](const auto slot) { return m_slots[slot].done; });
+            };
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condvar.wait(lock, [this, &all_done]() {
+                return !m_connected || all_done();
+            });
+            done = all_done();
+        }
+        if (!done) {
+            release_slots(slots);
+            return false;
+        }
+
+        for (auto b = size_t{0}; b < count; b++) {
+            const auto& slot = m_slots[slots[b]];
+            std::copy(slot.output_pol, slot.output_pol + OUTPUT_POL_SIZE,
+                      begin(output_pol) + (first + b) * OUTPUT_POL_SIZE);
+            std::copy(slot.output_val, slot.output_val + OUTPUT_VAL_SIZE,
+                      begin(output_val) + (first + b) * OUTPUT_VAL_SIZE);
+        }
+
+        release_slots(slots);
+    }
+    return true;
+}
+
+void RemotePipe::push_weights(
+    const unsigned int filter_size, const unsigned int channels,
+    const unsigned int outputs,
+    std::shared_ptr<const ForwardPipeWeights> /*weights*/) {
+    m_filter_size = filter_size;
+    m_input_channels = channels;
+    m_outputs = outputs;
+}
+
+#ifndef _WIN32
+namespace {
+    // The slots of a client, as mapped by the server.
+    struct Client {
+        std::unique_ptr<Connection> connection;
+        void* map{nullptr};
+        size_t map_size{0};
+        size_t slots{0};
+
+        ~Client() {
+            if (map != nullptr) {
+                munmap(map, map_size);
+            }
+        }
+    };
+
+    struct Request {
+        std::shared_ptr<Client> client;
+        size_t slot;
+    };
+
+    struct RequestQueue {
+        std::mutex mutex;
+        std::condition_variable condvar;
+        std::deque<Request> requests;
+    };
+}
+
+static std::string map_client(Client& client, const std::string& name) {
+    const auto fd = shm_open(name.c_str(), O_RDWR, 0600);
+    if (fd < 0) {
+        return "no shared memory " + name;
+    }
+    struct stat st {};
+    auto map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(SlotsHeader)) {
+        map = mmap(nullptr, size_t(st.st_size), PROT_READ | PROT_WRITE,
+                   MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        return "can't map " + name;
+    }
+    client.map = map;
+    client.map_size = size_t(st.st_size);
+
+    const auto header = static_cast<const SlotsHeader*>(map);
+    if (std::memcmp(header->magic, "LZNNPIP", sizeof(header->magic))
+        || header->version != SLOTS_VERSION
+        || header->input_size != INPUT_SIZE
+        || header->output_pol_size != OUTPUT_POL_SIZE
+        || header->output_val_size != OUTPUT_VAL_SIZE
+        || client.map_size
+               < sizeof(SlotsHeader)
+                     + header->slots * SLOT_SIZE * sizeof(float)) {
+        return "bad shared memory " + name;
+    }
+    client.slots = header->slots;
+    return "ok";
+}
+
+static void serve_client(const std::shared_ptr<Client>& client,
+                         RequestQueue& queue,
+                         const std::uint64_t network_hash) {
+    auto message = std::string{};
+    if (!client->connection->receive(message)) {
+        return;
+    }
+    auto in = std::istringstream{message};
+    auto command = std::string{};
+    auto hash = std::uint64_t{0};
+    auto channels = 0;
+    auto name = std::string{};
+    in >> command >> std::hex >> hash >> std::dec >> channels >> name;
+
+    auto reply = std::string{"ok"};
+    if (!in || command != "hello") {
+        reply = "error bad hello";
+    } else if (hash != network_hash) {
+        reply = "error different network";
+    } else {
+        const auto mapped = map_client(*client, name);
+        if (mapped != "ok") {
+            reply = "error " + mapped;
+        }
+    }
+    if (!client->connection->send(reply) || reply != "ok") {
+        return;
+    }
+    myprintf("Client %s connected.\n", name.c_str());
+
+    while (client->connection->receive(message)) {
+        in = std::istringstream{message};
+        in >> command;
+        if (command != "eval") {
+            continue;
+        }
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        auto slot = size_t{0};
+        while (in >> slot) {
+            if (slot < client->slots) {
+                queue.requests.emplace_back(Request{client, slot});
+            }
+        }
+        queue.condvar.notify_one();
+    }
+    myprintf("Client %s disconnected.\n", name.c_str());
+}
+
+// Evaluates the queued positions of all the clients together.
+static void run_batches(RequestQueue& queue, Network& network) {
+    auto input = std::vector<float>{};
+    auto output_pol = std::vector<float>{};
+    auto output_val = std::vector<float>{};
+    auto batch = std::vector<Request>{};
+    auto replies = std::vector<std::pair<Client*, std::string>>{};
+    for (;;) {
+        batch.clear();
+        {
+            std::unique_lock<std::mutex> lock(queue.mutex);
+            queue.condvar.wait(lock, [&queue]() {
+                return !queue.requests.empty();
+            });
+            // Give the other clients a moment to fill up the batch.
+            queue.condvar.wait_for(
+                lock, std::chrono::microseconds(RemotePipe::BATCH_WAIT_US),
+                [&queue]() {
+                    return queue.requests.size() >= RemotePipe::MAX_BATCH;
+                });
+            const auto count = std::min(queue.requests.size(),
+                                        size_t{RemotePipe::MAX_BATCH});
+            std::move(begin(queue.requests), begin(queue.requests) + count,
+                      std::back_inserter(batch));
+            queue.requests.erase(begin(queue.requests),
+                                 begin(queue.requests) + count);
+        }
+
+        input.resize(batch.size() * INPUT_SIZE);
+        output_pol.resize(batch.size() * OUTPUT_POL_SIZE);
+        output_val.resize(batch.size() * OUTPUT_VAL_SIZE);
+        for (auto b = size_t{0}; b < batch.size(); b++) {
+            const auto data = slot_data(batch[b].client->map, batch[b].slot);
+            std::copy(data, data + INPUT_SIZE,
+                      begin(input) + b * INPUT_SIZE);
+        }
+        network.forward_tower(input, output_pol, output_val, batch.size());
+
+        replies.clear();
+        for (auto b = size_t{0}; b < batch.size(); b++) {
+            const auto client = batch[b].client.get();
+            const auto data = slot_data(client->map, batch[b].slot);
+            const auto pol = begin(output_pol) + b * OUTPUT_POL_SIZE;
+            const auto val = begin(output_val) + b * OUTPUT_VAL_SIZE;
+            std::copy(pol, pol + OUTPUT_POL_SIZE, data + INPUT_SIZE);
+            std::copy(val, val + OUTPUT_VAL_SIZE,
+                      data + INPUT_SIZE + OUTPUT_POL_SIZE);
+
+            auto reply = std::find_if(
+                begin(replies), end(replies),
+                [client](const auto& r) { return r.first == client; });
+            if (reply == end(replies)) {
+                replies.emplace_back(client, "done");
+                reply = end(replies) - 1;
+            }
+            reply->second += ' ' + std::to_string(batch[b].slot);
+        }
+        for (const auto& reply : replies) {
+            if (!reply.first->connection->send(reply.second)) {
+                // Drops the client once its reader notices.
+                reply.first->connection->close();
+            }
+        }
+    }
+}
+
+void RemotePipe::serve(const std::string& address, Network& network) {
+    auto listener = Transport::listen(address);
+    if (!listener) {
+        return;
+    }
+    myprintf("Inference server listening on %s.\n", address.c_str());
+
+    auto queue = RequestQueue{};
+    std::thread([&queue, &network]() { run_batches(queue, network); })
+        .detach();
+    for (;;) {
+        auto client = std::make_shared<Client>();
+        client->connection = listener->accept();
+        if (!client->connection) {
+            continue;
+        }
+        const auto hash = network.get_network_hash();
+        std::thread([client, &queue, hash]() {
+            serve_client(client, queue, hash);
+        }).detach();
+    }
+}
+#else
+void RemotePipe::serve(const std::string&, Network&) {
+    myprintf("The inference server is not supported on this platform.\n");
+}
+#endif
@@ -0,0 +1,131 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef REMOTEPIPE_H_INCLUDED
+#define REMOTEPIPE_H_INCLUDED
+
+#include "config.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ForwardPipe.h"
+#include "Transport.h"
+
+class Network;
+
+// Evaluates the residual tower in an inference server shared by several
+// engine processes, so that it can batch the positions of all of them.
+// The input planes and the outputs go through a shared memory region of
+// the client, made of slots of one position each.  Only the numbers of
+// the slots go over the connection.  The policy and value heads are
+// still evaluated by the client.  If the server goes away, the client
+// reads the tower weights from the weights file again and evaluates the
+// tower itself from then on.
+class RemotePipe : public ForwardPipe {
+public:
+    // Positions a client can have evaluated at the same time.
+    static constexpr auto SLOTS = 128;
+    // Most positions the server evaluates in one forward pass.
+    static constexpr auto MAX_BATCH = 64;
+    // How long the server waits for a batch to fill up.
+    static constexpr auto BATCH_WAIT_US = 500;
+
+    RemotePipe(const std::string& address, const std::string& weightsfile,
+               std::uint64_t network_hash);
+    ~RemotePipe();
+
+    virtual void initialize(int channels);
+    virtual void forward(const std::vector<float>& input,
+                         std::vector<float>& output_pol,
+                         std::vector<float>& output_val);
+    virtual void forward_batch(const std::vector<float>& input,
+                               std::vector<float>& output_pol,
+                               std::vector<float>& output_val,
+                               size_t batch_size);
+    // The server has its own copy of the weights, only their sizes are
+    // kept, for evaluating locally without it.
+    virtual void push_weights(
+        unsigned int filter_size, unsigned int channels, unsigned int outputs,
+        std::shared_ptr<const ForwardPipeWeights> weights);
+
+    // Server side: evaluates for any number of clients using the same
+    // network.  Only returns if the address can't be listened on.
+    static void serve(const std::string& address, Network& network);
+
+private:
+    struct Slot {
+        float* input;
+        float* output_pol;
+        float* output_val;
+        bool busy;
+        bool done;
+    };
+
+    bool map_slots(const std::string& name);
+    void unmap_slots();
+    void read_replies();
+    // False if the server is gone, then nothing was evaluated.
+    bool forward_remote(const std::vector<float>& input,
+                        std::vector<float>& output_pol,
+                        std::vector<float>& output_val, size_t batch_size);
+    void release_slots(const std::vector<size_t>& slots);
+    void lost_connection();
+    ForwardPipe& local_pipe();
+
+    std::string m_address;
+    std::string m_weightsfile;
+    std::uint64_t m_network_hash;
+    std::unique_ptr<Connection> m_connection;
+    std::thread m_reader;
+
+    void* m_map{nullptr};
+    size_t m_map_size{0};
+    std::vector<Slot> m_slots;
+    int m_free_slots{0};
+    bool m_connected{false};
+    std::mutex m_mutex;
+    std::condition_variable m_condvar;
+
+    // What the local pipe needs, and the pipe once it is made.
+    int m_channels{0};
+    unsigned int m_filter_size{0};
+    unsigned int m_input_channels{0};
+    unsigned int m_outputs{0};
+    std::unique_ptr<ForwardPipe> m_local;
+    std::mutex m_local_mutex;
+};
+
+#endif
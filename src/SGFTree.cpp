@@ -155,14 +155,16 @@ void SGFTree::populate_states() {
     // Verifies if the game type is Go.
     // If it is Go but the board size is not defined (SZ), then insert
     // the standard size 19x19.
+    // GM[2] is othello, which state_to_string() writes in that mode.
     it = m_properties.find("GM");
     if (it != end(m_properties)) {
-        if (it->second != "1") {
+        if (it->second != (IS_OTHELLO ? "2" : "1")) {
             throw std::runtime_error("SGF Game is not a Go game");
         } else {
             if (!m_properties.count("SZ")) {
                 // No size, but SGF spec defines default size for Go
-                m_properties.insert(std::make_pair("SZ", "19"));
+                m_properties.insert(
+                    std::make_pair("SZ", IS_OTHELLO ? "8" : "19"));
                 valid_size = true;
             }
         }
@@ -30,6 +30,13 @@
 #include <cassert>
 #include <thread>
 
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 #include "SMP.h"
 
 SMP::Mutex::Mutex() {
@@ -85,3 +92,14 @@ SMP::Lock::~Lock() {
 size_t SMP::get_num_cpus() {
     return std::thread::hardware_concurrency();
 }
+
+void SMP::lower_thread_priority() {
+#ifdef _WIN32
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_IDLE);
+#elif defined(__linux__)
+    // Only gets the CPU when nothing else wants it.
+    auto param = sched_param{};
+    param.sched_priority = 0;
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#endif
+}
@@ -37,6 +37,9 @@
 
 namespace SMP {
     size_t get_num_cpus();
+    // Lets the calling thread run only on otherwise idle cores, where
+    // the system has a way to do so.
+    void lower_thread_priority();
 
     class Mutex {
     public:
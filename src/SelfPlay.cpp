@@ -0,0 +1,99 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <thread>
+#include <vector>
+
+#include "SelfPlay.h"
+
+#include "FastBoard.h"
+#include "GameState.h"
+#include "GTP.h"
+#include "SGFTree.h"
+#include "UCTSearch.h"
+#include "Utils.h"
+
+using namespace Utils;
+
+SelfPlay::SelfPlay(Network& network, const std::string& basename)
+    : m_network(network),
+      m_chunker(basename, true),
+      m_sgf(basename + ".sgf", std::ofstream::app) {}
+
+void SelfPlay::run(const int parallel, const int games) {
+    m_max_games = games;
+    m_network.set_shared(parallel > 1);
+    auto threads = std::vector<std::thread>{};
+    for (auto i = 0; i < parallel; i++) {
+        threads.emplace_back([this]() { play_games(); });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+void SelfPlay::play_games() {
+    // The workers of a search keep their threads until it stops, so
+    // the games can't share the global pool.
+    auto pool = ThreadPool{};
+    pool.initialize(cfg_num_threads);
+    while (m_max_games == 0 || m_next_game++ < m_max_games) {
+        play_game(pool);
+    }
+}
+
+void SelfPlay::play_game(ThreadPool& pool) {
+    auto game = GameState{};
+    game.init_game(BOARD_SIZE, KOMI);
+    game.set_timecontrol(0, 1, 0, 0); // Set infinite time.
+    auto search = UCTSearch{game, m_network};
+    search.set_thread_pool(pool, cfg_num_threads);
+    Training::clear_training();
+
+    do {
+        const auto move = search.think(game.get_to_move(), UCTSearch::NORMAL);
+        game.play_move(move);
+    } while (game.get_passes() < 2 && !game.has_resigned());
+
+    auto winner = int{FastBoard::BLACK};
+    if (game.has_resigned()) {
+        winner = !game.who_resigned();
+    } else if (game.final_score() < 0.0f) {
+        winner = FastBoard::WHITE;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Training::dump_training(winner, m_chunker);
+    m_sgf << SGFTree::state_to_string(game, FastBoard::BLACK) << std::endl;
+    myprintf("Self-play game over after %zu moves, %s wins.\n",
+             game.get_movenum(),
+             winner == FastBoard::BLACK ? "black" : "white");
+}
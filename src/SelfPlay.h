@@ -0,0 +1,70 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef SELFPLAY_H_INCLUDED
+#define SELFPLAY_H_INCLUDED
+
+#include "config.h"
+
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <string>
+
+#include "ThreadPool.h"
+#include "Training.h"
+
+class Network;
+
+// Plays self-play games for training, several at once.  The games share
+// the network and its cache, so that their evaluations batch together,
+// but every game searches its own tree with its own threads.  The
+// training data of the games goes into chunks named after basename, and
+// the games themselves into basename.sgf.
+class SelfPlay {
+public:
+    SelfPlay(Network& network, const std::string& basename);
+
+    // Plays parallel games at a time until games games are over, or
+    // for ever if games is 0.
+    void run(int parallel, int games);
+
+private:
+    void play_games();
+    void play_game(Utils::ThreadPool& pool);
+
+    Network& m_network;
+    OutputChunker m_chunker;
+    std::ofstream m_sgf;
+    std::mutex m_mutex;
+    std::atomic<int> m_next_game{0};
+    int m_max_games{0};
+};
+
+#endif
@@ -0,0 +1,194 @@
+/*
+    Extended from code:
+    Copyright (c) 2012 Jakob Progsch, Václav Zeman
+    Modifications:
+    Copyright (c) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    This software is provided 'as-is', without any express or implied
+    warranty. In no event will the authors be held liable for any damages
+    arising from the use of this software.
+
+    Permission is granted to anyone to use this software for any purpose,
+    including commercial applications, and to alter it and redistribute it
+    freely, subject to the following restrictions:
+
+    1. The origin of this software must not be misrepresented; you must not
+    claim that you wrote the original software. If you use this software
+    in a product, an acknowledgment in the product documentation would be
+    appreciated but is not required.
+
+    2. Altered source versions must be plainly marked as such, and must not be
+    misrepresented as being the original software.
+
+    3. This notice may not be removed or altered from any source
+    distribution.
+*/
+
+
+#include "config.h"
+
+#include <utility>
+
+#include "ThreadPool.h"
+
+namespace Utils {
+
+// The pool and deque of the worker running on this thread, if any.
+static thread_local const ThreadPool* t_pool = nullptr;
+static thread_local std::size_t t_home = 0;
+
+ThreadPool::ThreadPool() {
+    // Tasks queued before any worker is added wait in the first deque.
+    m_queues[0] = std::make_unique<WorkQueue>();
+    m_num_queues = 1;
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_exit = true;
+    }
+    m_condvar.notify_all();
+    for (std::thread& worker : m_threads) {
+        worker.join();
+    }
+}
+
+void ThreadPool::initialize(const size_t threads) {
+    for (size_t i = 0; i < threads; i++) {
+        add_thread([]() {} /* null function */);
+    }
+}
+
+void ThreadPool::add_thread(std::function<void()> initializer) {
+    const auto home = m_threads.size() % MAX_QUEUES;
+    if (!m_queues[home]) {
+        m_queues[home] = std::make_unique<WorkQueue>();
+        m_num_queues.store(home + 1, std::memory_order_release);
+    }
+    m_threads.emplace_back([this, home, initializer] {
+        t_pool = this;
+        t_home = home;
+        initializer();
+        worker_loop(home);
+    });
+}
+
+bool ThreadPool::is_worker() const {
+    return t_pool == this;
+}
+
+void ThreadPool::submit(Task task) {
+    auto home = t_home;
+    if (!is_worker()) {
+        const auto queues = m_num_queues.load(std::memory_order_acquire);
+        home = m_next_queue.fetch_add(1, std::memory_order_relaxed) % queues;
+    }
+    {
+        auto& queue = *m_queues[home];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+    }
+    // Pairs with the sleeping count and queued check in worker_loop, so
+    // either this thread sees the sleeper or the sleeper sees the task.
+    m_queued++;
+    if (m_sleeping > 0) {
+        { std::lock_guard<std::mutex> lock(m_mutex); }
+        m_condvar.notify_one();
+    }
+}
+
+bool ThreadPool::pop_task(Task& task, const std::size_t home) {
+    if (m_queued.load(std::memory_order_relaxed) == 0) {
+        return false;
+    }
+    // Our own deque LIFO, as its last task is likely still in the cache,
+    // the others FIFO, taking their oldest and usually largest tasks.
+    const auto queues = m_num_queues.load(std::memory_order_acquire);
+    for (auto i = size_t{0}; i < queues; i++) {
+        auto& queue = *m_queues[(home + i) % queues];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) {
+            continue;
+        }
+        if (i == 0) {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        } else {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+        m_queued--;
+        return true;
+    }
+    return false;
+}
+
+bool ThreadPool::run_pending_task() {
+    auto task = Task{};
+    if (!pop_task(task, is_worker() ? t_home : 0)) {
+        return false;
+    }
+    task();
+    return true;
+}
+
+void ThreadPool::worker_loop(const std::size_t home) {
+    for (;;) {
+        auto task = Task{};
+        if (pop_task(task, home)) {
+            task();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_sleeping++;
+        m_condvar.wait(lock, [this] { return m_exit || m_queued > 0; });
+        m_sleeping--;
+        if (m_exit && m_queued == 0) {
+            return;
+        }
+    }
+}
+
+ThreadGroup::~ThreadGroup() {
+    try {
+        wait_all();
+    } catch (...) {
+    }
+}
+
+void ThreadGroup::wait_all() {
+    // A worker waiting for nested tasks runs queued tasks meanwhile, so
+    // that the pool can't end up with every worker blocked.
+    if (m_pool.is_worker()) {
+        while (m_pending.load(std::memory_order_acquire) > 0) {
+            if (!m_pool.run_pending_task()) {
+                std::this_thread::yield();
+            }
+        }
+    }
+    // Also orders us after the last task_done(), which holds the mutex.
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_condvar.wait(lock, [this] { return m_pending == 0; });
+    if (m_exception) {
+        std::rethrow_exception(std::exchange(m_exception, nullptr));
+    }
+}
+
+void ThreadGroup::set_exception(std::exception_ptr exception) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_exception) {
+        m_exception = std::move(exception);
+    }
+}
+
+void ThreadGroup::task_done() {
+    // Under the mutex: the group may be destroyed as soon as a waiter
+    // sees the count drop to zero.
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (--m_pending == 0) {
+        m_condvar.notify_all();
+    }
+}
+
+}
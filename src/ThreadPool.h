@@ -26,21 +26,137 @@
     distribution.
 */
 
+#include <array>
+#include <atomic>
 #include <condition_variable>
 #include <cstddef>
+#include <deque>
+#include <exception>
 #include <functional>
 #include <future>
 #include <memory>
 #include <mutex>
-#include <queue>
+#include <new>
 #include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 namespace Utils {
 
+// A move-only void() callable.  Callables of up to INLINE_SIZE bytes are
+// stored in place, so queueing a small lambda does not allocate.
+class Task {
+public:
+    static constexpr std::size_t INLINE_SIZE = 48;
+
+    Task() = default;
+    template <class F,
+              class = std::enable_if_t<!std::is_same<std::decay_t<F>,
+                                                     Task>::value>>
+    Task(F&& f) {
+        using Callable = std::decay_t<F>;
+        if constexpr (fits_inline<Callable>()) {
+            new (&m_storage) Callable(std::forward<F>(f));
+            m_ops = &InlineOps<Callable>::ops;
+        } else {
+            new (&m_storage) Callable*(new Callable(std::forward<F>(f)));
+            m_ops = &HeapOps<Callable>::ops;
+        }
+    }
+    Task(Task&& other) noexcept {
+        move_from(other);
+    }
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            reset();
+            move_from(other);
+        }
+        return *this;
+    }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task() {
+        reset();
+    }
+
+    explicit operator bool() const {
+        return m_ops != nullptr;
+    }
+    void operator()() {
+        m_ops->invoke(&m_storage);
+    }
+
+private:
+    struct Ops {
+        void (*invoke)(void*);
+        // Moves the callable to new storage and destroys the old one.
+        void (*relocate)(void* from, void* to);
+        void (*destroy)(void*);
+    };
+
+    template <class F>
+    static constexpr bool fits_inline() {
+        return sizeof(F) <= INLINE_SIZE
+               && alignof(F) <= alignof(std::max_align_t)
+               && std::is_nothrow_move_constructible<F>::value;
+    }
+
+    template <class F>
+    struct InlineOps {
+        static void invoke(void* p) {
+            (*static_cast<F*>(p))();
+        }
+        static void relocate(void* from, void* to) {
+            new (to) F(std::move(*static_cast<F*>(from)));
+            static_cast<F*>(from)->~F();
+        }
+        static void destroy(void* p) {
+            static_cast<F*>(p)->~F();
+        }
+        static constexpr Ops ops{invoke, relocate, destroy};
+    };
+
+    template <class F>
+    struct HeapOps {
+        static void invoke(void* p) {
+            (**static_cast<F**>(p))();
+        }
+        static void relocate(void* from, void* to) {
+            new (to) F*(*static_cast<F**>(from));
+        }
+        static void destroy(void* p) {
+            delete *static_cast<F**>(p);
+        }
+        static constexpr Ops ops{invoke, relocate, destroy};
+    };
+
+    void move_from(Task& other) noexcept {
+        m_ops = other.m_ops;
+        if (m_ops) {
+            m_ops->relocate(&other.m_storage, &m_storage);
+            other.m_ops = nullptr;
+        }
+    }
+    void reset() {
+        if (m_ops) {
+            m_ops->destroy(&m_storage);
+            m_ops = nullptr;
+        }
+    }
+
+    std::aligned_storage_t<INLINE_SIZE, alignof(std::max_align_t)> m_storage;
+    const Ops* m_ops{nullptr};
+};
+
+// Work-stealing pool.  Every worker has its own deque: tasks queued from
+// a worker go to the back of its deque and it takes them back from there,
+// while idle workers steal from the front of the other deques.  Tasks
+// queued from other threads are spread over the deques round-robin.
 class ThreadPool {
 public:
-    ThreadPool() = default;
+    ThreadPool();
     ~ThreadPool();
 
     // create worker threads.  This version has no initializers.
@@ -54,86 +170,99 @@ public:
     auto add_task(F&& f, Args&&... args)
         -> std::future<typename std::result_of<F(Args...)>::type>;
 
+    // Queues a task without a future.  The task must not throw.
+    void submit(Task task);
+    // Runs one queued task on the calling thread.  Returns false if
+    // there was nothing to run.
+    bool run_pending_task();
+    bool is_worker() const;
+
 private:
+    // Workers past this count share deques.
+    static constexpr std::size_t MAX_QUEUES = 256;
+
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    bool pop_task(Task& task, std::size_t home);
+    void worker_loop(std::size_t home);
+
     std::vector<std::thread> m_threads;
-    std::queue<std::function<void()>> m_tasks;
+    std::array<std::unique_ptr<WorkQueue>, MAX_QUEUES> m_queues;
+    std::atomic<std::size_t> m_num_queues{0};
+    std::atomic<std::size_t> m_next_queue{0};
+    std::atomic<int> m_queued{0};
+    std::atomic<int> m_sleeping{0};
 
     std::mutex m_mutex;
     std::condition_variable m_condvar;
     bool m_exit{false};
 };
 
-inline void ThreadPool::add_thread(std::function<void()> initializer) {
-    m_threads.emplace_back([this, initializer] {
-        initializer();
-        for (;;) {
-            std::function<void()> task;
-            {
-                std::unique_lock<std::mutex> lock(m_mutex);
-                m_condvar.wait(lock,
-                               [this] { return m_exit || !m_tasks.empty(); });
-                if (m_exit && m_tasks.empty()) {
-                    return;
-                }
-                task = std::move(m_tasks.front());
-                m_tasks.pop();
-            }
-            task();
-        }
-    });
-}
-
-inline void ThreadPool::initialize(const size_t threads) {
-    for (size_t i = 0; i < threads; i++) {
-        add_thread([]() {} /* null function */);
-    }
-}
-
 template <class F, class... Args>
 auto ThreadPool::add_task(F&& f, Args&&... args)
     -> std::future<typename std::result_of<F(Args...)>::type> {
     using return_type = typename std::result_of<F(Args...)>::type;
 
-    auto task = std::make_shared<std::packaged_task<return_type()>>(
+    auto task = std::packaged_task<return_type()>(
         std::bind(std::forward<F>(f), std::forward<Args>(args)...));
-
-    std::future<return_type> res = task->get_future();
-    {
-        std::unique_lock<std::mutex> lock(m_mutex);
-        m_tasks.emplace([task]() { (*task)(); });
-    }
-    m_condvar.notify_one();
+    auto res = task.get_future();
+    submit(Task(std::move(task)));
     return res;
 }
 
-inline ThreadPool::~ThreadPool() {
-    {
-        std::unique_lock<std::mutex> lock(m_mutex);
-        m_exit = true;
-    }
-    m_condvar.notify_all();
-    for (std::thread& worker : m_threads) {
-        worker.join();
-    }
-}
-
 class ThreadGroup {
 public:
     ThreadGroup(ThreadPool& pool) : m_pool(pool) {}
+    ThreadGroup(const ThreadGroup&) = delete;
+    ThreadGroup& operator=(const ThreadGroup&) = delete;
+    // Waits for the tasks still running, as they refer to the group.
+    ~ThreadGroup();
+
     template <class F, class... Args>
     void add_task(F&& f, Args&&... args) {
-        m_taskresults.emplace_back(
-            m_pool.add_task(std::forward<F>(f), std::forward<Args>(args)...));
+        m_pending.fetch_add(1, std::memory_order_relaxed);
+        m_pool.submit(
+            [this, f = std::decay_t<F>(std::forward<F>(f)),
+             args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+                try {
+                    std::apply(f, args);
+                } catch (...) {
+                    set_exception(std::current_exception());
+                }
+                task_done();
+            });
     }
-    void wait_all() {
-        for (auto&& result : m_taskresults) {
-            result.get();
+
+    // Splits [0, count) into parts ranges and calls f(begin, end) for
+    // each of them, the calling thread taking the first one, then waits
+    // for all of them.  Can be nested inside tasks of the same pool.
+    template <class F>
+    void parallel_for(int parts, int count, F&& f) {
+        for (auto part = 1; part < parts; part++) {
+            add_task([&f, part, parts, count]() {
+                f(count * part / parts, count * (part + 1) / parts);
+            });
         }
+        f(0, count / parts);
+        wait_all();
     }
 
+    // Rethrows the first exception thrown by a task.  The group can be
+    // reused for new tasks afterwards.
+    void wait_all();
+
 private:
+    void set_exception(std::exception_ptr exception);
+    void task_done();
+
     ThreadPool& m_pool;
-    std::vector<std::future<void>> m_taskresults;
+    std::atomic<int> m_pending{0};
+    std::mutex m_mutex;
+    std::condition_variable m_condvar;
+    std::exception_ptr m_exception;
 };
 
 }
@@ -53,7 +53,7 @@
 #include "string.h"
 #include "zlib.h"
 
-std::vector<TimeStep> Training::m_data{};
+thread_local std::vector<TimeStep> Training::m_data{};
 
 std::ostream& operator<<(std::ostream& stream, const TimeStep& timestep) {
     stream << timestep.planes.size() << ' ';
@@ -279,10 +279,11 @@ void Training::dump_training(const int winner_color, OutputChunker& outchunk) {
                              | plane[bit + 3] << 0;
                 out << std::hex << hexbyte;
             }
-            // NUM_INTERSECTIONS % 4 = 1 so the last bit goes by itself
-            // for odd sizes
-            assert(plane.size() % 4 == 1);
-            out << plane[plane.size() - 1];
+            // The last bit goes by itself for odd sizes, where
+            // NUM_INTERSECTIONS % 4 = 1
+            if (plane.size() % 4 == 1) {
+                out << plane[plane.size() - 1];
+            }
             out << std::dec << std::endl;
         }
         // The side to move planes can be compactly encoded into a single
@@ -82,6 +82,7 @@ public:
     static void clear_training();
     static void dump_training(int winner_color,
                               const std::string& out_filename);
+    static void dump_training(int winner_color, OutputChunker& outchunker);
     static void dump_debug(const std::string& out_filename);
     static void record(Network& network, const GameState& state,
                        const UCTNode& node);
@@ -96,11 +97,12 @@ private:
     static void process_game(GameState& state, size_t& train_pos, int who_won,
                              const std::vector<int>& tree_moves,
                              OutputChunker& outchunker);
-    static void dump_training(int winner_color, OutputChunker& outchunker);
     static void dump_debug(OutputChunker& outchunker);
     static void save_training(std::ofstream& out);
     static void load_training(std::ifstream& in);
-    static std::vector<TimeStep> m_data;
+    // Every thread records its own game, so that several games can be
+    // played at once.
+    static thread_local std::vector<TimeStep> m_data;
 };
 
 #endif
@@ -0,0 +1,354 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <array>
+#include <boost/asio.hpp>
+#include <cstdint>
+#include <cstdio>
+#include <istream>
+#include <map>
+#include <mutex>
+#include <utility>
+
+#ifdef HAVE_SELECT
+#include <sys/select.h>
+#endif
+
+#include "Transport.h"
+
+#include "Utils.h"
+
+using namespace Utils;
+namespace asio = boost::asio;
+
+// The port after the last colon, -1 if there is none.
+static int parse_port(const std::string& address) {
+    const auto colon = address.rfind(':');
+    try {
+        return colon == std::string::npos
+                   ? -1
+                   : std::stoi(address.substr(colon + 1));
+    } catch (...) {
+        return -1;
+    }
+}
+
+// Messages are sent as a 32-bit little endian length, then the bytes.
+// Anything longer than this is taken as a corrupt stream.
+static constexpr std::uint32_t MAX_MESSAGE_SIZE = 64 * 1024 * 1024;
+
+template <class Protocol>
+class StreamConnection : public Connection {
+public:
+    using Socket = typename Protocol::socket;
+
+    StreamConnection(std::unique_ptr<asio::io_context>&& context,
+                     Socket&& socket, const Framing framing)
+        : m_context(std::move(context)),
+          m_socket(std::move(socket)),
+          m_framing(framing) {}
+
+    virtual bool send(const std::string& message) {
+        if (m_framing == Framing::LINES) {
+            std::lock_guard<std::mutex> lock(m_send_mutex);
+            auto error = boost::system::error_code{};
+            asio::write(m_socket, asio::buffer(message), error);
+            return !error;
+        }
+        const auto size = std::uint32_t(message.size());
+        auto header = std::array<unsigned char, 4>{};
+        for (auto i = 0; i < 4; i++) {
+            header[i] = (size >> (8 * i)) & 0xFF;
+        }
+        const auto buffers = std::array<asio::const_buffer, 2>{
+            asio::buffer(header), asio::buffer(message)};
+        std::lock_guard<std::mutex> lock(m_send_mutex);
+        auto error = boost::system::error_code{};
+        asio::write(m_socket, buffers, error);
+        return !error;
+    }
+
+    virtual bool receive(std::string& message) {
+        if (m_framing == Framing::LINES) {
+            return receive_line(message);
+        }
+        auto header = std::array<unsigned char, 4>{};
+        auto error = boost::system::error_code{};
+        asio::read(m_socket, asio::buffer(header), error);
+        if (error) {
+            return false;
+        }
+        auto size = std::uint32_t{0};
+        for (auto i = 0; i < 4; i++) {
+            size |= std::uint32_t{header[i]} << (8 * i);
+        }
+        if (size > MAX_MESSAGE_SIZE) {
+            return false;
+        }
+        message.resize(size);
+        asio::read(m_socket, asio::buffer(&message[0], size), error);
+        return !error;
+    }
+
+    virtual bool input_pending() {
+        if (m_buffer.size() > 0) {
+            return true;
+        }
+#ifdef HAVE_SELECT
+        // Also readable when the other end is gone.
+        const auto fd = m_socket.native_handle();
+        fd_set read_fds;
+        FD_ZERO(&read_fds);
+        FD_SET(fd, &read_fds);
+        struct timeval timeout{0, 0};
+        select(fd + 1, &read_fds, nullptr, nullptr, &timeout);
+        return FD_ISSET(fd, &read_fds);
+#else
+        auto error = boost::system::error_code{};
+        return m_socket.available(error) > 0 || error;
+#endif
+    }
+
+    virtual void close() {
+        auto error = boost::system::error_code{};
+        m_socket.shutdown(Socket::shutdown_both, error);
+    }
+
+private:
+    bool receive_line(std::string& message) {
+        auto error = boost::system::error_code{};
+        asio::read_until(m_socket, m_buffer, '\n', error);
+        // A last line may end without a newline.
+        if (error && m_buffer.size() == 0) {
+            return false;
+        }
+        auto stream = std::istream{&m_buffer};
+        std::getline(stream, message);
+        if (!message.empty() && message.back() == '\r') {
+            message.pop_back();
+        }
+        return true;
+    }
+
+    std::unique_ptr<asio::io_context> m_context;
+    Socket m_socket;
+    Framing m_framing;
+    // Read ahead of the line that receive() returns.
+    asio::streambuf m_buffer{MAX_MESSAGE_SIZE};
+    std::mutex m_send_mutex;
+};
+
+template <class Protocol>
+class StreamListener : public Listener {
+public:
+    StreamListener(std::unique_ptr<asio::io_context>&& context,
+                   typename Protocol::acceptor&& acceptor,
+                   const Framing framing)
+        : m_context(std::move(context)),
+          m_acceptor(std::move(acceptor)),
+          m_framing(framing) {}
+
+    virtual std::unique_ptr<Connection> accept() {
+        auto context = std::make_unique<asio::io_context>();
+        auto socket = typename Protocol::socket{*context};
+        auto error = boost::system::error_code{};
+        m_acceptor.accept(socket, error);
+        if (error) {
+            myprintf("Accepting a connection failed: %s\n",
+                     error.message().c_str());
+            return nullptr;
+        }
+        return std::make_unique<StreamConnection<Protocol>>(
+            std::move(context), std::move(socket), m_framing);
+    }
+
+private:
+    std::unique_ptr<asio::io_context> m_context;
+    typename Protocol::acceptor m_acceptor;
+    Framing m_framing;
+};
+
+static std::unique_ptr<Connection> tcp_connect(const std::string& address,
+                                               const Framing framing) {
+    using asio::ip::tcp;
+    if (parse_port(address) < 0) {
+        myprintf("Missing port in address %s.\n", address.c_str());
+        return nullptr;
+    }
+    const auto colon = address.rfind(':');
+    auto context = std::make_unique<asio::io_context>();
+    auto resolver = tcp::resolver{*context};
+    auto error = boost::system::error_code{};
+    const auto endpoints = resolver.resolve(
+        address.substr(0, colon), address.substr(colon + 1), error);
+    auto socket = tcp::socket{*context};
+    if (!error) {
+        asio::connect(socket, endpoints, error);
+    }
+    if (error) {
+        myprintf("Connecting to %s failed: %s\n", address.c_str(),
+                 error.message().c_str());
+        return nullptr;
+    }
+    socket.set_option(tcp::no_delay(true), error);
+    return std::make_unique<StreamConnection<tcp>>(
+        std::move(context), std::move(socket), framing);
+}
+
+static std::unique_ptr<Listener> tcp_listen(const std::string& address,
+                                            const Framing framing) {
+    using asio::ip::tcp;
+    const auto port = parse_port(address);
+    if (port < 0) {
+        myprintf("Missing port in address %s.\n", address.c_str());
+        return nullptr;
+    }
+    auto host = address.substr(0, address.rfind(':'));
+    // Other machines only get in when the address names them.
+    if (host.empty()) {
+        host = "127.0.0.1";
+    }
+    auto context = std::make_unique<asio::io_context>();
+    auto acceptor = tcp::acceptor{*context};
+    auto error = boost::system::error_code{};
+    const auto endpoint =
+        tcp::endpoint{asio::ip::make_address(host, error),
+                      static_cast<unsigned short>(port)};
+    if (!error) {
+        acceptor.open(endpoint.protocol(), error);
+    }
+    if (!error) {
+        acceptor.set_option(tcp::acceptor::reuse_address(true), error);
+        acceptor.bind(endpoint, error);
+    }
+    if (!error) {
+        acceptor.listen(asio::socket_base::max_listen_connections, error);
+    }
+    if (error) {
+        myprintf("Listening on %s failed: %s\n", address.c_str(),
+                 error.message().c_str());
+        return nullptr;
+    }
+    return std::make_unique<StreamListener<tcp>>(
+        std::move(context), std::move(acceptor), framing);
+}
+
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+static std::unique_ptr<Connection> local_connect(const std::string& path,
+                                                 const Framing framing) {
+    using asio::local::stream_protocol;
+    auto context = std::make_unique<asio::io_context>();
+    auto socket = stream_protocol::socket{*context};
+    auto error = boost::system::error_code{};
+    socket.connect(stream_protocol::endpoint{path}, error);
+    if (error) {
+        myprintf("Connecting to %s failed: %s\n", path.c_str(),
+                 error.message().c_str());
+        return nullptr;
+    }
+    return std::make_unique<StreamConnection<stream_protocol>>(
+        std::move(context), std::move(socket), framing);
+}
+
+static std::unique_ptr<Listener> local_listen(const std::string& path,
+                                              const Framing framing) {
+    using asio::local::stream_protocol;
+    // A socket file left behind by an earlier run would make bind fail.
+    std::remove(path.c_str());
+    auto context = std::make_unique<asio::io_context>();
+    auto acceptor = stream_protocol::acceptor{*context};
+    auto error = boost::system::error_code{};
+    const auto endpoint = stream_protocol::endpoint{path};
+    acceptor.open(endpoint.protocol(), error);
+    if (!error) {
+        acceptor.bind(endpoint, error);
+    }
+    if (!error) {
+        acceptor.listen(asio::socket_base::max_listen_connections, error);
+    }
+    if (error) {
+        myprintf("Listening on %s failed: %s\n", path.c_str(),
+                 error.message().c_str());
+        return nullptr;
+    }
+    return std::make_unique<StreamListener<stream_protocol>>(
+        std::move(context), std::move(acceptor), framing);
+}
+#endif
+
+struct Scheme {
+    Transport::Connector connector;
+    Transport::ListenerFactory listener;
+};
+
+static std::mutex s_schemes_mutex;
+
+static std::map<std::string, Scheme>& schemes() {
+    static auto s_schemes = std::map<std::string, Scheme>{
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+        {"unix", {local_connect, local_listen}},
+#endif
+        {"tcp", {tcp_connect, tcp_listen}}};
+    return s_schemes;
+}
+
+// Splits "scheme:rest" off the address.  Anything else is TCP, whose
+// addresses have a colon too, before the port.
+static std::pair<Scheme, std::string> find_scheme(const std::string& address) {
+    std::lock_guard<std::mutex> lock(s_schemes_mutex);
+    const auto colon = address.find(':');
+    if (colon != std::string::npos) {
+        const auto it = schemes().find(address.substr(0, colon));
+        if (it != end(schemes())) {
+            return {it->second, address.substr(colon + 1)};
+        }
+    }
+    return {schemes().at("tcp"), address};
+}
+
+void Transport::register_scheme(const std::string& scheme,
+                                Connector connector,
+                                ListenerFactory listener) {
+    std::lock_guard<std::mutex> lock(s_schemes_mutex);
+    schemes()[scheme] = {std::move(connector), std::move(listener)};
+}
+
+std::unique_ptr<Connection> Transport::connect(const std::string& address,
+                                               const Framing framing) {
+    const auto scheme = find_scheme(address);
+    return scheme.first.connector(scheme.second, framing);
+}
+
+std::unique_ptr<Listener> Transport::listen(const std::string& address,
+                                            const Framing framing) {
+    const auto scheme = find_scheme(address);
+    return scheme.first.listener(scheme.second, framing);
+}
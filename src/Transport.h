@@ -0,0 +1,88 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef TRANSPORT_H_INCLUDED
+#define TRANSPORT_H_INCLUDED
+
+#include "config.h"
+
+#include <functional>
+#include <memory>
+#include <string>
+
+// A connection carrying whole messages between two processes.  One
+// thread may send while another one receives.
+class Connection {
+public:
+    virtual ~Connection() = default;
+    // Both return false once the connection is closed or broken.
+    virtual bool send(const std::string& message) = 0;
+    virtual bool receive(std::string& message) = 0;
+    // Whether receive() would return without waiting, also true once
+    // the other end closed the connection.
+    virtual bool input_pending() = 0;
+    // Makes a receive() blocked in another thread return.
+    virtual void close() = 0;
+};
+
+class Listener {
+public:
+    virtual ~Listener() = default;
+    // Waits for the next connection, nullptr on failure.
+    virtual std::unique_ptr<Connection> accept() = 0;
+};
+
+// How messages are cut out of the byte stream.  LENGTH puts the size
+// in front of every message, LINES ends them at newlines, for text
+// protocols like GTP: send() then writes the text as it is and receive()
+// returns one line without its line ending.
+enum class Framing { LENGTH, LINES };
+
+// Opens connections by address.  "host:port" is TCP, other schemes are
+// picked by their "scheme:" prefix, like "unix:/tmp/leelaz.sock" for a
+// local socket where the system has them.  More schemes can be added.
+// Listening on ":port" takes only local connections, "0.0.0.0:port"
+// takes them from everywhere.
+namespace Transport {
+    using Connector = std::function<std::unique_ptr<Connection>(
+        const std::string&, Framing)>;
+    using ListenerFactory = std::function<std::unique_ptr<Listener>(
+        const std::string&, Framing)>;
+
+    void register_scheme(const std::string& scheme, Connector connector,
+                         ListenerFactory listener);
+
+    // Both print why and return nullptr when they fail.
+    std::unique_ptr<Connection> connect(const std::string& address,
+                                        Framing framing = Framing::LENGTH);
+    std::unique_ptr<Listener> listen(const std::string& address,
+                                     Framing framing = Framing::LENGTH);
+}
+
+#endif
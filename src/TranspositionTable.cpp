@@ -0,0 +1,69 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <new>
+
+#include "TranspositionTable.h"
+
+#include "NodeArena.h"
+
+TranspositionTable::TranspositionTable(NodeArena& arena) {
+    static_assert(SLOTS * sizeof(Entry) == SIZE, "Unexpected entry size");
+    m_entries = static_cast<Entry*>(arena.allocate(SIZE));
+    for (auto i = size_t{0}; i < SLOTS; i++) {
+        new (&m_entries[i]) Entry;
+    }
+}
+
+UCTNode* TranspositionTable::insert_or_get(std::uint64_t hash,
+                                           UCTNode* const node) {
+    // Zero marks a free slot.
+    hash = hash != 0 ? hash : 1;
+    const auto first = hash & (SLOTS - 1);
+    for (auto i = size_t{0}; i < PROBE_SLOTS; i++) {
+        auto& entry = m_entries[(first + i) & (SLOTS - 1)];
+        auto key = entry.key.load();
+        if (key == 0 && entry.key.compare_exchange_strong(key, hash)) {
+            entry.node.store(node);
+            return node;
+        }
+        if (key == hash) {
+            // The owner of the slot publishes the node right after
+            // claiming it.
+            auto stored = entry.node.load();
+            while (stored == nullptr) {
+                stored = entry.node.load();
+            }
+            return stored;
+        }
+    }
+    return node;
+}
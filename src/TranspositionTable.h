@@ -0,0 +1,78 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef TRANSPOSITIONTABLE_H_INCLUDED
+#define TRANSPOSITIONTABLE_H_INCLUDED
+
+#include "config.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+class NodeArena;
+class UCTNode;
+
+// Maps position hashes to the search node that stands for the position,
+// so that move order transpositions share one node.  The table lives in
+// the same arena as the tree and goes away with it.  It never grows:
+// once the probe window of a position is full, new positions are simply
+// not shared.
+class TranspositionTable {
+public:
+    static constexpr size_t SLOTS = 1 << 20;
+    static constexpr size_t PROBE_SLOTS = 8;
+    // Bytes taken from the arena.
+    static constexpr size_t SIZE = SLOTS * 2 * sizeof(std::uint64_t);
+
+    explicit TranspositionTable(NodeArena& arena);
+
+    // Returns the node already stored for the hash.  If there is none,
+    // stores node and returns it.
+    UCTNode* insert_or_get(std::uint64_t hash, UCTNode* node);
+
+    template <class Function>
+    void for_each(Function f) const {
+        for (auto i = size_t{0}; i < SLOTS; i++) {
+            const auto node = m_entries[i].node.load();
+            if (node != nullptr) {
+                f(m_entries[i].key.load(), node);
+            }
+        }
+    }
+
+private:
+    struct Entry {
+        std::atomic<std::uint64_t> key{0};
+        std::atomic<UCTNode*> node{nullptr};
+    };
+    Entry* m_entries;
+};
+
+#endif
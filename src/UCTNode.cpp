@@ -38,6 +38,7 @@
 #include <iterator>
 #include <limits>
 #include <numeric>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -214,7 +215,7 @@ void UCTNode::link_nodelist(std::atomic<int>& nodecount,
     m_min_psa_ratio_children = skipped_children ? min_psa_ratio : 0.0f;
 }
 
-const std::vector<UCTNodePointer>& UCTNode::get_children() const {
+const UCTNode::ChildList& UCTNode::get_children() const {
     return m_children;
 }
 
@@ -230,9 +231,13 @@ void UCTNode::virtual_loss_undo() {
     m_virtual_loss -= VIRTUAL_LOSS_COUNT;
 }
 
+UCTNode::EvalSum UCTNode::to_eval_sum(const double eval) {
+    return std::llround(eval * EVAL_SUM_ONE);
+}
+
 void UCTNode::update(const float eval) {
     // Cache values to avoid race conditions.
-    auto old_eval = static_cast<float>(m_blackevals);
+    auto old_eval = static_cast<float>(get_blackevals());
     auto old_visits = static_cast<int>(m_visits);
     // If the node has at least one visit, calculate the difference
     // between the new evaluation the average of the previous ones.
@@ -242,13 +247,49 @@ void UCTNode::update(const float eval) {
     auto new_delta = eval - (old_eval + eval) / (old_visits + 1);
     // Welford's online algorithm for calculating variance.
     auto delta = old_delta * new_delta;
-    atomic_add(m_squared_eval_diff, delta);
+    m_squared_eval_diff.fetch_add(to_eval_sum(delta),
+                                  std::memory_order_relaxed);
+}
+
+// The variance is not kept up to date this way, callers only use it
+// for the root, whose variance nobody looks at.
+void UCTNode::update_batch(const int visits, const EvalSum blackevals) {
+    m_visits += visits;
+    m_blackevals.fetch_add(blackevals, std::memory_order_relaxed);
+}
+
+UCTNode::Stats UCTNode::get_stats() const {
+    return {get_visits(), get_blackevals(),
+            m_squared_eval_diff / EVAL_SUM_ONE};
+}
+
+void UCTNode::merge_stats(const Stats& other) {
+    const auto visits = get_visits();
+    if (other.visits <= 0) {
+        return;
+    }
+    // Chan et al.'s pairwise update of Welford's sum of squares.
+    auto squared_eval_diff = other.squared_eval_diff;
+    if (visits > 0) {
+        const auto delta =
+            other.blackevals / other.visits - get_blackevals() / visits;
+        squared_eval_diff += delta * delta * visits * other.visits
+                             / (visits + other.visits);
+    }
+    m_visits += other.visits;
+    m_blackevals += to_eval_sum(other.blackevals);
+    m_squared_eval_diff += to_eval_sum(squared_eval_diff);
 }
 
 bool UCTNode::has_children() const {
     return m_min_psa_ratio_children <= 1.0f;
 }
 
+bool UCTNode::is_expanded() const {
+    const auto state = m_expand_state.load(std::memory_order_acquire);
+    return state == ExpandState::EXPANDED || state == ExpandState::LINKED;
+}
+
 // min_psa_ratio = minimum threshold of the probability of children
 // selection during expansion.
 bool UCTNode::expandable(const float min_psa_ratio) const {
@@ -271,7 +312,9 @@ void UCTNode::set_policy(const float policy) {
 }
 
 float UCTNode::get_eval_variance(const float default_var) const {
-    return m_visits > 1 ? m_squared_eval_diff / (m_visits - 1) : default_var;
+    return m_visits > 1
+        ? float(m_squared_eval_diff / EVAL_SUM_ONE / (m_visits - 1))
+        : default_var;
 }
 
 int UCTNode::get_visits() const {
@@ -326,27 +369,80 @@ float UCTNode::get_net_eval(const int tomove) const {
 }
 
 double UCTNode::get_blackevals() const {
-    return m_blackevals;
+    return m_blackevals / EVAL_SUM_ONE;
 }
 
 void UCTNode::accumulate_eval(const float eval) {
-    atomic_add(m_blackevals, double(eval));
-}
+    m_blackevals.fetch_add(to_eval_sum(eval), std::memory_order_relaxed);
+}
+
+// Child statistics gathered for uct_select_child, one array per field
+// so that the scoring loop runs over contiguous memory.
+struct SelectScratch {
+    // Lanes of the vectorized argmax.
+    static constexpr auto LANES = 8;
+    enum Kind : std::uint8_t { INACTIVE, UNVISITED, VISITED, EXPANDING };
+
+    void resize(const size_t children) {
+        // Round up so the scoring loop needs no scalar tail.
+        const auto padded = (children + LANES - 1) / LANES * LANES;
+        visits.resize(padded);
+        policy.resize(padded);
+        eval.resize(padded);
+        kind.resize(padded);
+        std::fill(begin(kind) + children, end(kind), INACTIVE);
+    }
+
+    std::vector<float> visits;
+    std::vector<float> policy;
+    std::vector<float> eval;
+    std::vector<std::uint8_t> kind;
+};
 
 UCTNode* UCTNode::uct_select_child(const int color, const bool is_root) {
     // Before selecting a child they must all be expanded.
     wait_expanded();
 
+    static thread_local SelectScratch scratch;
+    const auto children = m_children.size();
+    scratch.resize(children);
+
+    // Single pass over the children, reading each inflated node once.
     // Count parentvisits manually to avoid issues with transpositions.
     auto total_visited_policy = 0.0f;
     auto parentvisits = size_t{0};
-    for (const auto& child : m_children) {
-        if (child.valid()) {
-            parentvisits += child.get_visits();
-            if (child.get_visits() > 0) {
-                total_visited_policy += child.get_policy();
+    for (auto i = size_t{0}; i < children; i++) {
+        const auto& child = m_children[i];
+        auto kind = SelectScratch::UNVISITED;
+        auto visits = 0;
+        auto eval = 0.0f;
+        if (child.is_inflated()) {
+            const auto node = child.get();
+            visits = node->get_visits();
+            if (!node->active()) {
+                kind = SelectScratch::INACTIVE;
+            } else if (node->m_expand_state.load()
+                       == ExpandState::EXPANDING) {
+                kind = SelectScratch::EXPANDING;
+            } else if (visits > 0) {
+                kind = SelectScratch::VISITED;
+                // Transpositions share the value of their position.
+                const auto shared = node->get_transposition();
+                eval = shared ? shared->get_eval(color) : node->get_eval(color);
+            }
+            if (node->valid()) {
+                parentvisits += visits;
+                if (visits > 0) {
+                    total_visited_policy += node->get_policy();
+                }
             }
+            scratch.policy[i] = node->get_policy();
+        } else {
+            scratch.policy[i] = child.get_policy();
         }
+        scratch.visits[i] = float(visits);
+        scratch.eval[i] = eval;
+        scratch.kind[i] = kind;
     }
 
     const auto numerator = std::sqrt(
@@ -358,40 +454,57 @@ UCTNode* UCTNode::uct_select_child(const int color, const bool is_root) {
         * std::sqrt(total_visited_policy);
     // Estimated eval for unknown nodes = parent (not NN) eval - reduction
     const auto fpu_eval = get_raw_eval(color) - fpu_reduction;
-
-    auto best = static_cast<UCTNodePointer*>(nullptr);
-    auto best_value = std::numeric_limits<double>::lowest();
-
-    // Scans all children to select the best one.
-    for (auto& child : m_children) {
-        if (!child.active()) {
-            continue;
+    // Someone else is expanding these nodes, never select them
+    // if we can avoid so, because we'd block on them.
+    const auto blocked_eval = -1.0f - fpu_reduction;
+    const auto puct_scale = static_cast<float>(cfg_puct * numerator);
+    constexpr auto LOWEST = std::numeric_limits<float>::lowest();
+
+    // Branch-free argmax, every lane keeps its own best so that the
+    // compiler can turn the inner loop into vector selects.
+    constexpr auto LANES = SelectScratch::LANES;
+    float lane_value[LANES];
+    int lane_index[LANES];
+    std::fill(lane_value, lane_value + LANES, LOWEST);
+    std::fill(lane_index, lane_index + LANES, -1);
+
+    const auto visits = scratch.visits.data();
+    const auto policy = scratch.policy.data();
+    const auto eval = scratch.eval.data();
+    const auto kind = scratch.kind.data();
+    for (auto base = size_t{0}; base < scratch.kind.size(); base += LANES) {
+        for (auto lane = 0; lane < LANES; lane++) {
+            const auto i = base + lane;
+            const auto k = kind[i];
+            auto winrate = k == SelectScratch::VISITED ? eval[i] : fpu_eval;
+            winrate = k == SelectScratch::EXPANDING ? blocked_eval : winrate;
+            auto value =
+                winrate + puct_scale * policy[i] / (1.0f + visits[i]);
+            value = k == SelectScratch::INACTIVE ? LOWEST : value;
+
+            const auto better = value > lane_value[lane];
+            lane_value[lane] = better ? value : lane_value[lane];
+            lane_index[lane] = better ? int(i) : lane_index[lane];
         }
+    }
 
-        auto winrate = fpu_eval;
-        if (child.is_inflated()
-            && child->m_expand_state.load() == ExpandState::EXPANDING) {
-            // Someone else is expanding this node, never select it
-            // if we can avoid so, because we'd block on it.
-            winrate = -1.0f - fpu_reduction;
-        } else if (child.get_visits() > 0) {
-            winrate = child.get_eval(color);
+    // Ties go to the first child, like a plain scan would.
+    auto best = -1;
+    auto best_value = LOWEST;
+    for (auto lane = 0; lane < LANES; lane++) {
+        if (lane_index[lane] < 0) {
+            continue;
         }
-        const auto psa = child.get_policy();
-        const auto denom = 1.0 + child.get_visits();
-        const auto puct = cfg_puct * psa * (numerator / denom);
-        const auto value = winrate + puct;
-        assert(value > std::numeric_limits<double>::lowest());
-
-        if (value > best_value) {
-            best_value = value;
-            best = &child;
+        if (lane_value[lane] > best_value
+            || (lane_value[lane] == best_value && lane_index[lane] < best)) {
+            best_value = lane_value[lane];
+            best = lane_index[lane];
         }
     }
 
-    assert(best != nullptr);
-    best->inflate();
-    return best->get();
+    assert(best >= 0);
+    m_children[best].inflate();
+    return m_children[best].get();
 }
 
 class NodeComp
@@ -465,20 +578,89 @@ UCTNode& UCTNode::get_best_root_child(const int color) const {
     return *(ret->get());
 }
 
-size_t UCTNode::count_nodes_and_clear_expand_state() {
+size_t UCTNode::count_nodes_and_clear_expand_state(
+    std::unordered_set<const UCTNode*>* const seen) {
     auto nodecount = size_t{0};
     nodecount += m_children.size();
     if (expandable()) {
         m_expand_state = ExpandState::INITIAL;
     }
     for (auto& child : m_children) {
-        if (child.is_inflated()) {
-            nodecount += child->count_nodes_and_clear_expand_state();
+        if (child.is_inflated()
+            && (seen == nullptr || seen->insert(child.get()).second)) {
+            nodecount += child->count_nodes_and_clear_expand_state(seen);
         }
     }
     return nodecount;
 }
 
+// Copies this node and everything below it into the active arena.
+// Only to be called while no search is running.
+UCTNode* UCTNode::clone_tree(
+    const int min_visits,
+    std::unordered_map<const UCTNode*, UCTNode*>* const clones) const {
+    if (clones != nullptr) {
+        const auto it = clones->find(this);
+        if (it != clones->end()) {
+            return it->second;
+        }
+    }
+    auto node = NodeArena::get_active().construct<UCTNode>(m_move, m_policy);
+    if (clones != nullptr) {
+        clones->emplace(this, node);
+    }
+    node->m_virtual_loss = m_virtual_loss.load();
+    node->m_visits = m_visits.load();
+    node->m_net_eval = m_net_eval;
+    node->m_squared_eval_diff = m_squared_eval_diff.load();
+    node->m_blackevals = m_blackevals.load();
+    node->m_status = m_status.load();
+    node->m_expand_state = m_expand_state.load();
+    node->m_min_psa_ratio_children = m_min_psa_ratio_children.load();
+
+    if (m_visits < min_visits && get_transposition() == nullptr) {
+        // Keep the statistics, the subtree is built again if the
+        // search comes back here.
+        node->m_expand_state = ExpandState::INITIAL;
+        node->m_min_psa_ratio_children = 2.0f;
+        return node;
+    }
+
+    node->m_children.reserve(m_children.size());
+    for (const auto& child : m_children) {
+        if (child.is_inflated()) {
+            node->m_children.emplace_back(
+                child->clone_tree(min_visits, clones));
+        } else {
+            node->m_children.emplace_back(child.get_move(),
+                                          child.get_policy());
+        }
+    }
+    return node;
+}
+
+// Makes a node that was never expanded forward to the node that already
+// stands for the same position.
+void UCTNode::link_transposition(UCTNode* const shared) {
+    if (acquire_expanding()) {
+        m_children.emplace_back(shared);
+        m_min_psa_ratio_children = 0.0f;
+        m_expand_state = ExpandState::LINKED;
+    } else {
+        // Another thread is linking it.
+        while (m_expand_state.load() == ExpandState::EXPANDING) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+UCTNode* UCTNode::get_transposition() const {
+    if (m_expand_state.load() != ExpandState::LINKED) {
+        return nullptr;
+    }
+    return m_children.front().get();
+}
+
 void UCTNode::invalidate() {
     m_status = INVALID;
 }
@@ -36,10 +36,13 @@
 #include <cassert>
 #include <cstring>
 #include <memory>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "GameState.h"
 #include "Network.h"
+#include "NodeArena.h"
 #include "SMP.h"
 #include "UCTNodePointer.h"
 
@@ -49,6 +52,13 @@ public:
     // to it to encourage other CPUs to explore other parts of the
     // search tree.
     static constexpr auto VIRTUAL_LOSS_COUNT = 3;
+    using ChildList =
+        std::vector<UCTNodePointer, ArenaAllocator<UCTNodePointer>>;
+    // Evals are summed in fixed point, so that a backup is a plain
+    // fetch_add instead of a compare and swap loop.
+    using EvalSum = std::int64_t;
+    static constexpr double EVAL_SUM_ONE = 4294967296.0;
+    static EvalSum to_eval_sum(double eval);
     // Defined in UCTNode.cpp
     explicit UCTNode(int vertex, float policy);
     UCTNode() = delete;
@@ -58,14 +68,28 @@ public:
                          const GameState& state, float& eval,
                          float min_psa_ratio = 0.0f);
 
-    const std::vector<UCTNodePointer>& get_children() const;
+    const ChildList& get_children() const;
     void sort_children(int color, float lcb_min_visits);
     UCTNode& get_best_root_child(int color) const;
     UCTNode* uct_select_child(int color, bool is_root);
 
-    size_t count_nodes_and_clear_expand_state();
+    // Walks shared nodes only once when given the set of seen nodes.
+    size_t count_nodes_and_clear_expand_state(
+        std::unordered_set<const UCTNode*>* seen = nullptr);
+    // Nodes with fewer than min_visits visits are copied without their
+    // subtree.  Keeps shared nodes shared when given the map of made clones.
+    UCTNode* clone_tree(
+        int min_visits = 0,
+        std::unordered_map<const UCTNode*, UCTNode*>* clones = nullptr) const;
+    // Transpositions: the node then only keeps the statistics of the
+    // move leading to it, the position is searched under the shared node.
+    void link_transposition(UCTNode* shared);
+    UCTNode* get_transposition() const;
     bool first_visit() const;
     bool has_children() const;
+    // Whether the children are complete, so that another thread may
+    // read them while the search goes on.
+    bool is_expanded() const;
     bool expandable(float min_psa_ratio = 0.0f) const;
     void invalidate();
     void set_active(bool active);
@@ -82,6 +106,17 @@ public:
     void virtual_loss();
     void virtual_loss_undo();
     void update(float eval);
+    // Backs up visits whose evals were summed elsewhere.
+    void update_batch(int visits, EvalSum blackevals);
+    // Search statistics, to combine searches of the same node by
+    // several processes.  Merging is not safe during a search.
+    struct Stats {
+        int visits;
+        double blackevals;
+        double squared_eval_diff;
+    };
+    Stats get_stats() const;
+    void merge_stats(const Stats& other);
     float get_eval_lcb(int color) const;
 
     // Defined in UCTNodeRoot.cpp, only to be called on m_root in UCTSearch
@@ -91,7 +126,7 @@ public:
 
     UCTNode* get_first_child() const;
     UCTNode* get_nopass_child(FastState& state) const;
-    std::unique_ptr<UCTNode> find_child(int move);
+    UCTNode* find_child(int move);
     void inflate_all_children();
 
     void clear_expand_state();
@@ -126,8 +161,8 @@ private:
     // Variable used for calculating variance of evaluations.
     // Initialized to small non-zero value to avoid accidental zero variances
     // at low visits.
-    std::atomic<float> m_squared_eval_diff{1e-4f};
-    std::atomic<double> m_blackevals{0.0};
+    std::atomic<EvalSum> m_squared_eval_diff{EvalSum(1e-4 * EVAL_SUM_ONE)};
+    std::atomic<EvalSum> m_blackevals{0};
     std::atomic<Status> m_status{ACTIVE};
 
     // m_expand_state acts as the lock for m_children.
@@ -144,12 +179,16 @@ private:
         // expansion done.  m_children cannot be modified on a multi-thread
         // context, until node is destroyed.
         EXPANDED,
+
+        // the position is searched under another node, reached by a
+        // different move order.  m_children holds just that node.
+        LINKED,
     };
     std::atomic<ExpandState> m_expand_state{ExpandState::INITIAL};
 
     // Tree data
     std::atomic<float> m_min_psa_ratio_children{2.0f};
-    std::vector<UCTNodePointer> m_children;
+    ChildList m_children;
 
     //  m_expand_state manipulation methods
     // INITIAL -> EXPANDING
@@ -36,31 +36,16 @@
 
 #include "UCTNode.h"
 
-std::atomic<size_t> UCTNodePointer::m_tree_size = {0};
+#include "NodeArena.h"
 
+// The tree is only ever allocated from arenas, so this is exact,
+// including the slack at the end of partly used blocks.
 size_t UCTNodePointer::get_tree_size() {
-    return m_tree_size.load();
+    return NodeArena::get_total_size();
 }
 
-void UCTNodePointer::increment_tree_size(const size_t sz) {
-    m_tree_size += sz;
-}
-
-void UCTNodePointer::decrement_tree_size(const size_t sz) {
-    assert(UCTNodePointer::m_tree_size >= sz);
-    m_tree_size -= sz;
-}
-
-// Deallocates pointer's memory and reduces the tree's size.
-UCTNodePointer::~UCTNodePointer() {
-    auto sz = sizeof(UCTNodePointer);
-    auto v = m_data.load();
-    if (is_inflated(v)) {
-        delete read_ptr(v);
-        sz += sizeof(UCTNode);
-    }
-    decrement_tree_size(sz);
-}
+// The node and its memory stay with the arena.
+UCTNodePointer::~UCTNodePointer() = default;
 
 UCTNodePointer::UCTNodePointer(UCTNodePointer&& n) {
     //Exchange values between n and the new node.
@@ -71,7 +56,6 @@ UCTNodePointer::UCTNodePointer(UCTNodePointer&& n) {
 #else
     assert(v == INVALID);
 #endif
-    increment_tree_size(sizeof(UCTNodePointer));
 }
 
 UCTNodePointer::UCTNodePointer(const std::int16_t vertex, const float policy) {
@@ -85,23 +69,22 @@ UCTNodePointer::UCTNodePointer(const std::int16_t vertex, const float policy) {
     // Moves i_vertix by 16 bits (to the central part of m_data).
     m_data = (static_cast<std::uint64_t>(i_policy) << 32)
            | (static_cast<std::uint64_t>(i_vertex) << 16);
-    increment_tree_size(sizeof(UCTNodePointer));
+}
+
+UCTNodePointer::UCTNodePointer(UCTNode* const node) {
+    auto v = reinterpret_cast<std::uint64_t>(node);
+    assert((v & 3ULL) == 0);
+    m_data = v | POINTER;
 }
 
 UCTNodePointer& UCTNodePointer::operator=(UCTNodePointer&& n) {
     auto nv = std::atomic_exchange(&n.m_data, INVALID);
-    auto v = std::atomic_exchange(&m_data, nv);
-
-    if (is_inflated(v)) {
-        decrement_tree_size(sizeof(UCTNode));
-        delete read_ptr(v);
-    }
+    std::atomic_exchange(&m_data, nv);
     return *this;
 }
 
 UCTNode* UCTNodePointer::release() {
     auto v = std::atomic_exchange(&m_data, INVALID);
-    decrement_tree_size(sizeof(UCTNode));
     return read_ptr(v);
 }
 
@@ -112,17 +95,16 @@ void UCTNodePointer::inflate() const {
         if (is_inflated(v)) return;
 
         auto v2 = reinterpret_cast<std::uint64_t>(
-            new UCTNode(read_vertex(v), read_policy(v)));
+            NodeArena::get_active().construct<UCTNode>(read_vertex(v),
+                                                       read_policy(v)));
         assert((v2 & 3ULL) == 0);
         v2 |= POINTER;
         bool success = m_data.compare_exchange_strong(v, v2);
         if (success) {
-            increment_tree_size(sizeof(UCTNode));
             return;
         } else {
             // this means that somebody else also modified this instance.
-            // Try again next time
-            delete read_ptr(v2);
+            // Try again next time, the arena keeps the unused node.
         }
     }
 }
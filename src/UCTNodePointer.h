@@ -53,16 +53,16 @@ class UCTNode;
 // All methods should be thread-safe except destructor and when
 // the instanced is 'moved from'.
 
+// Nodes are placed in the active NodeArena and are left to it when the
+// pointer goes away.  With transpositions a node can have several
+// pointers to it, so none of them owns it.
+
 class UCTNodePointer {
 private:
     static constexpr std::uint64_t INVALID = 2;
     static constexpr std::uint64_t POINTER = 1;
     static constexpr std::uint64_t UNINFLATED = 0;
 
-    static std::atomic<size_t> m_tree_size;
-    static void increment_tree_size(size_t sz);
-    static void decrement_tree_size(size_t sz);
-
     // the raw storage used here.
     // if bit [1:0] is 1, m_data is the actual pointer.
     // if bit [1:0] is 0, bit [31:16] is the vertex value, bit [63:32] is the policy
@@ -101,6 +101,7 @@ public:
     ~UCTNodePointer();
     UCTNodePointer(UCTNodePointer&& n);
     UCTNodePointer(std::int16_t vertex, float policy);
+    explicit UCTNodePointer(UCTNode* node);
     UCTNodePointer(const UCTNodePointer&) = delete;
 
     bool is_inflated() const {
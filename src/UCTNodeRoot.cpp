@@ -204,12 +204,12 @@ UCTNode* UCTNode::get_nopass_child(FastState& state) const {
 }
 
 // Used to find new root in UCTSearch.
-std::unique_ptr<UCTNode> UCTNode::find_child(const int move) {
+UCTNode* UCTNode::find_child(const int move) {
     for (auto& child : m_children) {
         if (child.get_move() == move) {
             // no guarantee that this is a non-inflated node
             child.inflate();
-            return std::unique_ptr<UCTNode>(child.release());
+            return child.get();
         }
     }
 
@@ -30,15 +30,20 @@
 #include "config.h"
 
 #include <algorithm>
+#include <array>
 #include <boost/format.hpp>
 #include <boost/scope_exit.hpp>
 #include <cassert>
+#include <chrono>
 #include <cmath>
 #include <cstddef>
 #include <functional>
 #include <limits>
 #include <memory>
+#include <sstream>
 #include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "UCTSearch.h"
 
@@ -59,6 +64,9 @@ using namespace Utils;
 
 constexpr int UCTSearch::UNLIMITED_PLAYOUTS;
 
+// How often the thread controlling a search wakes up while it runs.
+constexpr auto SEARCH_TICK = std::chrono::milliseconds(10);
+
 class OutputAnalysisData {
 public:
     OutputAnalysisData(std::string move, const int visits, const float winrate,
@@ -94,6 +102,20 @@ public:
         return tmp;
     }
 
+    std::string get_json_string() const {
+        auto pv = std::string{};
+        auto in = std::istringstream{m_pv};
+        auto move = std::string{};
+        while (in >> move) {
+            pv += (pv.empty() ? "\"" : ",\"") + move + "\"";
+        }
+        return str(boost::format("{\"move\":\"%s\",\"visits\":%d,"
+                                 "\"winrate\":%.4f,\"prior\":%.4f,"
+                                 "\"lcb\":%.4f,\"pv\":[%s]}")
+                   % m_move % m_visits % m_winrate % m_policy_prior
+                   % std::max(0.0f, m_lcb) % pv);
+    }
+
     // Checks if the values have exceeded the LCB ratio.
     // If at least one has not exceeded, checks if they have the same
     // visits. In this case, it checks winrate.  If they have
@@ -128,8 +150,25 @@ UCTSearch::UCTSearch(GameState& g, Network& network)
     : m_rootstate(g), m_network(network) {
     set_playout_limit(cfg_max_playouts);
     set_visit_limit(cfg_max_visits);
+    set_thread_pool(thread_pool, cfg_num_threads);
 
-    m_root = std::make_unique<UCTNode>(FastBoard::PASS, 0.0f);
+    reset_tree();
+    if (!cfg_search_workers.empty()) {
+        m_distributed =
+            std::make_unique<DistributedSearch>(cfg_search_workers);
+    }
+}
+
+// Drops the whole tree at once and starts over from an empty root.
+void UCTSearch::reset_tree() {
+    m_arena = std::make_unique<NodeArena>();
+    NodeArena::set_active(m_arena.get());
+    m_root = m_arena->construct<UCTNode>(FastBoard::PASS, 0.0f);
+    m_transpositions = nullptr;
+    m_uncollectable_size = 0;
+    if (cfg_transpositions) {
+        m_transpositions = m_arena->construct<TranspositionTable>(*m_arena);
+    }
 }
 
 bool UCTSearch::advance_to_new_rootstate() {
@@ -163,41 +202,28 @@ bool UCTSearch::advance_to_new_rootstate() {
         return false;
     }
 
-    // Make sure that the nodes we destroyed the previous move are
-    // in fact destroyed.
-    while (!m_delete_futures.empty()) {
-        m_delete_futures.front().wait_all();
-        m_delete_futures.pop_front();
-    }
-
     // Try to replay moves advancing m_root
     for (auto i = 0; i < depth; i++) {
-        ThreadGroup tg(thread_pool);
-
         // Test that contains the state of the root, plays a new move
         // and updates the state.
         test->forward_move();
         // The move is saved.
         const auto move = test->get_last_move();
 
-        // The old root is "moved" into the variable oldroot.
-        auto oldroot = std::move(m_root);
         // The child of the old root becomes the new root.
         // The child is the one that corresponds to the move played.
-        m_root = oldroot->find_child(move);
-
-        // Lazy tree destruction.  Instead of calling the destructor of the
-        // old root node on the main thread, send the old root to a separate
-        // thread and destroy it from the child thread.  This will save a
-        // bit of time when dealing with large trees.
-        auto p = oldroot.release();
-        tg.add_task([p]() { delete p; });
-        m_delete_futures.push_back(std::move(tg));
+        // The rest of the old tree stays in the arena for now.
+        m_root = m_root->find_child(move);
 
         if (!m_root) {
             // Tree hasn't been expanded this far
             return false;
         }
+        // A transposition only forwards to the node that stands for
+        // its position, which is the one to search from.
+        if (const auto shared = m_root->get_transposition()) {
+            m_root = shared;
+        }
         // Update m_last_rootstate with the played move.
         m_last_rootstate->play_move(move);
     }
@@ -209,29 +235,144 @@ bool UCTSearch::advance_to_new_rootstate() {
         return false;
     }
 
+    // Copy the subtree we keep into a fresh arena and free the old one
+    // in one go, rather than destroying the discarded nodes one by one.
+    compact_tree();
+
     return true;
 }
 
+// Copies the tree below m_root into a fresh arena and frees the old
+// one.  Only to be called while no search is running.
+void UCTSearch::compact_tree(const int min_visits) {
+    auto arena = std::make_unique<NodeArena>();
+    NodeArena::set_active(arena.get());
+    if (m_transpositions) {
+        // Clone every shared node once, then point the new table at
+        // the clones of the nodes that are still reachable.
+        auto clones = std::unordered_map<const UCTNode*, UCTNode*>{};
+        m_root = m_root->clone_tree(min_visits, &clones);
+        const auto old_transpositions = m_transpositions;
+        m_transpositions = arena->construct<TranspositionTable>(*arena);
+        old_transpositions->for_each([&](const auto hash, const auto node) {
+            const auto it = clones.find(node);
+            if (it != end(clones)) {
+                m_transpositions->insert_or_get(hash, it->second);
+            }
+        });
+    } else {
+        m_root = m_root->clone_tree(min_visits);
+    }
+    m_arena = std::move(arena);
+    m_uncollectable_size = 0;
+}
+
+// Smallest visit count a node needs to keep its subtree, so that
+// what is kept fits in bytes.  Visits only shrink going down the tree,
+// so a node survives when its parent does.
+int UCTSearch::collect_threshold(const size_t bytes) const {
+    // Bytes a subtree would keep, by log2 of the visits of its parent.
+    auto kept = std::array<size_t, 32>{};
+    auto seen = std::unordered_set<const UCTNode*>{};
+    std::function<void(const UCTNode&)> traverse = [&](const UCTNode& node) {
+        // Workers may be filling in the children of the other nodes.
+        if (!node.is_expanded()) {
+            return;
+        }
+        const auto& children = node.get_children();
+        auto size = children.size() * sizeof(UCTNodePointer);
+        for (const auto& child : children) {
+            if (child.is_inflated()
+                && (!m_transpositions || seen.insert(child.get()).second)) {
+                size += sizeof(UCTNode);
+                traverse(*child.get());
+            }
+        }
+        const auto visits = std::max(node.get_visits(), 1);
+        kept[std::ilogb(visits)] += size;
+    };
+    traverse(*m_root);
+
+    auto total = size_t{0};
+    for (auto bucket = int(kept.size()) - 1; bucket >= 0; bucket--) {
+        if (total + kept[bucket] > bytes) {
+            return int(std::min(std::int64_t{1} << (bucket + 1),
+                                std::int64_t{m_root->get_visits()}));
+        }
+        total += kept[bucket];
+    }
+    return 0;
+}
+
+// Frees cold subtrees when the tree is close to its memory limit, so
+// that long searches can go on within a fixed budget.  The nodes that
+// are dropped keep their statistics.
+void UCTSearch::collect_garbage(ThreadGroup& tg) {
+    const auto tree_size = m_arena->size();
+    if (tree_size < cfg_max_tree_size / 10 * 9
+        || tree_size <= m_uncollectable_size) {
+        return;
+    }
+
+    // Pick what to drop while the search goes on.  Aim for half the
+    // budget, not counting the transposition table.
+    auto budget = cfg_max_tree_size / 2;
+    if (m_transpositions) {
+        budget -= std::min(budget, TranspositionTable::SIZE);
+    }
+    const auto min_visits = collect_threshold(budget);
+    if (min_visits == 0) {
+        // Nothing to drop, leave it to get_min_psa_ratio().
+        m_uncollectable_size = tree_size;
+        return;
+    }
+
+    // Copying needs the tree to hold still.
+    m_run = false;
+    m_network.drain_evals();
+    tg.wait_all();
+    m_network.resume_evals();
+    merge_root_stats();
+
+    compact_tree(min_visits);
+    m_nodes = count_nodes_and_clear_expand_state();
+    myprintf("Collected search tree: %d -> %d MiB, kept subtrees "
+             "with %d+ visits\n",
+             int(tree_size / MiB),
+             int(m_arena->size() / MiB),
+             min_visits);
+
+    // The workers may have reached the playout limit meanwhile.
+    if (m_playouts >= m_stop_playouts) {
+        return;
+    }
+    m_run = true;
+    for (auto i = size_t{0}; i < m_num_threads; i++) {
+        tg.add_task(UCTWorker(m_rootstate, this, m_root));
+    }
+}
+
 void UCTSearch::update_root() {
     // Definition of m_playouts is playouts per search call.
     // So reset this count now.
     m_playouts = 0;
+    NodeArena::set_active(m_arena.get());
 
 #ifndef NDEBUG
     // Records the number of nodes in the tree.
-    auto start_nodes = m_root->count_nodes_and_clear_expand_state();
+    auto start_nodes = count_nodes_and_clear_expand_state();
 #endif
 
     // If the advancement to the new root doesn't work, or if the new
     // root is null then create a new standard root node.
     if (!advance_to_new_rootstate() || !m_root) {
-        m_root = std::make_unique<UCTNode>(FastBoard::PASS, 0.0f);
+        reset_tree();
     }
     // Clear last_rootstate to prevent accidental use.
     m_last_rootstate.reset(nullptr);
 
     // Check how big our search tree (reused or new) is.
-    m_nodes = m_root->count_nodes_and_clear_expand_state();
+    m_nodes = count_nodes_and_clear_expand_state();
 
 #ifndef NDEBUG
     if (m_nodes > 0) {
@@ -242,10 +383,18 @@ void UCTSearch::update_root() {
 #endif
 }
 
+size_t UCTSearch::count_nodes_and_clear_expand_state() {
+    if (m_transpositions) {
+        auto seen = std::unordered_set<const UCTNode*>{};
+        return m_root->count_nodes_and_clear_expand_state(&seen);
+    }
+    return m_root->count_nodes_and_clear_expand_state();
+}
+
 float UCTSearch::get_min_psa_ratio() const {
     // Checks memory based on the maximum memory of the tree.
     const auto mem_full =
-        UCTNodePointer::get_tree_size() / static_cast<float>(cfg_max_tree_size);
+        m_arena->size() / static_cast<float>(cfg_max_tree_size);
     // If we are halfway through our memory budget, start trimming
     // moves with very low policy priors.
     if (mem_full > 0.5f) {
@@ -268,13 +417,29 @@ SearchResult UCTSearch::play_simulation(GameState& currstate,
     auto result = SearchResult{};
     auto new_node = false;
 
-    node->virtual_loss();
+    // Nothing selects the root, so it takes no virtual loss.
+    const auto is_root = node == m_root;
+    if (!is_root) {
+        node->virtual_loss();
+    }
 
     // This will undo virtual loss even if something throws an exception.
-    BOOST_SCOPE_EXIT(node) {
-        node->virtual_loss_undo();
+    BOOST_SCOPE_EXIT(node, is_root) {
+        if (!is_root) {
+            node->virtual_loss_undo();
+        }
     } BOOST_SCOPE_EXIT_END
 
+    // Search the position under the node shared by all move orders,
+    // and count the visit for this move too.
+    if (const auto shared = node->get_transposition()) {
+        result = play_simulation(currstate, shared);
+        if (result.valid()) {
+            node->update(result.eval());
+        }
+        return result;
+    }
+
     // If the node is expandable but there have been more than 2
     // passes, then interrupt and return the result until that point.
     if (node->expandable()) {
@@ -302,11 +467,19 @@ SearchResult UCTSearch::play_simulation(GameState& currstate,
     // The node has children and a valid result wasn't returned.
     // Select the next child to be explored (the best one).
     if (node->has_children() && !result.valid()) {
-        auto next = node->uct_select_child(color, node == m_root.get());
+        auto next = node->uct_select_child(color, is_root);
         auto move = next->get_move();
 
         // Play the move.
         currstate.play_move(move);
+        if (m_transpositions && next->first_visit()) {
+            // Link to the node of this position, if there is one.
+            const auto shared = m_transpositions->insert_or_get(
+                currstate.board.get_hash(), next);
+            if (shared != next) {
+                next->link_transposition(shared);
+            }
+        }
         if (move != FastBoard::PASS && currstate.superko()) {
             next->invalidate();
         } else {
@@ -317,12 +490,51 @@ SearchResult UCTSearch::play_simulation(GameState& currstate,
 
     // New node was updated in create_children.
     if (result.valid() && !new_node) {
-        node->update(result.eval());
+        if (is_root) {
+            backup_root(result.eval());
+        } else {
+            node->update(result.eval());
+        }
     }
 
     return result;
 }
 
+void UCTSearch::backup_root(const float eval) {
+    static std::atomic<int> next_shard{0};
+    thread_local auto shard = next_shard++ % ROOT_SHARDS;
+    m_root_shards[shard].visits.fetch_add(1, std::memory_order_relaxed);
+    m_root_shards[shard].blackevals.fetch_add(UCTNode::to_eval_sum(eval),
+                                              std::memory_order_relaxed);
+}
+
+// Folds the root backups into the root node.  Called from the thread
+// that controls the search, before it looks at the root.
+void UCTSearch::merge_root_stats() {
+    for (auto& shard : m_root_shards) {
+        const auto visits = shard.visits.exchange(0);
+        const auto blackevals = shard.blackevals.exchange(0);
+        if (visits > 0) {
+            m_root->update_batch(visits, blackevals);
+        }
+    }
+}
+
+// Adds the root children statistics of searches by other processes.
+void UCTSearch::add_remote_stats(const DistributedSearch::RootStats& stats) {
+    auto visits = 0;
+    auto blackevals = 0.0;
+    for (const auto& child : stats) {
+        const auto node = m_root->find_child(child.move);
+        if (node != nullptr) {
+            node->merge_stats(child.stats);
+            visits += child.stats.visits;
+            blackevals += child.stats.blackevals;
+        }
+    }
+    m_root->update_batch(visits, UCTNode::to_eval_sum(blackevals));
+}
+
 void UCTSearch::dump_stats(const FastState& state, UCTNode& parent) {
     // Doesn't print anything if "quiet" mode is activated, or if the
     // parent doesn't have any children.
@@ -370,12 +582,13 @@ void UCTSearch::dump_stats(const FastState& state, UCTNode& parent) {
     tree_stats(parent);
 }
 
-void UCTSearch::output_analysis(const FastState& state, const UCTNode& parent) {
+std::vector<OutputAnalysisData> UCTSearch::get_sorted_analysis(
+    const FastState& state, const UCTNode& parent) {
     // We need to make a copy of the data before sorting
     auto sortable_data = std::vector<OutputAnalysisData>();
 
     if (!parent.has_children()) {
-        return;
+        return sortable_data;
     }
 
     const auto color = state.get_to_move();
@@ -410,6 +623,14 @@ void UCTSearch::output_analysis(const FastState& state, const UCTNode& parent) {
     }
     // Sort array to decide order
     std::stable_sort(rbegin(sortable_data), rend(sortable_data));
+    return sortable_data;
+}
+
+void UCTSearch::output_analysis(const FastState& state, const UCTNode& parent) {
+    const auto sortable_data = get_sorted_analysis(state, parent);
+    if (sortable_data.empty()) {
+        return;
+    }
 
     auto i = 0;
     // Output analysis data in gtp stream
@@ -423,12 +644,27 @@ void UCTSearch::output_analysis(const FastState& state, const UCTNode& parent) {
     gtp_printf_raw("\n");
 }
 
+std::string UCTSearch::get_analysis_json() {
+    const auto color = m_rootstate.get_to_move();
+    auto moves = std::string{};
+    for (const auto& data : get_sorted_analysis(m_rootstate, *m_root)) {
+        moves += (moves.empty() ? "" : ",") + data.get_json_string();
+    }
+    const auto visits = m_root->get_visits();
+    const auto winrate = visits ? m_root->get_raw_eval(color) : 0.5f;
+    return str(boost::format("{\"visits\":%d,\"winrate\":%.4f,"
+                             "\"moves\":[%s]}")
+               % visits % winrate % moves);
+}
+
 void UCTSearch::tree_stats(const UCTNode& node) {
     size_t nodes = 0;
     size_t non_leaf_nodes = 0;
     size_t depth_sum = 0;
     size_t max_depth = 0;
     size_t children_count = 0;
+    // Shared nodes are only walked once.
+    auto seen = std::unordered_set<const UCTNode*>{};
 
     std::function<void(const UCTNode& node, size_t)> traverse =
         [&](const UCTNode& node, size_t depth) {
@@ -442,7 +678,9 @@ void UCTSearch::tree_stats(const UCTNode& node) {
             for (const auto& child : node.get_children()) {
                 if (child.get_visits() > 0) {
                     children_count += 1;
-                    traverse(*(child.get()), depth + 1);
+                    if (!m_transpositions || seen.insert(child.get()).second) {
+                        traverse(*(child.get()), depth + 1);
+                    }
                 } else {
                     nodes += 1;
                     depth_sum += depth + 1;
@@ -662,6 +900,10 @@ int UCTSearch::get_best_move(const passflag_t passflag) {
 }
 
 std::string UCTSearch::get_pv(FastState& state, const UCTNode& parent) {
+    if (const auto shared = parent.get_transposition()) {
+        return get_pv(state, *shared);
+    }
+
     if (!parent.has_children()) {
         return std::string();
     }
@@ -702,7 +944,7 @@ std::string UCTSearch::get_analysis(const int playouts) {
 }
 
 bool UCTSearch::is_running() const {
-    return m_run && UCTNodePointer::get_tree_size() < cfg_max_tree_size;
+    return m_run && m_arena->size() < cfg_max_tree_size;
 }
 
 // Remaining playouts based on the elapsed and remaining time.
@@ -811,7 +1053,19 @@ bool UCTSearch::stop_thinking(const int elapsed_centis,
            || elapsed_centis >= time_for_move;
 }
 
+UCTWorker::UCTWorker(GameState& state, UCTSearch* const search,
+                     UCTNode* const root)
+    : m_rootstate(state),
+      m_search(search),
+      m_root(root),
+      m_arena(NodeArena::get_active()),
+      m_analyze_tags(cfg_analyze_tags) {}
+
 void UCTWorker::operator()() {
+    // The thread may be helping out in the middle of another search.
+    const auto previous_arena = NodeArena::set_active(&m_arena);
+    const auto previous_tags = cfg_analyze_tags;
+    cfg_analyze_tags = m_analyze_tags;
     try {
         do {
             auto currstate = std::make_unique<GameState>(m_rootstate);
@@ -823,10 +1077,43 @@ void UCTWorker::operator()() {
     } catch (NetworkHaltException&) {
         // intentionally empty
     }
+    cfg_analyze_tags = previous_tags;
+    NodeArena::set_active(previous_arena);
+}
+
+void UCTSearch::set_tick_callback(TickCallback callback) {
+    m_tick_callback = std::move(callback);
 }
 
 void UCTSearch::increment_playouts() {
-    m_playouts++;
+    if (++m_playouts >= m_stop_playouts) {
+        stop_search();
+    }
+}
+
+// The root visits only grow by the playouts of this search, so both
+// limits come down to a playout count.
+void UCTSearch::set_stop_playouts() {
+    m_stop_playouts =
+        std::min(m_maxplayouts, m_maxvisits - m_root->get_visits());
+}
+
+// Makes the workers finish their playout and exit, and wakes up the
+// thread controlling the search.
+void UCTSearch::stop_search() {
+    {
+        std::lock_guard<std::mutex> lock(m_stop_mutex);
+        m_run = false;
+    }
+    m_stop_condvar.notify_all();
+}
+
+// Sleeps until the search is stopped or until the given time.  Returns
+// whether the search was stopped.
+bool UCTSearch::wait_for_stop(
+    const std::chrono::steady_clock::time_point until) {
+    std::unique_lock<std::mutex> lock(m_stop_mutex);
+    return m_stop_condvar.wait_until(lock, until, [this] { return !m_run; });
 }
 
 int UCTSearch::think(const int color, const passflag_t passflag) {
@@ -848,19 +1135,33 @@ int UCTSearch::think(const int color, const passflag_t passflag) {
     // create a sorted list of legal moves (make sure we
     // play something legal and decent even in time trouble)
     m_root->prepare_root_node(m_network, color, m_nodes, m_rootstate);
+    set_stop_playouts();
+    if (m_tick_callback) {
+        m_tick_callback(*m_root, false);
+    }
+    if (m_distributed) {
+        m_distributed->start(m_rootstate, color, m_maxvisits, m_maxplayouts);
+    }
 
     m_run = true;
-    int cpus = cfg_num_threads;
-    ThreadGroup tg(thread_pool);
-    for (int i = 0; i < cpus; i++) {
-        tg.add_task(UCTWorker(m_rootstate, this, m_root.get()));
+    ThreadGroup tg(*m_thread_pool);
+    for (auto i = size_t{0}; i < m_num_threads; i++) {
+        tg.add_task(UCTWorker(m_rootstate, this, m_root));
     }
 
+    // The workers stop the search when they reach the visit or playout
+    // limit, the time limit has its own deadline.  In between we wake up
+    // every tick for output, time management and garbage collection.
+    const auto deadline = std::chrono::steady_clock::now()
+                          + std::chrono::milliseconds(time_for_move) * 10;
     auto keeprunning = true;
     auto last_update = 0;
     auto last_output = 0;
     do {
-        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        const auto tick = std::chrono::steady_clock::now() + SEARCH_TICK;
+        keeprunning = !wait_for_stop(std::min(tick, deadline));
+        keeprunning &= std::chrono::steady_clock::now() < deadline;
+        merge_root_stats();
 
         Time elapsed;
         int elapsed_centis = Time::timediff_centis(start, elapsed);
@@ -880,9 +1181,15 @@ int UCTSearch::think(const int color, const passflag_t passflag) {
             last_update = elapsed_centis;
             myprintf("%s\n", get_analysis(m_playouts.load()).c_str());
         }
-        keeprunning = is_running();
+        if (keeprunning) {
+            collect_garbage(tg);
+        }
+        keeprunning &= is_running();
         keeprunning &= !stop_thinking(elapsed_centis, time_for_move);
         keeprunning &= have_alternate_moves(elapsed_centis, time_for_move);
+        if (m_tick_callback) {
+            keeprunning &= m_tick_callback(*m_root, false);
+        }
     } while (keeprunning);
 
     // Make sure to post at least once.
@@ -895,6 +1202,13 @@ int UCTSearch::think(const int color, const passflag_t passflag) {
     m_network.drain_evals();
     tg.wait_all();
     m_network.resume_evals();
+    merge_root_stats();
+    if (m_tick_callback) {
+        m_tick_callback(*m_root, true);
+    }
+    if (m_distributed) {
+        add_remote_stats(m_distributed->finish());
+    }
 
     // Reactivate all pruned root children.
     for (const auto& node : m_root->get_children()) {
@@ -955,17 +1269,21 @@ void UCTSearch::ponder() {
 
     m_root->prepare_root_node(m_network, m_rootstate.board.get_to_move(),
                               m_nodes, m_rootstate);
+    set_stop_playouts();
 
     m_run = true;
-    ThreadGroup tg(thread_pool);
-    for (auto i = size_t{0}; i < cfg_num_threads; i++) {
-        tg.add_task(UCTWorker(m_rootstate, this, m_root.get()));
+    ThreadGroup tg(*m_thread_pool);
+    for (auto i = size_t{0}; i < m_num_threads; i++) {
+        tg.add_task(UCTWorker(m_rootstate, this, m_root));
     }
     Time start;
     auto keeprunning = true;
     auto last_output = 0;
     do {
-        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        // Also polls for input every tick.
+        keeprunning = !wait_for_stop(std::chrono::steady_clock::now()
+                                     + SEARCH_TICK);
+        merge_root_stats();
         if (cfg_analyze_tags.interval_centis()) {
             Time elapsed;
             int elapsed_centis = Time::timediff_centis(start, elapsed);
@@ -975,7 +1293,10 @@ void UCTSearch::ponder() {
                 output_analysis(m_rootstate, *m_root);
             }
         }
-        keeprunning = is_running();
+        if (keeprunning) {
+            collect_garbage(tg);
+        }
+        keeprunning &= is_running();
         keeprunning &= !stop_thinking(0, 1);
     } while (!Utils::input_pending() && keeprunning);
 
@@ -989,6 +1310,7 @@ void UCTSearch::ponder() {
     m_network.drain_evals();
     tg.wait_all();
     m_network.resume_evals();
+    merge_root_stats();
 
     // Display search info.
     myprintf("\n");
@@ -1016,3 +1338,9 @@ void UCTSearch::set_visit_limit(const int visits) {
     // Limit to type max / 2 to prevent overflow when multithreading.
     m_maxvisits = std::min(visits, UNLIMITED_PLAYOUTS);
 }
+
+void UCTSearch::set_thread_pool(Utils::ThreadPool& pool,
+                                const size_t threads) {
+    m_thread_pool = &pool;
+    m_num_threads = threads;
+}
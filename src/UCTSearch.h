@@ -30,18 +30,27 @@
 #ifndef UCTSEARCH_H_INCLUDED
 #define UCTSEARCH_H_INCLUDED
 
+#include <array>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
 #include <future>
-#include <list>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <tuple>
+#include <vector>
 
+#include "DistributedSearch.h"
 #include "FastBoard.h"
 #include "FastState.h"
 #include "GameState.h"
 #include "Network.h"
+#include "NodeArena.h"
 #include "ThreadPool.h"
+#include "TranspositionTable.h"
 #include "UCTNode.h"
 
 class SearchResult {
@@ -78,6 +87,9 @@ namespace TimeManagement {
     };
 };
 
+class AnalyzeTags;
+class OutputAnalysisData;
+
 class UCTSearch {
 public:
     /*
@@ -114,10 +126,20 @@ public:
     int think(int color, passflag_t passflag = NORMAL);
     void set_playout_limit(int playouts);
     void set_visit_limit(int visits);
+    // Searches with this many workers from the pool, instead of
+    // --threads of the global one.
+    void set_thread_pool(Utils::ThreadPool& pool, size_t threads);
     void ponder();
     bool is_running() const;
     void increment_playouts();
+    // Called with the root when think() starts, before any playout, on
+    // every tick, and once more with done set after the search stopped.
+    // think() stops when it returns false.
+    using TickCallback = std::function<bool(const UCTNode& root, bool done)>;
+    void set_tick_callback(TickCallback callback);
     std::string explain_last_think() const;
+    // The root moves of the last think() as a JSON object, best first.
+    std::string get_analysis_json();
     SearchResult play_simulation(GameState& currstate, UCTNode* node);
 
 private:
@@ -132,36 +154,76 @@ private:
     size_t prune_noncontenders(int color, int elapsed_centis = 0,
                                int time_for_move = 0, bool prune = true);
     bool stop_thinking(int elapsed_centis = 0, int time_for_move = 0) const;
+    void set_stop_playouts();
+    void stop_search();
+    bool wait_for_stop(std::chrono::steady_clock::time_point until);
     int get_best_move(passflag_t passflag);
     void update_root();
+    void reset_tree();
+    size_t count_nodes_and_clear_expand_state();
+    void compact_tree(int min_visits = 0);
+    int collect_threshold(size_t bytes) const;
+    void collect_garbage(Utils::ThreadGroup& tg);
+    void backup_root(float eval);
+    void merge_root_stats();
+    void add_remote_stats(const DistributedSearch::RootStats& stats);
     bool advance_to_new_rootstate();
+    std::vector<OutputAnalysisData> get_sorted_analysis(
+        const FastState& state, const UCTNode& parent);
     void output_analysis(const FastState& state, const UCTNode& parent);
 
     GameState& m_rootstate;
     std::unique_ptr<GameState> m_last_rootstate;
-    std::unique_ptr<UCTNode> m_root;
+    // Holds every node of the tree, m_root included.
+    std::unique_ptr<NodeArena> m_arena;
+    UCTNode* m_root{nullptr};
+    // Shared nodes by position, only when searching a graph.
+    TranspositionTable* m_transpositions{nullptr};
+    // Tree size at which collecting garbage last found nothing to drop.
+    size_t m_uncollectable_size{0};
     std::atomic<int> m_nodes{0};
     std::atomic<int> m_playouts{0};
+    // Backups into the root, spread over cache lines so that threads
+    // don't all write the same one.  The controlling thread merges them
+    // into m_root every tick, before it reads the root.  The workers only
+    // read the root eval for the first play urgency of unvisited root
+    // children, and that value may be up to one tick old: summing all
+    // shards on every root selection would cost more than it gains.
+    struct alignas(64) RootShard {
+        std::atomic<int> visits{0};
+        std::atomic<UCTNode::EvalSum> blackevals{0};
+    };
+    static constexpr auto ROOT_SHARDS = 64;
+    std::array<RootShard, ROOT_SHARDS> m_root_shards;
     std::atomic<bool> m_run{false};
+    // Playout count at which the workers stop the search by themselves.
+    int m_stop_playouts{0};
+    std::mutex m_stop_mutex;
+    std::condition_variable m_stop_condvar;
     int m_maxplayouts;
     int m_maxvisits;
+    Utils::ThreadPool* m_thread_pool;
+    size_t m_num_threads;
     std::string m_think_output;
-
-    std::list<Utils::ThreadGroup> m_delete_futures;
+    TickCallback m_tick_callback;
+    // Search workers in other processes, if any.
+    std::unique_ptr<DistributedSearch> m_distributed;
 
     Network& m_network;
 };
 
 class UCTWorker {
 public:
-    UCTWorker(GameState& state, UCTSearch* const search, UCTNode* const root)
-        : m_rootstate(state), m_search(search), m_root(root) {}
+    UCTWorker(GameState& state, UCTSearch* search, UCTNode* root);
     void operator()();
 
 private:
     GameState& m_rootstate;
     UCTSearch* m_search;
     UCTNode* m_root;
+    NodeArena& m_arena;
+    // The analyze tags of the thread that started the search.
+    const AnalyzeTags& m_analyze_tags;
 };
 
 #endif
@@ -33,7 +33,7 @@
 #include <boost/math/distributions/students_t.hpp>
 #include <cstdarg>
 #include <cstdio>
-#include <mutex>
+#include <cstdlib>
 
 #include "Utils.h"
 
@@ -47,9 +47,17 @@
 #endif
 
 #include "GTP.h"
+#include "Logger.h"
+#include "Transport.h"
 
 Utils::ThreadPool thread_pool;
 
+static thread_local Connection* tl_gtp_connection = nullptr;
+
+void Utils::set_gtp_connection(Connection* const connection) {
+    tl_gtp_connection = connection;
+}
+
 // Values memorized in the table (determines the size).
 auto constexpr z_entries = 1000;
 std::array<float, z_entries> z_lookup;
@@ -83,6 +91,9 @@ float Utils::cached_t_quantile(const int v) {
 
 // Checks if there are any available input data.
 bool Utils::input_pending() {
+    if (tl_gtp_connection) {
+        return tl_gtp_connection->input_pending();
+    }
 // POSIX systems: OS supports select().
 #ifdef HAVE_SELECT
     fd_set read_fds;
@@ -132,22 +143,36 @@ bool Utils::input_pending() {
 #endif
 }
 
-static std::mutex IOmutex;
+// The log file is written on a background thread.
+// Never destroyed, as messages may still come in while exiting.
+static Logger& logger() {
+    static auto* const s_logger = []() {
+        auto* const instance = new Logger();
+        std::atexit([]() { logger().stop(); });
+        std::at_quick_exit([]() { logger().stop(); });
+        return instance;
+    }();
+    return *s_logger;
+}
 
-// Output handler
-static void myprintf_base(const char* const fmt, va_list ap) {
+// Formats the whole message first, so that it goes out in one write.
+static std::string format(const char* const fmt, va_list ap) {
     va_list ap2;
     va_copy(ap2, ap);
-
-    // Prints on the error console.
-    vfprintf(stderr, fmt, ap);
-
-    if (cfg_logfile_handle) {
-        std::lock_guard<std::mutex> lock(IOmutex);
-        // Prints on file logs.
-        vfprintf(cfg_logfile_handle, fmt, ap2);
-    }
+    const auto size = vsnprintf(nullptr, 0, fmt, ap2);
     va_end(ap2);
+    if (size <= 0) {
+        return {};
+    }
+    auto text = std::string(size, '\0');
+    vsnprintf(&text[0], size + 1, fmt, ap);
+    return text;
+}
+
+// Output handler
+static void myprintf_base(const char* const fmt, va_list ap) {
+    // Prints on the error console and on file logs.
+    logger().write(format(fmt, ap), true, cfg_logfile_handle);
 }
 
 //Prints messages.
@@ -171,13 +196,19 @@ void Utils::myprintf_error(const char* const fmt, ...) {
     va_end(ap);
 }
 
-static void gtp_fprintf(FILE* const file, const std::string& prefix,
-                        const char* const fmt, va_list ap) {
-    // Prefix print.
-    fprintf(file, "%s ", prefix.c_str());
-    // Prints the message from the specified file.
-    vfprintf(file, fmt, ap);
-    fprintf(file, "\n\n");
+// Sends GTP output to the session of the thread or to stdout with one
+// write, then logs it.  The end of a response flushes the log file.
+static void gtp_output(const std::string& text) {
+    if (tl_gtp_connection) {
+        tl_gtp_connection->send(text);
+    } else {
+        fwrite(text.data(), 1, text.size(), stdout);
+    }
+    // Output's route to the log file.
+    if (cfg_logfile_handle) {
+        logger().write(std::string(text), false, cfg_logfile_handle);
+        logger().flush();
+    }
 }
 
 static void gtp_base_printf(const int id, std::string prefix,
@@ -186,12 +217,7 @@ static void gtp_base_printf(const int id, std::string prefix,
     if (id != -1) {
         prefix += std::to_string(id);
     }
-    gtp_fprintf(stdout, prefix, fmt, ap);
-    // Output's route to the log file.
-    if (cfg_logfile_handle) {
-        std::lock_guard<std::mutex> lock(IOmutex);
-        gtp_fprintf(cfg_logfile_handle, prefix, fmt, ap);
-    }
+    gtp_output(prefix + " " + format(fmt, ap) + "\n\n");
 }
 
 void Utils::gtp_printf(const int id, const char* const fmt, ...) {
@@ -206,15 +232,8 @@ void Utils::gtp_printf(const int id, const char* const fmt, ...) {
 void Utils::gtp_printf_raw(const char* const fmt, ...) {
     va_list ap;
     va_start(ap, fmt);
-    vfprintf(stdout, fmt, ap);
+    gtp_output(format(fmt, ap));
     va_end(ap);
-
-    if (cfg_logfile_handle) {
-        std::lock_guard<std::mutex> lock(IOmutex);
-        va_start(ap, fmt);
-        vfprintf(cfg_logfile_handle, fmt, ap);
-        va_end(ap);
-    }
 }
 
 // Print error messages with GTP format.
@@ -229,8 +248,7 @@ void Utils::gtp_fail_printf(const int id, const char* const fmt, ...) {
 void Utils::log_input(const std::string& input) {
     // Checks the configuration of the log files.
     if (cfg_logfile_handle) {
-        std::lock_guard<std::mutex> lock(IOmutex);
-        fprintf(cfg_logfile_handle, ">>%s\n", input.c_str());
+        logger().write(">>" + input + "\n", false, cfg_logfile_handle);
     }
 }
 
@@ -40,6 +40,8 @@
 
 extern Utils::ThreadPool thread_pool;
 
+class Connection;
+
 namespace Utils {
     void myprintf_error(const char* fmt, ...);
     void myprintf(const char* fmt, ...);
@@ -48,6 +50,10 @@ namespace Utils {
     void gtp_fail_printf(int id, const char* fmt, ...);
     void log_input(const std::string& input);
     bool input_pending();
+    // GTP output of the calling thread goes to the connection instead of
+    // stdout, and input_pending() checks it instead of stdin, while a
+    // session of the GTP server runs on the thread.  nullptr ends that.
+    void set_gtp_connection(Connection* connection);
 
     template <class T>
     void atomic_add(std::atomic<T>& f, const T d) {
@@ -0,0 +1,160 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <string>
+
+#include "BatchAnalysis.h"
+#include "FastBoard.h"
+#include "GTP.h"
+#include "GameState.h"
+#include "Random.h"
+#include "SGFTree.h"
+#include "Zobrist.h"
+
+namespace {
+
+// Time the search gets for a move with infinite time.
+constexpr auto INFINITE_TIME = 31 * 24 * 60 * 60 * 100;
+
+GameState played(const std::string& moves) {
+    auto state = GameState{};
+    state.init_game(BOARD_SIZE, KOMI);
+    auto color = std::string{"b"};
+    for (auto pos = size_t{0}; pos < moves.size(); pos += 2) {
+        EXPECT_TRUE(state.play_textmove(color, moves.substr(pos, 2)));
+        color = (color == "b" ? "w" : "b");
+    }
+    return state;
+}
+
+bool same_position(const GameState& first, const GameState& second) {
+    return first.board.get_hash() == second.board.get_hash()
+           && first.get_movenum() == second.get_movenum()
+           && first.get_to_move() == second.get_to_move();
+}
+
+bool has_infinite_time(const GameState& state) {
+    return state.get_timecontrol().max_time_for_move(
+               BOARD_SIZE, state.get_to_move(), state.get_movenum())
+           == INFINITE_TIME;
+}
+
+} // namespace
+
+class BatchAnalysisTest : public ::testing::Test {
+public:
+    BatchAnalysisTest() {
+        GTP::setup_default_parameters();
+        auto rng = Random{5489};
+        Zobrist::init_zobrist(rng);
+    }
+};
+
+TEST_F(BatchAnalysisTest, MoveList) {
+    const auto expected = played("f4d3c6d6");
+
+    auto state = GameState{};
+    ASSERT_TRUE(BatchAnalysis::parse_position("moves f4d3c6d6", state));
+    EXPECT_TRUE(same_position(state, expected));
+    EXPECT_TRUE(has_infinite_time(state));
+
+    auto spaced = GameState{};
+    ASSERT_TRUE(BatchAnalysis::parse_position("moves  f4 d3\tC6 d6 ", spaced));
+    EXPECT_TRUE(same_position(spaced, expected));
+
+    auto start = GameState{};
+    ASSERT_TRUE(BatchAnalysis::parse_position("moves", start));
+    EXPECT_TRUE(same_position(start, played("")));
+}
+
+// Black has no move after these moves, and passes.
+TEST_F(BatchAnalysisTest, ForcedPass) {
+    const auto opening = std::string{"f4f3f2d3c4g2h2h1e2f1f5g5e6h3h5d1"};
+
+    auto state = GameState{};
+    ASSERT_TRUE(BatchAnalysis::parse_position("moves " + opening + "c6",
+                                              state));
+    EXPECT_EQ(state.get_movenum(), size_t{18});
+    EXPECT_EQ(state.get_to_move(), FastBoard::BLACK);
+
+    auto explicit_pass = GameState{};
+    ASSERT_TRUE(BatchAnalysis::parse_position(
+        "moves " + opening + " pass c6", explicit_pass));
+    EXPECT_TRUE(same_position(explicit_pass, state));
+
+    // Passing is only allowed without a legal move.
+    EXPECT_FALSE(
+        BatchAnalysis::parse_position("moves " + opening + "c6 pass", state));
+}
+
+TEST_F(BatchAnalysisTest, Sgf) {
+    // The game is saved with a time limit, the search ignores it.
+    auto game = played("f4d3c6d6");
+    const auto filename = (boost::filesystem::temp_directory_path()
+                           / boost::filesystem::unique_path())
+                              .string();
+    {
+        auto out = std::ofstream{filename};
+        out << SGFTree::state_to_string(game, FastBoard::WHITE);
+    }
+
+    auto state = GameState{};
+    ASSERT_TRUE(BatchAnalysis::parse_position("sgf " + filename, state));
+    EXPECT_TRUE(same_position(state, game));
+    EXPECT_TRUE(has_infinite_time(state));
+
+    auto partial = GameState{};
+    ASSERT_TRUE(
+        BatchAnalysis::parse_position("sgf " + filename + " 3", partial));
+    EXPECT_TRUE(same_position(partial, played("f4d3")));
+    EXPECT_TRUE(has_infinite_time(partial));
+
+    boost::filesystem::remove(filename);
+}
+
+TEST_F(BatchAnalysisTest, BadInput) {
+    auto state = GameState{};
+    EXPECT_FALSE(BatchAnalysis::parse_position("", state));
+    EXPECT_FALSE(BatchAnalysis::parse_position("position f5", state));
+    EXPECT_FALSE(BatchAnalysis::parse_position("moves f4 z9", state));
+    EXPECT_FALSE(BatchAnalysis::parse_position("moves f4 f4", state));
+    EXPECT_FALSE(BatchAnalysis::parse_position("moves f5", state));
+    EXPECT_FALSE(BatchAnalysis::parse_position("moves pass", state));
+    EXPECT_FALSE(BatchAnalysis::parse_position("moves f4 resign", state));
+    EXPECT_FALSE(BatchAnalysis::parse_position("moves f4 -d3", state));
+    EXPECT_FALSE(BatchAnalysis::parse_position("sgf", state));
+
+    const auto missing = (boost::filesystem::temp_directory_path()
+                          / boost::filesystem::unique_path())
+                             .string();
+    EXPECT_FALSE(BatchAnalysis::parse_position("sgf " + missing, state));
+}
@@ -0,0 +1,172 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include <algorithm>
+#include <gtest/gtest.h>
+#include <memory>
+#include <vector>
+
+#include "CPUPipe.h"
+#include "GTP.h"
+#include "Network.h"
+#include "Random.h"
+
+class CPUPipeTest : public ::testing::Test {
+protected:
+    static constexpr auto OUTPUTS = 16;
+    static constexpr auto INPUT_SIZE =
+        Network::INPUT_CHANNELS * NUM_INTERSECTIONS;
+
+    CPUPipeTest() : m_rng{5489} {
+        GTP::setup_default_parameters();
+
+        m_raw_weights.resize(OUTPUTS * Network::INPUT_CHANNELS * 9);
+        for (auto& w : m_raw_weights) {
+            w = random_weight();
+        }
+        auto weights = std::make_shared<ForwardPipe::ForwardPipeWeights>();
+        weights->m_conv_weights_raw.emplace_back(m_raw_weights);
+        weights->m_conv_weights.emplace_back(Network::winograd_transform_f(
+            m_raw_weights, OUTPUTS, Network::INPUT_CHANNELS));
+        weights->m_batchnorm_means.emplace_back(OUTPUTS, 0.0f);
+        weights->m_batchnorm_stddevs.emplace_back(OUTPUTS, 1.0f);
+        weights->m_conv_pol_w.resize(OUTPUTS * Network::OUTPUTS_POLICY);
+        weights->m_conv_val_w.resize(OUTPUTS * Network::OUTPUTS_VALUE);
+
+        m_pipe.m_input_channels = OUTPUTS;
+        m_pipe.push_weights(3, Network::INPUT_CHANNELS, OUTPUTS, weights);
+    }
+
+    float random_weight() {
+        return m_rng.randfix<2001>() / 1000.0f - 1.0f;
+    }
+
+    // Fills the planes of one position with random 0/1 stones.
+    void random_stones(std::vector<float>& input, const int batch) {
+        const auto planes = &input[batch * INPUT_SIZE];
+        for (auto i = 0; i < (Network::INPUT_CHANNELS - 2) * NUM_INTERSECTIONS;
+             i++) {
+            planes[i] = float(m_rng.randfix<3>() == 0);
+        }
+    }
+
+    void fill_tomove(std::vector<float>& input, const int batch,
+                     const float first, const float second) {
+        const auto plane = &input[batch * INPUT_SIZE
+                                  + (Network::INPUT_CHANNELS - 2)
+                                        * NUM_INTERSECTIONS];
+        std::fill_n(plane, NUM_INTERSECTIONS, first);
+        std::fill_n(plane + NUM_INTERSECTIONS, NUM_INTERSECTIONS, second);
+    }
+
+    std::vector<float> sparse_convolve(const std::vector<float>& input,
+                                       const int batch_size) {
+        auto acc = std::vector<float>{};
+        auto output = std::vector<float>(batch_size * OUTPUTS
+                                         * NUM_INTERSECTIONS);
+        for (auto b = 0; b < batch_size; b++) {
+            m_pipe.sparse_input_convolve(OUTPUTS, input, acc, output, b);
+        }
+        return output;
+    }
+
+    std::vector<float> dense_convolve(const CPUPipe::ConvAlgorithm algorithm,
+                                      const std::vector<float>& input,
+                                      const int batch_size) {
+        auto params = CPUPipe::ConvParams{};
+        params.algorithm = algorithm;
+        const auto weights = CPUPipe::prepare_conv3(
+            algorithm, m_raw_weights, OUTPUTS, Network::INPUT_CHANNELS);
+        auto buffers = CPUPipe::ConvBuffers{};
+        auto output = std::vector<float>(batch_size * OUTPUTS
+                                         * NUM_INTERSECTIONS);
+        CPUPipe::convolve3(params, OUTPUTS, Network::INPUT_CHANNELS, input,
+                           weights, buffers, output, batch_size);
+        return output;
+    }
+
+    bool use_sparse_input(const std::vector<float>& input,
+                          const int batch_size) const {
+        return m_pipe.use_sparse_input(input, batch_size);
+    }
+
+    Random m_rng;
+    std::vector<float> m_raw_weights;
+    CPUPipe m_pipe;
+};
+
+// The sparse input convolution must give the dense results for every
+// kind of side to move planes: fully set ones take the precomputed
+// responses, the others are accumulated like stones.
+TEST_F(CPUPipeTest, SparseInputMatchesDense) {
+    constexpr auto BATCH = 5;
+    auto input = std::vector<float>(BATCH * INPUT_SIZE);
+    for (auto b = 0; b < BATCH; b++) {
+        random_stones(input, b);
+    }
+    fill_tomove(input, 0, 1.0f, 0.0f);
+    fill_tomove(input, 1, 0.0f, 1.0f);
+    fill_tomove(input, 2, 0.0f, 0.0f);
+    fill_tomove(input, 3, 1.0f, 1.0f);
+    // Almost full planes go through the generic path.
+    fill_tomove(input, 4, 1.0f, 0.0f);
+    input[4 * INPUT_SIZE + (Network::INPUT_CHANNELS - 2) * NUM_INTERSECTIONS
+          + 10] = 0.0f;
+
+    const auto sparse = sparse_convolve(input, BATCH);
+    for (auto a = 0; a < CPUPipe::CONV_ALGORITHMS; a++) {
+        const auto algorithm = static_cast<CPUPipe::ConvAlgorithm>(a);
+        const auto dense = dense_convolve(algorithm, input, BATCH);
+        ASSERT_EQ(sparse.size(), dense.size());
+        for (auto i = size_t{0}; i < dense.size(); i++) {
+            ASSERT_NEAR(sparse[i], dense[i], 1e-3f)
+                << CPUPipe::algorithm_to_string(algorithm) << " at " << i;
+        }
+    }
+}
+
+// Empty and full stone planes.  Both positions share the scratch
+// space, so the second one must not start from the sums of the first.
+TEST_F(CPUPipeTest, SparseInputEdgeCases) {
+    auto input = std::vector<float>(2 * INPUT_SIZE, 0.0f);
+    fill_tomove(input, 0, 0.0f, 1.0f);
+    std::fill_n(begin(input) + INPUT_SIZE,
+                (Network::INPUT_CHANNELS - 2) * NUM_INTERSECTIONS, 1.0f);
+    fill_tomove(input, 1, 1.0f, 0.0f);
+
+    EXPECT_TRUE(use_sparse_input(input, 1));
+    EXPECT_FALSE(use_sparse_input(input, 2));
+
+    const auto sparse = sparse_convolve(input, 2);
+    const auto dense =
+        dense_convolve(CPUPipe::ConvAlgorithm::DIRECT, input, 2);
+    for (auto i = size_t{0}; i < dense.size(); i++) {
+        ASSERT_NEAR(sparse[i], dense[i], 1e-3f) << "at " << i;
+    }
+}
@@ -0,0 +1,319 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <boost/filesystem.hpp>
+#include <cmath>
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "FullBoard.h"
+#include "GTP.h"
+#include "NNCache.h"
+#include "Network.h"
+#include "Random.h"
+#include "Zobrist.h"
+
+namespace {
+
+// Hashes spread over the whole table, as Zobrist hashes are.
+std::uint64_t test_hash(const int i) {
+    return (std::uint64_t(i) + 1) * 0x9E3779B97F4A7C15ULL;
+}
+
+// A result whose every field can be checked against the hash.
+NNCache::Netresult test_result(const std::uint64_t hash) {
+    auto result = NNCache::Netresult{};
+    const auto base = float(hash % 1000);
+    for (auto idx = size_t{0}; idx < NUM_INTERSECTIONS; idx++) {
+        result.policy[idx] = base + idx;
+    }
+    result.policy_pass = base + NUM_INTERSECTIONS;
+    result.winrate = base / 1000.0f;
+    return result;
+}
+
+bool matches(const std::uint64_t hash, const NNCache::Netresult& result) {
+    const auto expected = test_result(hash);
+    return result.policy == expected.policy
+           && result.policy_pass == expected.policy_pass
+           && result.winrate == expected.winrate;
+}
+
+// Vertex that the symmetry maps the given vertex to.
+int symmetric_vertex(const FullBoard& board, const int vertex,
+                     const int symmetry) {
+    const auto xy =
+        Network::get_symmetry(board.get_xy(vertex), symmetry, BOARD_SIZE);
+    return board.get_vertex(xy.first, xy.second);
+}
+
+// Gives a stone the other color, keeping the hashes up to date, by
+// flipping it from a neighbour that already has that color.
+bool recolor(FullBoard& board, const int vertex, const int color) {
+    constexpr auto SIDE = BOARD_SIZE + 2;
+    // Same order as the directions of the board.
+    constexpr std::array<int, 8> DIRS = {-SIDE,    1,        SIDE,     -1,
+                                         -SIDE + 1, SIDE + 1, SIDE - 1,
+                                         -SIDE - 1};
+    for (auto dir = 0; dir < 8; dir++) {
+        if (board.get_state(vertex - DIRS[dir]) == color) {
+            board.flip(vertex - DIRS[dir], vertex + DIRS[dir], dir);
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace
+
+class NNCacheTest : public ::testing::Test {
+public:
+    NNCacheTest() {
+        GTP::setup_default_parameters();
+    }
+};
+
+// Writers keep replacing the entries of a small table while readers
+// look them up: a hit must never mix two entries.
+TEST_F(NNCacheTest, ConcurrentReadWrite) {
+    auto cache = NNCache{64 * NNCache::ENTRY_SIZE};
+    cache.set_encoding(NNCache::Encoding::FULL);
+
+    constexpr auto KEYS = 1024;
+    constexpr auto ROUNDS = 200;
+    auto done = std::atomic<bool>{false};
+    auto hits = std::atomic<int>{0};
+    auto torn = std::atomic<int>{0};
+
+    auto readers = std::vector<std::thread>{};
+    for (auto t = 0; t < 2; t++) {
+        readers.emplace_back([&, t]() {
+            auto result = NNCache::Netresult{};
+            auto i = t;
+            while (!done) {
+                const auto hash = test_hash(i++ % KEYS);
+                if (cache.lookup(hash, result)) {
+                    hits++;
+                    if (!matches(hash, result)) {
+                        torn++;
+                    }
+                }
+            }
+        });
+    }
+    auto writers = std::vector<std::thread>{};
+    for (auto t = 0; t < 2; t++) {
+        writers.emplace_back([&, t]() {
+            for (auto round = 0; round < ROUNDS; round++) {
+                for (auto i = t; i < KEYS; i += 2) {
+                    const auto hash = test_hash((i + round * 7) % KEYS);
+                    cache.insert(hash, test_result(hash));
+                }
+            }
+        });
+    }
+    for (auto& writer : writers) {
+        writer.join();
+    }
+    done = true;
+    for (auto& reader : readers) {
+        reader.join();
+    }
+
+    EXPECT_GT(hits, 0);
+    EXPECT_EQ(torn, 0);
+
+    // Once the writers are gone every entry left is intact.
+    auto result = NNCache::Netresult{};
+    auto found = 0;
+    for (auto i = 0; i < KEYS; i++) {
+        if (cache.lookup(test_hash(i), result)) {
+            found++;
+            EXPECT_TRUE(matches(test_hash(i), result));
+        }
+    }
+    EXPECT_GT(found, 0);
+    EXPECT_LE(found, 64);
+}
+
+// Compact entries keep the winrate exact and every policy within half
+// a quantization step, about 3%, of what was stored.
+TEST_F(NNCacheTest, CompactRoundTrip) {
+    auto cache = NNCache{};
+    cache.set_encoding(NNCache::Encoding::COMPACT);
+
+    auto stored = NNCache::Netresult{};
+    for (auto idx = size_t{0}; idx < NUM_INTERSECTIONS; idx++) {
+        // Priors from 1 down to about 1e-6.
+        stored.policy[idx] = std::exp(-13.8f * idx / (NUM_INTERSECTIONS - 1));
+    }
+    // Exactly zero must stay zero, tiny priors must not become zero.
+    stored.policy[1] = 0.0f;
+    stored.policy[2] = 1e-12f;
+    stored.policy_pass = 0.0123f;
+    stored.winrate = 0.61803f;
+
+    const auto hash = test_hash(42);
+    cache.insert(hash, stored);
+    auto result = NNCache::Netresult{};
+    ASSERT_TRUE(cache.lookup(hash, result));
+
+    const auto tolerance = std::exp(1.0f / 32.0f) - 1.0f + 1e-5f;
+    for (auto idx = size_t{0}; idx < NUM_INTERSECTIONS; idx++) {
+        if (idx == 1 || idx == 2) {
+            continue;
+        }
+        EXPECT_NEAR(result.policy[idx] / stored.policy[idx], 1.0f, tolerance)
+            << "index " << idx;
+    }
+    EXPECT_EQ(result.policy[1], 0.0f);
+    EXPECT_GT(result.policy[2], 0.0f);
+    EXPECT_LT(result.policy[2], 1e-6f);
+    EXPECT_NEAR(result.policy_pass / stored.policy_pass, 1.0f, tolerance);
+    EXPECT_EQ(result.winrate, stored.winrate);
+}
+
+// A saved cache loads back bit for bit, but only for the same network.
+TEST_F(NNCacheTest, SaveLoad) {
+    constexpr auto NETWORK_HASH = std::uint64_t{0x0123456789ABCDEFULL};
+    constexpr auto KEYS = 500;
+    const auto filename = (boost::filesystem::temp_directory_path()
+                           / boost::filesystem::unique_path())
+                              .string();
+
+    auto saved = NNCache{};
+    saved.set_encoding(NNCache::Encoding::FULL);
+    for (auto i = 0; i < KEYS; i++) {
+        saved.insert(test_hash(i), test_result(test_hash(i)));
+    }
+    ASSERT_TRUE(saved.save(filename, NETWORK_HASH));
+
+    auto loaded = NNCache{};
+    loaded.set_encoding(NNCache::Encoding::FULL);
+    ASSERT_TRUE(loaded.load(filename, NETWORK_HASH));
+    auto result = NNCache::Netresult{};
+    for (auto i = 0; i < KEYS; i++) {
+        ASSERT_TRUE(loaded.lookup(test_hash(i), result));
+        EXPECT_TRUE(matches(test_hash(i), result));
+    }
+
+    auto other = NNCache{};
+    EXPECT_FALSE(other.load(filename, NETWORK_HASH + 1));
+    EXPECT_FALSE(other.lookup(test_hash(0), result));
+
+    boost::filesystem::remove(filename);
+}
+
+// The same game played on the board turned by each of the eight
+// symmetries must give the same canonical hash after every move.
+TEST_F(NNCacheTest, CanonicalHashSymmetries) {
+    auto zobrist_rng = Random{5489};
+    Zobrist::init_zobrist(zobrist_rng);
+
+    auto boards = std::array<FullBoard, Network::NUM_SYMMETRIES>{};
+    for (auto& board : boards) {
+        board.reset_board(BOARD_SIZE);
+    }
+    // Half of the symmetries swap the colors of the starting stones.
+    const auto& reference = boards[0];
+    for (auto sym = 1; sym < Network::NUM_SYMMETRIES; sym++) {
+        for (auto y = 0; y < BOARD_SIZE; y++) {
+            for (auto x = 0; x < BOARD_SIZE; x++) {
+                const auto vertex = reference.get_vertex(x, y);
+                const auto color = reference.get_state(vertex);
+                const auto target = symmetric_vertex(reference, vertex, sym);
+                if (color != FastBoard::EMPTY
+                    && boards[sym].get_state(target) != color) {
+                    ASSERT_TRUE(recolor(boards[sym], target, color));
+                }
+            }
+        }
+    }
+
+    auto rng = Random{1234};
+    auto color = int{FastBoard::BLACK};
+    auto passes = 0;
+    auto moves = 0;
+    while (passes < 2) {
+        auto legal = std::vector<int>{};
+        for (auto y = 0; y < BOARD_SIZE; y++) {
+            for (auto x = 0; x < BOARD_SIZE; x++) {
+                const auto vertex = reference.get_vertex(x, y);
+                if (reference.get_state(vertex) == FastBoard::EMPTY
+                    && reference.is_play_legal(color, vertex)) {
+                    legal.emplace_back(vertex);
+                }
+            }
+        }
+        if (legal.empty()) {
+            passes++;
+        } else {
+            passes = 0;
+            moves++;
+            const auto move = legal[rng.randuint64(legal.size())];
+            for (auto sym = 0; sym < Network::NUM_SYMMETRIES; sym++) {
+                boards[sym].update_board(
+                    color, symmetric_vertex(reference, move, sym));
+            }
+        }
+        color = !color;
+        for (auto& board : boards) {
+            board.set_to_move(color);
+        }
+
+        const auto canonical = reference.get_canonical_hash();
+        auto smallest = reference.calc_hash();
+        for (auto sym = 1; sym < Network::NUM_SYMMETRIES; sym++) {
+            smallest = std::min(smallest, reference.calc_symmetry_hash(
+                                              FastBoard::NO_VERTEX, sym));
+        }
+        EXPECT_EQ(canonical.first, smallest);
+        for (const auto& board : boards) {
+            EXPECT_EQ(board.get_canonical_hash().first, canonical.first);
+        }
+    }
+    // The game got somewhere, on boards that really are turned.
+    EXPECT_GT(moves, NUM_INTERSECTIONS / 2);
+    for (auto sym = 1; sym < Network::NUM_SYMMETRIES; sym++) {
+        for (auto y = 0; y < BOARD_SIZE; y++) {
+            for (auto x = 0; x < BOARD_SIZE; x++) {
+                const auto vertex = reference.get_vertex(x, y);
+                EXPECT_EQ(boards[sym].get_state(
+                              symmetric_vertex(reference, vertex, sym)),
+                          reference.get_state(vertex));
+            }
+        }
+    }
+}
@@ -0,0 +1,118 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Michael O and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include <atomic>
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <vector>
+
+#include "ThreadPool.h"
+
+using namespace Utils;
+
+TEST(ThreadPoolTest, WaitAll) {
+    auto pool = ThreadPool{};
+    pool.initialize(4);
+    auto group = ThreadGroup{pool};
+
+    auto count = std::atomic<int>{0};
+    for (auto i = 0; i < 1000; i++) {
+        group.add_task([&count]() { count++; });
+    }
+    group.wait_all();
+    EXPECT_EQ(count, 1000);
+
+    // The group can be reused.
+    for (auto i = 0; i < 10; i++) {
+        group.add_task([&count](const int add) { count += add; }, 2);
+    }
+    group.wait_all();
+    EXPECT_EQ(count, 1020);
+
+    auto future = pool.add_task([](const int a, const int b) { return a * b; },
+                                6, 7);
+    EXPECT_EQ(future.get(), 42);
+}
+
+// Every worker blocking in an inner wait_all must not deadlock the pool:
+// the waiting workers run the queued tasks themselves.
+TEST(ThreadPoolTest, NestedParallelFor) {
+    auto pool = ThreadPool{};
+    pool.initialize(2);
+
+    constexpr auto COUNT = 64;
+    auto hits = std::vector<std::atomic<int>>(COUNT * COUNT);
+    auto outer = ThreadGroup{pool};
+    outer.add_task([&]() {
+        auto group = ThreadGroup{pool};
+        group.parallel_for(8, COUNT, [&](const int begin, const int end) {
+            for (auto i = begin; i < end; i++) {
+                auto inner = ThreadGroup{pool};
+                inner.parallel_for(8, COUNT, [&, i](const int b, const int e) {
+                    for (auto j = b; j < e; j++) {
+                        hits[i * COUNT + j]++;
+                    }
+                });
+            }
+        });
+    });
+    outer.wait_all();
+
+    for (const auto& hit : hits) {
+        EXPECT_EQ(hit, 1);
+    }
+}
+
+TEST(ThreadPoolTest, ExceptionPropagation) {
+    auto pool = ThreadPool{};
+    pool.initialize(4);
+    auto group = ThreadGroup{pool};
+
+    auto count = std::atomic<int>{0};
+    for (auto i = 0; i < 100; i++) {
+        group.add_task([&count, i]() {
+            if (i == 50) {
+                throw std::runtime_error("task failed");
+            }
+            count++;
+        });
+    }
+    EXPECT_THROW(group.wait_all(), std::runtime_error);
+    // The other tasks still ran.
+    EXPECT_EQ(count, 99);
+
+    // The exception is only thrown once.
+    group.add_task([&count]() { count++; });
+    EXPECT_NO_THROW(group.wait_all());
+    EXPECT_EQ(count, 100);
+
+    auto future =
+        pool.add_task([]() -> int { throw std::logic_error("no result"); });
+    EXPECT_THROW(future.get(), std::logic_error);
+}